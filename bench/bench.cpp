@@ -0,0 +1,382 @@
+#include "cpplazy/cpplazy.hpp"
+#include "startup.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Compares cpplazy against the usual alternatives: a function-local static, std::call_once and a double-checked atomic<T*>.
+// Usage: cpplazy-bench [--format=json|csv] [--threads=N] [--init-ns=N] [--quick]
+namespace bench_helpers
+{
+    using clock = std::chrono::steady_clock;
+
+    template<typename T>
+    void do_not_optimize(const T& value)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        asm volatile("" : : "r,m"(value) : "memory");
+#else
+        static volatile const void* sink;
+        sink = &value;
+#endif
+    }
+
+    struct options
+    {
+        bool csv = false;
+        unsigned max_threads = std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() : 1;
+        std::int64_t init_ns = 2000; // Simulated cost of a cold initialization
+        std::uint64_t warm_iterations = 50'000'000;
+        std::uint64_t move_iterations = 5'000'000;
+    };
+
+    options g_options;
+
+    struct result
+    {
+        std::string benchmark;
+        std::string variant;
+        unsigned threads;
+        double value;
+        const char* unit;
+        std::uint64_t iterations;
+    };
+
+    std::vector<result> g_results;
+
+    void report(std::string benchmark, std::string variant, unsigned threads, double value, const char* unit, std::uint64_t iterations)
+    {
+        g_results.push_back({ std::move(benchmark), std::move(variant), threads, value, unit, iterations });
+        std::cerr << g_results.back().benchmark << " / " << g_results.back().variant << " / " << threads << " threads: " << value << " " << unit << std::endl;
+    }
+
+    int init_value()
+    {
+        // Busy wait, so waiting threads see a realistic initialization window
+        const auto end = clock::now() + std::chrono::nanoseconds(g_options.init_ns);
+        while (clock::now() < end)
+        {
+        }
+        return 42;
+    }
+
+    struct call_once_holder
+    {
+        std::once_flag flag;
+        std::optional<int> value;
+
+        int& get()
+        {
+            std::call_once(flag, [this] { value = init_value(); });
+            return *value;
+        }
+    };
+
+    struct double_checked_holder
+    {
+        std::atomic<int*> value{ nullptr };
+        std::mutex mutex;
+
+        ~double_checked_holder()
+        {
+            delete value.load();
+        }
+
+        int& get()
+        {
+            int* p = value.load(std::memory_order_acquire);
+            if (!p)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                p = value.load(std::memory_order_relaxed);
+                if (!p)
+                {
+                    p = new int(init_value());
+                    value.store(p, std::memory_order_release);
+                }
+            }
+            return *p;
+        }
+    };
+
+    // Every instantiation is a separate function-local static, so each round of the cold benchmarks gets a fresh one
+    template<std::size_t I>
+    int& local_static()
+    {
+        static int value = init_value();
+        return value;
+    }
+
+    constexpr std::size_t cold_rounds = 64;
+
+    template<std::size_t... I>
+    constexpr auto make_local_statics(std::index_sequence<I...>)
+    {
+        return std::array<int& (*)(), sizeof...(I)>{ &local_static<I>... };
+    }
+
+    constexpr auto local_statics = make_local_statics(std::make_index_sequence<cold_rounds>{});
+
+    int (*const lazy_static_init)() = &init_value;
+    using lazy_static_int = cpplazy::lazy_static<int, int (*)()>;
+
+    template<typename F>
+    double ns_per_op(std::uint64_t iterations, F&& f)
+    {
+        const auto begin = clock::now();
+        for (std::uint64_t i = 0; i < iterations; i++)
+        {
+            f();
+        }
+        return std::chrono::duration<double, std::nano>(clock::now() - begin).count() / iterations;
+    }
+
+    // Runs access() on `threads` threads at once (released together), for each of `rounds` fresh objects,
+    // and returns the average time from release until the last thread got the value.
+    template<typename Access>
+    double cold_contention(unsigned threads, std::size_t rounds, Access&& access)
+    {
+        std::atomic<std::size_t> round{ 0 };
+        std::atomic<unsigned> done{ 0 };
+        std::atomic<bool> stop{ false };
+        std::vector<std::thread> workers;
+        for (unsigned t = 1; t < threads; t++)
+        {
+            workers.emplace_back([&] {
+                for (std::size_t seen = 0;; seen++)
+                {
+                    std::size_t r;
+                    while ((r = round.load(std::memory_order_acquire)) == seen && !stop.load(std::memory_order_relaxed))
+                    {
+                        std::this_thread::yield();
+                    }
+                    if (stop.load(std::memory_order_relaxed))
+                    {
+                        return;
+                    }
+                    do_not_optimize(access(r - 1));
+                    done.fetch_add(1, std::memory_order_acq_rel);
+                }
+            });
+        }
+
+        double total_ns = 0;
+        for (std::size_t r = 0; r < rounds; r++)
+        {
+            done.store(0, std::memory_order_relaxed);
+            const auto begin = clock::now();
+            round.store(r + 1, std::memory_order_release);
+            do_not_optimize(access(r));
+            while (done.load(std::memory_order_acquire) != threads - 1)
+            {
+                std::this_thread::yield();
+            }
+            total_ns += std::chrono::duration<double, std::nano>(clock::now() - begin).count();
+        }
+        stop.store(true);
+        for (auto& w : workers)
+        {
+            w.join();
+        }
+        return total_ns / rounds;
+    }
+
+    void warm_deref()
+    {
+        const std::uint64_t n = g_options.warm_iterations;
+
+        cpplazy::lazy<int> lazy{ &init_value };
+        *lazy;
+        report("warm_deref", "cpplazy::lazy", 1, ns_per_op(n, [&] { do_not_optimize(*lazy); }), "ns/op", n);
+
+        static lazy_static_int static_lazy{ lazy_static_init };
+        *static_lazy;
+        report("warm_deref", "cpplazy::lazy_static", 1, ns_per_op(n, [&] { do_not_optimize(*static_lazy); }), "ns/op", n);
+
+        local_static<0>();
+        report("warm_deref", "function-local static", 1, ns_per_op(n, [&] { do_not_optimize(local_static<0>()); }), "ns/op", n);
+
+        call_once_holder once;
+        once.get();
+        report("warm_deref", "std::call_once", 1, ns_per_op(n, [&] { do_not_optimize(once.get()); }), "ns/op", n);
+
+        double_checked_holder checked;
+        checked.get();
+        report("warm_deref", "atomic<T*> double-checked", 1, ns_per_op(n, [&] { do_not_optimize(checked.get()); }), "ns/op", n);
+    }
+
+    void cold_init()
+    {
+        for (unsigned threads = 1; threads <= g_options.max_threads; threads *= 2)
+        {
+            {
+                std::vector<cpplazy::lazy<int>> lazies;
+                for (std::size_t r = 0; r < cold_rounds; r++)
+                {
+                    lazies.emplace_back(&init_value);
+                }
+                report("cold_init", "cpplazy::lazy", threads, cold_contention(threads, cold_rounds, [&](std::size_t r) { return *lazies[r]; }), "ns/round", cold_rounds);
+            }
+            {
+                std::unique_ptr<call_once_holder[]> holders(new call_once_holder[cold_rounds]);
+                report("cold_init", "std::call_once", threads, cold_contention(threads, cold_rounds, [&](std::size_t r) { return holders[r].get(); }), "ns/round", cold_rounds);
+            }
+            {
+                std::unique_ptr<double_checked_holder[]> holders(new double_checked_holder[cold_rounds]);
+                report("cold_init", "atomic<T*> double-checked", threads, cold_contention(threads, cold_rounds, [&](std::size_t r) { return holders[r].get(); }), "ns/round", cold_rounds);
+            }
+            if (threads == 1)
+            {
+                // Function-local statics can only be cold once per process
+                report("cold_init", "function-local static", threads, cold_contention(threads, cold_rounds, [&](std::size_t r) { return local_statics[r](); }), "ns/round", cold_rounds);
+            }
+        }
+    }
+
+    void move_cost()
+    {
+        const std::uint64_t n = g_options.move_iterations;
+        auto make_vector = [] { return std::vector<int>(1000, 1); };
+
+        {
+            cpplazy::lazy<std::vector<int>> a{ make_vector };
+            cpplazy::lazy<std::vector<int>> b{ make_vector };
+            a->value();
+            report("move_assign", "cpplazy::lazy (initialized)", 1, ns_per_op(n, [&] { b = std::move(a); a = std::move(b); do_not_optimize(a); }), "ns/op", n);
+        }
+        {
+            cpplazy::lazy<std::vector<int>> a{ make_vector };
+            cpplazy::lazy<std::vector<int>> b{ make_vector };
+            report("move_assign", "cpplazy::lazy (uninitialized)", 1, ns_per_op(n, [&] { b = std::move(a); a = std::move(b); do_not_optimize(a); }), "ns/op", n);
+        }
+        {
+            std::optional<std::vector<int>> a = make_vector();
+            std::optional<std::vector<int>> b;
+            report("move_assign", "std::optional", 1, ns_per_op(n, [&] { b = std::move(a); a = std::move(b); do_not_optimize(a); }), "ns/op", n);
+        }
+        {
+            // The double-checked pattern holds a pointer, which is what it moves
+            std::unique_ptr<std::vector<int>> a(new std::vector<int>(make_vector()));
+            std::unique_ptr<std::vector<int>> b;
+            report("move_assign", "atomic<T*> double-checked (as unique_ptr)", 1, ns_per_op(n, [&] { b = std::move(a); a = std::move(b); do_not_optimize(a); }), "ns/op", n);
+        }
+    }
+
+    void memory()
+    {
+        report("memory", "cpplazy::lazy<int>", 1, sizeof(cpplazy::lazy<int>), "bytes", 1);
+        report("memory", "cpplazy::lazy<void>", 1, sizeof(cpplazy::lazy<void>), "bytes", 1);
+        report("memory", "cpplazy::lazy_static<int>", 1, sizeof(lazy_static_int), "bytes", 1);
+        report("memory", "cpplazy::once_cell<int>", 1, sizeof(cpplazy::once_cell<int>), "bytes", 1);
+        report("memory", "function-local static int (with guard)", 1, sizeof(int) + sizeof(std::uint64_t), "bytes", 1);
+        report("memory", "std::call_once + optional<int>", 1, sizeof(call_once_holder), "bytes", 1);
+        report("memory", "atomic<T*> double-checked + mutex + int", 1, sizeof(double_checked_holder) + sizeof(int), "bytes", 1);
+    }
+
+    // The cost each kind of object added to the startup of this process, declared at namespace scope (see startup.cpp).
+    // lazy_static, call_once and double-checked holders are constant initialized, but the destructor of the double-checked
+    // holder is still registered at startup. lazy<T> runs a constructor.
+    // Function-local statics are left out: they are not initialized at startup.
+    void startup()
+    {
+        for (const bench_startup::measurement& m : bench_startup::measured())
+        {
+            report("startup_dynamic_init", m.variant, 1, m.ns / 1000, "us", bench_startup::startup_globals);
+        }
+    }
+
+    std::string json_escape(const std::string& s)
+    {
+        std::string out;
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\')
+            {
+                out += '\\';
+            }
+            out += c;
+        }
+        return out;
+    }
+
+    void print_results()
+    {
+        if (g_options.csv)
+        {
+            std::cout << "benchmark,variant,threads,value,unit,iterations\n";
+            for (const result& r : g_results)
+            {
+                std::cout << r.benchmark << ",\"" << r.variant << "\"," << r.threads << "," << r.value << "," << r.unit << "," << r.iterations << "\n";
+            }
+            return;
+        }
+
+        std::cout << "{\n  \"context\": { \"timestamp\": " << std::time(nullptr)
+                  << ", \"hardware_concurrency\": " << std::thread::hardware_concurrency()
+                  << ", \"init_ns\": " << g_options.init_ns << " },\n  \"results\": [\n";
+        for (std::size_t i = 0; i < g_results.size(); i++)
+        {
+            const result& r = g_results[i];
+            std::cout << "    { \"benchmark\": \"" << r.benchmark << "\", \"variant\": \"" << json_escape(r.variant) << "\", \"threads\": " << r.threads
+                      << ", \"value\": " << r.value << ", \"unit\": \"" << r.unit << "\", \"iterations\": " << r.iterations << " }"
+                      << (i + 1 < g_results.size() ? ",\n" : "\n");
+        }
+        std::cout << "  ]\n}" << std::endl;
+    }
+}
+
+using namespace bench_helpers;
+
+int main(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--format=csv")
+        {
+            g_options.csv = true;
+        }
+        else if (arg == "--format=json")
+        {
+            g_options.csv = false;
+        }
+        else if (arg.rfind("--threads=", 0) == 0)
+        {
+            g_options.max_threads = static_cast<unsigned>(std::max(1, std::stoi(arg.substr(10))));
+        }
+        else if (arg.rfind("--init-ns=", 0) == 0)
+        {
+            g_options.init_ns = std::stoll(arg.substr(10));
+        }
+        else if (arg == "--quick")
+        {
+            g_options.warm_iterations /= 100;
+            g_options.move_iterations /= 100;
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--format=json|csv] [--threads=N] [--init-ns=N] [--quick]" << std::endl;
+            return 1;
+        }
+    }
+
+    // Human readable progress goes to stderr, the results to stdout
+    warm_deref();
+    cold_init();
+    move_cost();
+    memory();
+    startup();
+    print_results();
+}
@@ -0,0 +1,82 @@
+#include "startup.hpp"
+#include "cpplazy/cpplazy.hpp"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <optional>
+
+// startup_globals namespace-scope objects of each kind, between timestamps. Dynamic initialization within a
+// translation unit runs in declaration order, so the gap between two timestamps is what that kind added to startup.
+namespace
+{
+    using clock = std::chrono::steady_clock;
+
+    int startup_value()
+    {
+        return 42;
+    }
+
+    using lazy_static_int = cpplazy::lazy_static<int, int (*)()>;
+
+    struct call_once_global
+    {
+        std::once_flag flag;
+        std::optional<int> value;
+    };
+
+    struct double_checked_global
+    {
+        std::atomic<int*> value{ nullptr };
+        std::mutex mutex;
+
+        ~double_checked_global()
+        {
+            delete value.load();
+        }
+    };
+
+#define STARTUP_CONCAT2(a, b) a##b
+#define STARTUP_CONCAT(a, b) STARTUP_CONCAT2(a, b)
+#define STARTUP_1(declare) declare(STARTUP_CONCAT(global_, __COUNTER__))
+#define STARTUP_10(declare) STARTUP_1(declare) STARTUP_1(declare) STARTUP_1(declare) STARTUP_1(declare) STARTUP_1(declare) \
+    STARTUP_1(declare) STARTUP_1(declare) STARTUP_1(declare) STARTUP_1(declare) STARTUP_1(declare)
+#define STARTUP_100(declare) STARTUP_10(declare) STARTUP_10(declare) STARTUP_10(declare) STARTUP_10(declare) STARTUP_10(declare) \
+    STARTUP_10(declare) STARTUP_10(declare) STARTUP_10(declare) STARTUP_10(declare) STARTUP_10(declare)
+#define STARTUP_1000(declare) STARTUP_100(declare) STARTUP_100(declare) STARTUP_100(declare) STARTUP_100(declare) STARTUP_100(declare) \
+    STARTUP_100(declare) STARTUP_100(declare) STARTUP_100(declare) STARTUP_100(declare) STARTUP_100(declare)
+
+#define DECLARE_LAZY(name) cpplazy::lazy<int> name{ &startup_value };
+#define DECLARE_LAZY_STATIC(name) lazy_static_int name{ &startup_value };
+#define DECLARE_CALL_ONCE(name) call_once_global name;
+#define DECLARE_DOUBLE_CHECKED(name) double_checked_global name;
+
+    const clock::time_point before_lazy = clock::now();
+    STARTUP_1000(DECLARE_LAZY)
+    const clock::time_point before_lazy_static = clock::now();
+    STARTUP_1000(DECLARE_LAZY_STATIC)
+    const clock::time_point before_call_once = clock::now();
+    STARTUP_1000(DECLARE_CALL_ONCE)
+    const clock::time_point before_double_checked = clock::now();
+    STARTUP_1000(DECLARE_DOUBLE_CHECKED)
+    const clock::time_point after_all = clock::now();
+
+    double ns_between(clock::time_point begin, clock::time_point end)
+    {
+        return std::chrono::duration<double, std::nano>(end - begin).count();
+    }
+}
+
+namespace bench_startup
+{
+    const std::size_t startup_globals = 1000;
+
+    std::vector<measurement> measured()
+    {
+        return {
+            { "cpplazy::lazy", ns_between(before_lazy, before_lazy_static) },
+            { "cpplazy::lazy_static", ns_between(before_lazy_static, before_call_once) },
+            { "std::call_once", ns_between(before_call_once, before_double_checked) },
+            { "atomic<T*> double-checked", ns_between(before_double_checked, after_all) },
+        };
+    }
+}
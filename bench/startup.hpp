@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Startup cost of namespace-scope objects, measured while this process started (see startup.cpp).
+namespace bench_startup
+{
+    struct measurement
+    {
+        const char* variant;
+        double ns;
+    };
+
+    extern const std::size_t startup_globals;
+
+    std::vector<measurement> measured();
+}
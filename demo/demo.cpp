@@ -1,80 +1,342 @@
 #include "cpplazy/cpplazy.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
 #include <vector>
-#include <mutex>
-#include <sstream>
 
+// A load generator built on the .NET Lazy<T> example (https://docs.microsoft.com/en-us/dotnet/api/system.lazy-1):
+// a herd of threads hits cold lazy<large_object>s at the same time, then keeps reading them.
+// Reports latency histograms of the first access (including the wait for the initializing thread) and of steady state accesses.
+//
+// Usage: cpplazy-demo [--threads=N] [--init-us=N] [--rate=N] [--lazies=N] [--accesses=N] [--histogram]
+//   --threads   Threads accessing the lazies (default: hardware_concurrency() - 1)
+//   --init-us   Time large_object's constructor takes, in microseconds (default: 1000)
+//   --rate      Steady state accesses per second per thread, 0 for as fast as possible (default: 0)
+//   --lazies    Number of cold lazies, the herd is released on each in turn (default: 1)
+//   --accesses  Steady state accesses per thread (default: 100000)
+//   --histogram Print the full percentile distribution, not just the summary
 namespace demo_helpers
 {
+    using clock = std::chrono::steady_clock;
+
+    struct options
+    {
+        unsigned threads = std::max(2u, std::thread::hardware_concurrency()) - 1; // hardware_concurrency() is 0 when unknown
+        std::int64_t init_us = 1000;
+        std::uint64_t rate = 0;
+        size_t lazies = 1;
+        std::uint64_t accesses = 100'000;
+        bool histogram = false;
+    };
+
     class large_object
     {
     public:
-        large_object(std::thread::id initialized_by) :
+        large_object(std::thread::id initialized_by, std::chrono::microseconds init_cost) :
             m_init_by(initialized_by)
         {
-            std::cout << "large_object was created on thread id " << m_init_by << std::endl;
+            // Stands in for loading a file, parsing a config etc.
+            const auto end = clock::now() + init_cost;
+            while (clock::now() < end)
+            {
+            }
         }
-        std::vector<long> data{ 1'000'000 }; //Init to one million longs
+        std::vector<long> data = std::vector<long>(1'000'000); //Init to one million longs
         std::thread::id m_init_by;
     };
 
-    large_object create_large_object()
+    // Log-linear buckets, as in HdrHistogram: values below 2^sub_bucket_bits are exact,
+    // above that each power of two is split into 2^(sub_bucket_bits - 1) buckets (under 1% error with 8 bits).
+    class latency_histogram
     {
-        return large_object(std::this_thread::get_id());
-    }
+    public:
+        static constexpr unsigned sub_bucket_bits = 8;
+        static constexpr std::uint64_t sub_bucket_count = 1ull << sub_bucket_bits;
+        static constexpr std::uint64_t half_count = sub_bucket_count / 2;
+
+        latency_histogram() :
+            m_counts(bucket_index(~0ull) + 1)
+        {
+        }
+
+        void record(std::uint64_t value_ns)
+        {
+            m_counts[bucket_index(value_ns)]++;
+            m_total++;
+            m_max = std::max(m_max, value_ns);
+            m_min = std::min(m_min, value_ns);
+            m_sum += static_cast<double>(value_ns);
+        }
+
+        void merge(const latency_histogram& other)
+        {
+            for (size_t i = 0; i < m_counts.size(); i++)
+            {
+                m_counts[i] += other.m_counts[i];
+            }
+            m_total += other.m_total;
+            m_max = std::max(m_max, other.m_max);
+            m_min = std::min(m_min, other.m_min);
+            m_sum += other.m_sum;
+        }
+
+        std::uint64_t count() const { return m_total; }
+        std::uint64_t max() const { return m_max; }
+        std::uint64_t min() const { return m_total ? m_min : 0; }
+        double mean() const { return m_total ? m_sum / m_total : 0; }
+
+        // The highest value equivalent to the bucket holding the given percentile (0..100)
+        std::uint64_t value_at_percentile(double percentile) const
+        {
+            const auto wanted = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::ceil(percentile / 100 * m_total)));
+            std::uint64_t seen = 0;
+            for (size_t i = 0; i < m_counts.size(); i++)
+            {
+                seen += m_counts[i];
+                if (seen >= wanted)
+                {
+                    return std::min(bucket_highest_value(i), m_max);
+                }
+            }
+            return m_max;
+        }
+
+        // Same columns as HdrHistogram's outputPercentileDistribution()
+        void print_distribution(std::FILE* out) const
+        {
+            std::fprintf(out, "%14s %14s %12s %14s\n\n", "Value(us)", "Percentile", "TotalCount", "1/(1-Percentile)");
+            std::uint64_t seen = 0;
+            double next_percentile = 0;
+            int tick = 0;
+            for (size_t i = 0; i < m_counts.size() && seen < m_total; i++)
+            {
+                if (!m_counts[i])
+                {
+                    continue;
+                }
+                seen += m_counts[i];
+                const double percentile = 100.0 * seen / m_total;
+                if (percentile >= next_percentile || seen == m_total)
+                {
+                    const double value_us = std::min(bucket_highest_value(i), m_max) / 1000.0;
+                    if (seen == m_total)
+                    {
+                        std::fprintf(out, "%14.3f %14.12f %12llu\n", value_us, 1.0, static_cast<unsigned long long>(seen));
+                    }
+                    else
+                    {
+                        std::fprintf(out, "%14.3f %14.12f %12llu %14.2f\n", value_us, percentile / 100, static_cast<unsigned long long>(seen), 1 / (1 - percentile / 100));
+                    }
+                    // Halve the remaining distance to 100% in 5 steps each, like HdrHistogram's default ticks
+                    while (next_percentile <= percentile && percentile < 100)
+                    {
+                        next_percentile = 100 * (1 - std::pow(2.0, -(++tick) / 5.0));
+                    }
+                }
+            }
+            std::fprintf(out, "#[Mean = %.3f, Max = %.3f, Total count = %llu]\n", mean() / 1000, m_max / 1000.0, static_cast<unsigned long long>(m_total));
+        }
 
-    struct large_object_creator
+    private:
+        static size_t bucket_index(std::uint64_t value)
+        {
+            if (value < sub_bucket_count)
+            {
+                return static_cast<size_t>(value);
+            }
+            unsigned shift = 0;
+            while ((value >> shift) >= sub_bucket_count)
+            {
+                shift++;
+            }
+            // (value >> shift) is in [half_count, sub_bucket_count)
+            return static_cast<size_t>(sub_bucket_count + (shift - 1) * half_count + ((value >> shift) - half_count));
+        }
+
+        static std::uint64_t bucket_highest_value(size_t index)
+        {
+            if (index < sub_bucket_count)
+            {
+                return index;
+            }
+            const auto shift = static_cast<unsigned>((index - sub_bucket_count) / half_count + 1);
+            const std::uint64_t sub = (index - sub_bucket_count) % half_count + half_count;
+            return ((sub + 1) << shift) - 1;
+        }
+
+        std::vector<std::uint64_t> m_counts;
+        std::uint64_t m_total = 0;
+        std::uint64_t m_max = 0;
+        std::uint64_t m_min = ~0ull;
+        double m_sum = 0;
+    };
+
+    // Releases all threads at once, so they hit the cold lazy as a herd
+    class spin_barrier
     {
-        large_object operator()()
+    public:
+        explicit spin_barrier(unsigned count) :
+            m_count(count)
+        {
+        }
+
+        void arrive_and_wait()
         {
-            return large_object(std::this_thread::get_id());
+            const unsigned generation = m_generation.load(std::memory_order_acquire);
+            if (m_waiting.fetch_add(1, std::memory_order_acq_rel) + 1 == m_count)
+            {
+                m_waiting.store(0, std::memory_order_relaxed);
+                m_generation.store(generation + 1, std::memory_order_release);
+                return;
+            }
+            while (m_generation.load(std::memory_order_acquire) == generation)
+            {
+                std::this_thread::yield();
+            }
         }
+
+    private:
+        const unsigned m_count;
+        std::atomic<unsigned> m_waiting{ 0 };
+        std::atomic<unsigned> m_generation{ 0 };
     };
 
-    long thread_id_to_long(std::thread::id id)
+    std::uint64_t elapsed_ns(clock::time_point from, clock::time_point to)
+    {
+        return to > from ? static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count()) : 0;
+    }
+
+    void print_summary(const char* title, const latency_histogram& histogram, bool full)
     {
-        std::ostringstream oss;
-        oss << id;
-        return std::stoll(oss.str());
+        std::printf("\n%s (%llu samples, us)\n", title, static_cast<unsigned long long>(histogram.count()));
+        std::printf("  min %10.3f  mean %10.3f  p50 %10.3f  p90 %10.3f  p99 %10.3f  p99.9 %10.3f  p99.99 %10.3f  max %10.3f\n",
+            histogram.min() / 1000.0, histogram.mean() / 1000.0,
+            histogram.value_at_percentile(50) / 1000.0, histogram.value_at_percentile(90) / 1000.0,
+            histogram.value_at_percentile(99) / 1000.0, histogram.value_at_percentile(99.9) / 1000.0,
+            histogram.value_at_percentile(99.99) / 1000.0, histogram.max() / 1000.0);
+        if (full)
+        {
+            std::printf("\n");
+            histogram.print_distribution(stdout);
+        }
+    }
+
+    bool parse_options(int argc, char* argv[], options& opts)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            const std::string arg = argv[i];
+            const auto value = [&arg](size_t prefix) { return std::stoull(arg.substr(prefix)); };
+            if (arg.rfind("--threads=", 0) == 0)
+            {
+                opts.threads = std::max(1u, static_cast<unsigned>(value(10)));
+            }
+            else if (arg.rfind("--init-us=", 0) == 0)
+            {
+                opts.init_us = static_cast<std::int64_t>(value(10));
+            }
+            else if (arg.rfind("--rate=", 0) == 0)
+            {
+                opts.rate = value(7);
+            }
+            else if (arg.rfind("--lazies=", 0) == 0)
+            {
+                opts.lazies = std::max<size_t>(1, value(9));
+            }
+            else if (arg.rfind("--accesses=", 0) == 0)
+            {
+                opts.accesses = value(11);
+            }
+            else if (arg == "--histogram")
+            {
+                opts.histogram = true;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        return true;
     }
 }
 
 using namespace demo_helpers;
 
-// The below demo is a similar example as given by .NET's Lazy<T> documentation (https://docs.microsoft.com/en-us/dotnet/api/system.lazy-1)
-int main()
+int main(int argc, char* argv[])
 {
-    //Create the lazy object with a lambda function that returns the type of the lazy object
-    cpplazy::lazy<large_object> lazy_large_object{ [] { return large_object(std::this_thread::get_id()); } };
+    options opts;
+    if (!parse_options(argc, argv, opts))
+    {
+        std::cerr << "Usage: " << argv[0] << " [--threads=N] [--init-us=N] [--rate=N] [--lazies=N] [--accesses=N] [--histogram]" << std::endl;
+        return 1;
+    }
 
-    //The following lines show additional way to initialize the lazy object (to get the same result as above):
-    cpplazy::lazy<large_object> lazy_large_object2{ &create_large_object };
-    large_object_creator lrg_obj_crtr;
-    cpplazy::lazy<large_object> lazy_large_object3{ lrg_obj_crtr };
+    //Create the lazy objects with a lambda function that returns the type of the lazy object.
+    //large_object is not created until the first time you use its '->' (arrow) operator or its '*' (dereference) operator
+    const std::chrono::microseconds init_cost(opts.init_us);
+    std::vector<std::unique_ptr<cpplazy::lazy<large_object>>> lazies;
+    for (size_t i = 0; i < opts.lazies; i++)
+    {
+        lazies.push_back(std::make_unique<cpplazy::lazy<large_object>>([init_cost] { return large_object(std::this_thread::get_id(), init_cost); }));
+    }
 
-    std::cout << "large_object is not created until the first time you \n" 
-                 " use its '->' (arrow) operator or its '*' (dereference) operator\n" << std::endl;
-    
+    std::cout << "Starting " << opts.threads << " threads that will access " << opts.lazies << " cold large_object(s) "
+              << "(init " << opts.init_us << "us, " << opts.accesses << " steady state accesses per thread at "
+              << (opts.rate ? std::to_string(opts.rate) + "/s" : std::string("full speed")) << ")" << std::endl;
+
+    std::vector<latency_histogram> first_access(opts.threads);
+    std::vector<latency_histogram> steady_state(opts.threads);
+    spin_barrier barrier(opts.threads);
     std::vector<std::thread> threads;
-    std::mutex lock;
-    const auto num_threads = std::thread::hardware_concurrency() - 1;
 
-    std::cout << "Creating, and starting " << num_threads << " threads that will access the same large_object now\n" << std::endl;
-        for (size_t i = 0; i < num_threads; i++)
+    for (unsigned t = 0; t < opts.threads; t++)
     {
-        threads.emplace_back([&] {
+        threads.emplace_back([&, t] {
             //This is the thread code
 
-            large_object& obj = *lazy_large_object;
+            // First access: the whole herd is released on each cold lazy, one of the threads initializes it and the rest wait
+            for (size_t i = 0; i < lazies.size(); i++)
+            {
+                barrier.arrive_and_wait();
+                const auto begin = clock::now();
+                large_object& obj = **lazies[i];
+                first_access[t].record(elapsed_ns(begin, clock::now()));
+                (void)obj;
+            }
 
-            // IMPORTANT: lazy initialization is thread-safe, but it doesn't protect the
-            //            object after creation. You must lock the object before accessing it,
-            //            unless the type is thread safe. (large_object is not thread safe.)
+            // Steady state: keep reading the (now initialized) lazies.
+            // With a fixed rate, latency is measured from the intended start of each access, so a stall isn't hidden
+            // by the accesses it delayed (coordinated omission).
+            barrier.arrive_and_wait();
+            const auto interval = opts.rate ? std::chrono::nanoseconds(1'000'000'000 / opts.rate) : std::chrono::nanoseconds(0);
+            auto next = clock::now();
+            long sink = 0;
+            for (std::uint64_t n = 0; n < opts.accesses; n++)
             {
-                std::lock_guard lg(lock); //C++17 type deduction
-                auto thread_id = std::this_thread::get_id();
-                obj.data[0] = thread_id_to_long(thread_id);
-                std::cout << "Initialized by thread " << obj.m_init_by << "; last used by thread " << obj.data[0] << "." << std::endl;
+                if (opts.rate)
+                {
+                    while (clock::now() < next)
+                    {
+                        std::this_thread::yield();
+                    }
+                }
+                const auto begin = opts.rate ? next : clock::now();
+                // IMPORTANT: lazy initialization is thread-safe, but it doesn't protect the
+                //            object after creation, which is why the threads only read it here.
+                sink += (**lazies[n % lazies.size()]).data[0];
+                steady_state[t].record(elapsed_ns(begin, clock::now()));
+                next += interval;
+            }
+            if (sink == -1)
+            {
+                std::cout << "unreachable" << std::endl;
             }
         });
     }
@@ -84,6 +346,18 @@ int main()
         t.join();
     }
 
-    std::cout << "\nPress any key to end program" << std::endl;
-    getchar();
-}
\ No newline at end of file
+    latency_histogram first_access_total;
+    latency_histogram steady_state_total;
+    for (unsigned t = 0; t < opts.threads; t++)
+    {
+        first_access_total.merge(first_access[t]);
+        steady_state_total.merge(steady_state[t]);
+    }
+
+    for (size_t i = 0; i < lazies.size() && i < 4; i++)
+    {
+        std::cout << "large_object " << i << " was created on thread id " << (**lazies[i]).m_init_by << std::endl;
+    }
+    print_summary("First access latency", first_access_total, opts.histogram);
+    print_summary("Steady state access latency", steady_state_total, opts.histogram);
+}
@@ -21,57 +21,1939 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
 #include <mutex>
 #include <functional>
+#include <memory>
 #include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
 #include <utility>
+#include <variant>
+#include <vector>
+
+// Set to 0 to compile without try/catch. Detected automatically for -fno-exceptions builds.
+#ifndef CPPLAZY_HAS_EXCEPTIONS
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS) || defined(_CPPUNWIND)
+#define CPPLAZY_HAS_EXCEPTIONS 1
+#else
+#define CPPLAZY_HAS_EXCEPTIONS 0
+#endif
+#endif
+
+// Expands to `constinit` where available, to have the compiler verify a lazy_static does no work before main.
+#ifndef CPPLAZY_CONSTINIT
+#if defined(__cpp_constinit)
+#define CPPLAZY_CONSTINIT constinit
+#elif defined(__clang__)
+#define CPPLAZY_CONSTINIT [[clang::require_constant_initialization]]
+#else
+#define CPPLAZY_CONSTINIT
+#endif
+#endif
+
+// Set to 1 to record every initialization and blocked wait into a ring buffer, which trace.hpp exports as a Chrome trace.
+// Implies CPPLAZY_ENABLE_INSTRUMENTATION. Must be the same in every translation unit.
+#ifndef CPPLAZY_ENABLE_TRACING
+#define CPPLAZY_ENABLE_TRACING 0
+#endif
+
+// The number of most recent events kept by the trace ring buffer.
+#ifndef CPPLAZY_TRACE_BUFFER_SIZE
+#define CPPLAZY_TRACE_BUFFER_SIZE 4096
+#endif
+
+// Set to 1 to count CPU cycles, instructions, last level cache misses and page faults of every initializer (see lazy_stats) 
+// using perf_event_open. Linux only, the counters stay zero if perf events are not permitted (see perf_event_paranoid) or not supported.
+// Implies CPPLAZY_ENABLE_INSTRUMENTATION. Must be the same in every translation unit.
+#ifndef CPPLAZY_ENABLE_PERF_COUNTERS
+#define CPPLAZY_ENABLE_PERF_COUNTERS 0
+#endif
+
+// Set to 1 to collect per-object counters (see lazy_stats) and call instrumentation_hooks. 
+// Must be the same in every translation unit. When 0, nothing is added to any object or code path.
+#ifndef CPPLAZY_ENABLE_INSTRUMENTATION
+#define CPPLAZY_ENABLE_INSTRUMENTATION (CPPLAZY_ENABLE_TRACING || CPPLAZY_ENABLE_PERF_COUNTERS)
+#endif
+
+// Set to 1 to detect an initializer that waits for its own lazy object, directly or through other lazy objects on any thread,
+// which would otherwise hang forever. The chain of objects is reported to the cycle handler (see set_cycle_handler()).
+// Must be the same in every translation unit.
+#ifndef CPPLAZY_ENABLE_CYCLE_DETECTION
+#define CPPLAZY_ENABLE_CYCLE_DETECTION 0
+#endif
+
+#if (CPPLAZY_ENABLE_TRACING || CPPLAZY_ENABLE_PERF_COUNTERS) && !CPPLAZY_ENABLE_INSTRUMENTATION
+#error "CPPLAZY_ENABLE_TRACING and CPPLAZY_ENABLE_PERF_COUNTERS require CPPLAZY_ENABLE_INSTRUMENTATION"
+#endif
+
+#if CPPLAZY_ENABLE_PERF_COUNTERS && defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if CPPLAZY_ENABLE_CYCLE_DETECTION
+#include <cstdio>
+#include <cstdlib>
+#endif
+
+#if CPPLAZY_ENABLE_TRACING && !defined(_WIN32)
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#endif
 
 
 namespace cpplazy
 {
+    // Counters collected by every lazy object (lazy, lazy_static, lazy_expected, once_cell...) 
+    // when built with CPPLAZY_ENABLE_INSTRUMENTATION, see stats(). Moving or swapping an object moves its counters too.
+    struct lazy_stats
+    {
+        std::chrono::nanoseconds init_time{};    // Time spent in the last successful initialization
+        std::chrono::nanoseconds first_access{}; // Time from process start (static initialization) to the first access. Zero if never accessed
+        std::uint64_t failures = 0;              // Initializations that threw
+        std::uint64_t waits = 0;                 // Number of times a thread blocked, waiting for another thread to initialize
+        std::chrono::nanoseconds total_wait{};
+        std::chrono::nanoseconds max_wait{};
+
+        // Counted during the last successful initialization with CPPLAZY_ENABLE_PERF_COUNTERS (zero when not available).
+        // Includes lazy objects initialized by the init function, but not time spent waiting for other threads.
+        std::uint64_t cycles = 0;
+        std::uint64_t instructions = 0;
+        std::uint64_t cache_misses = 0; // Last level cache
+        std::uint64_t page_faults = 0;
+    };
+
+    enum class lazy_state
+    {
+        uninitialized,
+        initializing,
+        initialized
+    };
+
+    // A named lazy object, as listed by for_each_registered().
+    struct lazy_info
+    {
+        std::string name;
+        lazy_state state = lazy_state::uninitialized;
+        std::size_t value_size = 0; // An estimate of the memory held by the value (see detail::estimate_value_size()), zero when not initialized
+        lazy_stats stats;
+    };
+
+#if CPPLAZY_ENABLE_INSTRUMENTATION
+    // Passed to the instrumentation hooks.
+    struct init_event
+    {
+        const void* object;                  // Identifies the lazy object (the address of its state)
+        std::chrono::nanoseconds duration{}; // on_init_end: time spent initializing, on_wait: time spent blocked
+        bool succeeded = false;              // on_init_end only
+    };
+
+    // Global hooks, for feeding initializations into your own metrics. 
+    // Called on the initializing (or waiting) thread, so they must be thread safe, and should be quick.
+    // They must not throw: on_init_begin runs once the object is marked as initializing, where an exception would leave 
+    // it initializing forever, so an exception escaping any hook calls std::terminate().
+    struct instrumentation_hooks
+    {
+        void (*on_init_begin)(const init_event&) = nullptr;
+        void (*on_init_end)(const init_event&) = nullptr;
+        void (*on_wait)(const init_event&) = nullptr;
+    };
+#endif
+
+    namespace detail
+    {
+#if CPPLAZY_ENABLE_INSTRUMENTATION
+        inline std::int64_t now_ns() noexcept
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        inline const std::int64_t process_start_ns = now_ns();
+
+        struct hook_table
+        {
+            std::atomic<void (*)(const init_event&)> on_init_begin{ nullptr };
+            std::atomic<void (*)(const init_event&)> on_init_end{ nullptr };
+            std::atomic<void (*)(const init_event&)> on_wait{ nullptr };
+        };
+
+        inline hook_table& hooks() noexcept
+        {
+            static hook_table table;
+            return table;
+        }
+
+        inline void call_hook(const std::atomic<void (*)(const init_event&)>& hook, const init_event& e) noexcept
+        {
+            if (auto f = hook.load(std::memory_order_acquire))
+            {
+                f(e);
+            }
+        }
+
+#if CPPLAZY_ENABLE_PERF_COUNTERS
+        // The calling thread's counters, opened on first use and counting for the thread's lifetime,
+        // so nested initializations can be measured by reading them before and after.
+        class thread_perf_counters
+        {
+        public:
+
+            static constexpr std::size_t count = 4; // cycles, instructions, cache misses, page faults
+
+            struct values
+            {
+                std::uint64_t counts[count] = {};
+            };
+
+        private:
+
+            int m_fds[count] = { -1, -1, -1, -1 };
+
+        public:
+
+            thread_perf_counters() noexcept
+            {
+#if defined(__linux__)
+                static const std::uint32_t types[count] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE };
+                static const std::uint64_t configs[count] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_SW_PAGE_FAULTS };
+                for (std::size_t i = 0; i < count; i++)
+                {
+                    perf_event_attr attr;
+                    std::memset(&attr, 0, sizeof(attr));
+                    attr.size = sizeof(attr);
+                    attr.type = types[i];
+                    attr.config = configs[i];
+                    attr.exclude_kernel = 1; // Allowed with the default perf_event_paranoid
+                    attr.exclude_hv = 1;
+                    // Each counter is opened on its own, so an unsupported one (e.g. hardware counters in a VM) doesn't disable the others
+                    m_fds[i] = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+                }
+#endif
+            }
+
+            ~thread_perf_counters()
+            {
+#if defined(__linux__)
+                for (int fd : m_fds)
+                {
+                    if (fd != -1)
+                    {
+                        ::close(fd);
+                    }
+                }
+#endif
+            }
+
+            thread_perf_counters(const thread_perf_counters&) = delete;
+            thread_perf_counters& operator=(const thread_perf_counters&) = delete;
+
+            static thread_perf_counters& instance() noexcept
+            {
+                static thread_local thread_perf_counters counters;
+                return counters;
+            }
+
+            bool available() const noexcept
+            {
+                for (int fd : m_fds)
+                {
+                    if (fd != -1)
+                    {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            values read() const noexcept
+            {
+                values v;
+#if defined(__linux__)
+                for (std::size_t i = 0; i < count; i++)
+                {
+                    if (m_fds[i] == -1 || ::read(m_fds[i], &v.counts[i], sizeof(v.counts[i])) != static_cast<ssize_t>(sizeof(v.counts[i])))
+                    {
+                        v.counts[i] = 0;
+                    }
+                }
+#endif
+                return v;
+            }
+        };
+#endif
+
+        class stats_counters
+        {
+            std::int64_t m_init_begin_ns = 0; // Only accessed by the initializing thread
+            std::atomic<std::int64_t> m_init_ns{ 0 };
+            std::atomic<std::int64_t> m_first_access_ns{ 0 };
+            std::atomic<std::uint64_t> m_failures{ 0 };
+            std::atomic<std::uint64_t> m_waits{ 0 };
+            std::atomic<std::int64_t> m_total_wait_ns{ 0 };
+            std::atomic<std::int64_t> m_max_wait_ns{ 0 };
+#if CPPLAZY_ENABLE_PERF_COUNTERS
+            thread_perf_counters::values m_perf_begin; // Only accessed by the initializing thread
+            std::atomic<std::uint64_t> m_perf[thread_perf_counters::count] = {};
+#endif
+
+        public:
+
+            constexpr stats_counters() noexcept = default;
+
+            void on_access() noexcept
+            {
+                if (m_first_access_ns.load(std::memory_order_relaxed) == 0)
+                {
+                    std::int64_t never = 0;
+                    const std::int64_t since_start = now_ns() - process_start_ns;
+                    m_first_access_ns.compare_exchange_strong(never, since_start > 0 ? since_start : 1, std::memory_order_relaxed);
+                }
+            }
+
+            void on_init_begin(const void* object) noexcept
+            {
+                call_hook(hooks().on_init_begin, init_event{ object });
+#if CPPLAZY_ENABLE_PERF_COUNTERS
+                m_perf_begin = thread_perf_counters::instance().read();
+#endif
+                m_init_begin_ns = now_ns();
+            }
+
+            std::int64_t init_begin_ns() const noexcept
+            {
+                return m_init_begin_ns;
+            }
+
+            void on_init_end(const void* object, bool succeeded) noexcept
+            {
+                const std::int64_t duration = now_ns() - m_init_begin_ns;
+                if (succeeded)
+                {
+                    m_init_ns.store(duration, std::memory_order_relaxed);
+#if CPPLAZY_ENABLE_PERF_COUNTERS
+                    const thread_perf_counters::values end = thread_perf_counters::instance().read();
+                    for (std::size_t i = 0; i < thread_perf_counters::count; i++)
+                    {
+                        m_perf[i].store(end.counts[i] - m_perf_begin.counts[i], std::memory_order_relaxed);
+                    }
+#endif
+                }
+                else
+                {
+                    m_failures.fetch_add(1, std::memory_order_relaxed);
+                }
+                call_hook(hooks().on_init_end, init_event{ object, std::chrono::nanoseconds(duration), succeeded });
+            }
+
+            void on_wait(const void* object, std::int64_t wait_begin_ns) noexcept
+            {
+                const std::int64_t duration = now_ns() - wait_begin_ns;
+                m_waits.fetch_add(1, std::memory_order_relaxed);
+                m_total_wait_ns.fetch_add(duration, std::memory_order_relaxed);
+                std::int64_t max = m_max_wait_ns.load(std::memory_order_relaxed);
+                while (duration > max && !m_max_wait_ns.compare_exchange_weak(max, duration, std::memory_order_relaxed))
+                {
+                }
+                call_hook(hooks().on_wait, init_event{ object, std::chrono::nanoseconds(duration) });
+            }
+
+            void swap(stats_counters& other) noexcept
+            {
+                swap_relaxed(m_init_ns, other.m_init_ns);
+                swap_relaxed(m_first_access_ns, other.m_first_access_ns);
+                swap_relaxed(m_failures, other.m_failures);
+                swap_relaxed(m_waits, other.m_waits);
+                swap_relaxed(m_total_wait_ns, other.m_total_wait_ns);
+                swap_relaxed(m_max_wait_ns, other.m_max_wait_ns);
+#if CPPLAZY_ENABLE_PERF_COUNTERS
+                for (std::size_t i = 0; i < thread_perf_counters::count; i++)
+                {
+                    swap_relaxed(m_perf[i], other.m_perf[i]);
+                }
+#endif
+            }
+
+            void reset() noexcept
+            {
+                stats_counters empty;
+                swap(empty);
+            }
+
+            lazy_stats load() const noexcept
+            {
+                lazy_stats stats;
+                stats.init_time = std::chrono::nanoseconds(m_init_ns.load(std::memory_order_relaxed));
+                stats.first_access = std::chrono::nanoseconds(m_first_access_ns.load(std::memory_order_relaxed));
+                stats.failures = m_failures.load(std::memory_order_relaxed);
+                stats.waits = m_waits.load(std::memory_order_relaxed);
+                stats.total_wait = std::chrono::nanoseconds(m_total_wait_ns.load(std::memory_order_relaxed));
+                stats.max_wait = std::chrono::nanoseconds(m_max_wait_ns.load(std::memory_order_relaxed));
+#if CPPLAZY_ENABLE_PERF_COUNTERS
+                stats.cycles = m_perf[0].load(std::memory_order_relaxed);
+                stats.instructions = m_perf[1].load(std::memory_order_relaxed);
+                stats.cache_misses = m_perf[2].load(std::memory_order_relaxed);
+                stats.page_faults = m_perf[3].load(std::memory_order_relaxed);
+#endif
+                return stats;
+            }
+
+        private:
+
+            template<typename U>
+            static void swap_relaxed(std::atomic<U>& lhs, std::atomic<U>& rhs) noexcept
+            {
+                rhs.store(lhs.exchange(rhs.load(std::memory_order_relaxed), std::memory_order_relaxed), std::memory_order_relaxed);
+            }
+        };
+
+        class once_state;
+
+        // A slot in the global registry of named lazy objects. 
+        // Entries are never freed, only recycled, so enumerating the registry never touches freed memory, and never takes a lock.
+        // An object can't be destroyed (or moved) while an enumeration reads it: it waits for m_readers to drop to zero after unpublishing itself.
+        class registry_entry
+        {
+            registry_entry* m_next = nullptr; // Immutable once pushed
+            std::atomic<bool> m_in_use{ true };
+            std::atomic<int> m_readers{ 0 };
+            std::atomic<const once_state*> m_object{ nullptr };
+            std::string m_name; // Only written while m_object is null, and no reader holds the entry
+
+            static std::atomic<registry_entry*>& head() noexcept
+            {
+                static std::atomic<registry_entry*> entries{ nullptr };
+                return entries;
+            }
+
+        public:
+
+            static registry_entry* acquire(const once_state* object, std::string name)
+            {
+                registry_entry* entry = head().load(std::memory_order_acquire);
+                for (; entry; entry = entry->m_next)
+                {
+                    bool in_use = false;
+                    if (!entry->m_in_use.load(std::memory_order_relaxed) && entry->m_in_use.compare_exchange_strong(in_use, true, std::memory_order_acquire))
+                    {
+                        break;
+                    }
+                }
+                if (!entry)
+                {
+                    entry = new registry_entry(); // Never deleted, see above
+                    entry->m_next = head().load(std::memory_order_relaxed);
+                    while (!head().compare_exchange_weak(entry->m_next, entry, std::memory_order_release, std::memory_order_relaxed))
+                    {
+                    }
+                }
+                entry->m_name = std::move(name);
+                entry->m_object.store(object, std::memory_order_seq_cst);
+                return entry;
+            }
+
+            // Only for the object holding the entry
+            const std::string& name() const noexcept
+            {
+                return m_name;
+            }
+
+            void release() noexcept
+            {
+                retarget(nullptr);
+                m_in_use.store(false, std::memory_order_release);
+            }
+
+            // Points the entry to a moved object. Returns once no reader can be using the previous one.
+            void retarget(const once_state* object) noexcept
+            {
+                m_object.store(object, std::memory_order_seq_cst);
+                while (m_readers.load(std::memory_order_seq_cst) != 0)
+                {
+                    std::this_thread::yield();
+                }
+            }
+
+            // Calls func(const std::string& name, const once_state&) for every registered object.
+            template<typename Func>
+            static void for_each(Func&& func)
+            {
+                for (registry_entry* entry = head().load(std::memory_order_acquire); entry; entry = entry->m_next)
+                {
+                    entry->m_readers.fetch_add(1, std::memory_order_seq_cst);
+                    if (const once_state* object = entry->m_object.load(std::memory_order_seq_cst))
+                    {
+                        func(entry->m_name, *object);
+                    }
+                    entry->m_readers.fetch_sub(1, std::memory_order_release);
+                }
+            }
+        };
+
+        enum class trace_kind : std::uint8_t
+        {
+            init,
+            failed_init,
+            wait
+        };
+#endif
+
+#if CPPLAZY_ENABLE_TRACING
+        struct trace_event
+        {
+            trace_kind kind;
+            std::uint64_t thread_id;
+            std::int64_t begin_ns; // Since process start
+            std::int64_t end_ns;
+            const void* object;
+            char name[48];         // Truncated, empty for unnamed objects
+        };
+
+        inline std::uint64_t current_thread_id() noexcept
+        {
+#if defined(__linux__)
+            static thread_local const std::uint64_t id = static_cast<std::uint64_t>(::syscall(SYS_gettid)); // Matches the tids shown by perf, top...
+#else
+            static thread_local const std::uint64_t id = std::hash<std::thread::id>{}(std::this_thread::get_id());
+#endif
+            return id;
+        }
+
+        // A fixed size ring buffer, written without locks by the threads initializing or waiting.
+        // Each slot is a seqlock, so a reader skips slots being overwritten instead of blocking writers.
+        class trace_buffer
+        {
+            static constexpr std::size_t capacity = CPPLAZY_TRACE_BUFFER_SIZE;
+            static constexpr std::size_t name_words = sizeof(trace_event::name) / sizeof(std::uint64_t);
+
+            struct slot
+            {
+                std::atomic<std::uint64_t> sequence{ 0 }; // Odd while being written, 2 * (index + 1) once written
+                std::atomic<std::uint8_t> kind{ 0 };
+                std::atomic<std::uint64_t> thread_id{ 0 };
+                std::atomic<std::int64_t> begin_ns{ 0 };
+                std::atomic<std::int64_t> end_ns{ 0 };
+                std::atomic<const void*> object{ nullptr };
+                std::atomic<std::uint64_t> name[name_words] = {};
+            };
+
+            std::atomic<std::uint64_t> m_next{ 0 };
+            std::atomic<std::uint64_t> m_first{ 0 }; // Events before it were cleared
+            slot m_slots[capacity];
+
+        public:
+
+            static trace_buffer& instance() noexcept
+            {
+                static trace_buffer buffer;
+                return buffer;
+            }
+
+            void record(trace_kind kind, std::int64_t begin_ns, std::int64_t end_ns, const void* object, const char* name) noexcept
+            {
+                const std::uint64_t index = m_next.fetch_add(1, std::memory_order_relaxed);
+                slot& s = m_slots[index % capacity];
+                s.sequence.store(2 * index + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                s.kind.store(static_cast<std::uint8_t>(kind), std::memory_order_relaxed);
+                s.thread_id.store(current_thread_id(), std::memory_order_relaxed);
+                s.begin_ns.store(begin_ns - process_start_ns, std::memory_order_relaxed);
+                s.end_ns.store(end_ns - process_start_ns, std::memory_order_relaxed);
+                s.object.store(object, std::memory_order_relaxed);
+                char packed[sizeof(trace_event::name)] = {};
+                for (std::size_t i = 0; name[i] && i < sizeof(packed) - 1; i++)
+                {
+                    packed[i] = name[i];
+                }
+                for (std::size_t i = 0; i < name_words; i++)
+                {
+                    std::uint64_t word;
+                    std::memcpy(&word, packed + i * sizeof(word), sizeof(word));
+                    s.name[i].store(word, std::memory_order_relaxed);
+                }
+                s.sequence.store(2 * (index + 1), std::memory_order_release);
+            }
+
+            // Calls func(const trace_event&) for the buffered events, oldest first.
+            template<typename Func>
+            void for_each(Func&& func) const
+            {
+                const std::uint64_t end = m_next.load(std::memory_order_acquire);
+                std::uint64_t index = m_first.load(std::memory_order_relaxed);
+                if (end - index > capacity)
+                {
+                    index = end - capacity;
+                }
+                for (; index < end; index++)
+                {
+                    const slot& s = m_slots[index % capacity];
+                    const std::uint64_t sequence = s.sequence.load(std::memory_order_acquire);
+                    if (sequence != 2 * (index + 1))
+                    {
+                        continue;
+                    }
+                    trace_event e;
+                    e.kind = static_cast<trace_kind>(s.kind.load(std::memory_order_relaxed));
+                    e.thread_id = s.thread_id.load(std::memory_order_relaxed);
+                    e.begin_ns = s.begin_ns.load(std::memory_order_relaxed);
+                    e.end_ns = s.end_ns.load(std::memory_order_relaxed);
+                    e.object = s.object.load(std::memory_order_relaxed);
+                    for (std::size_t i = 0; i < name_words; i++)
+                    {
+                        const std::uint64_t word = s.name[i].load(std::memory_order_relaxed);
+                        std::memcpy(e.name + i * sizeof(word), &word, sizeof(word));
+                    }
+                    e.name[sizeof(e.name) - 1] = 0;
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (s.sequence.load(std::memory_order_relaxed) == sequence)
+                    {
+                        func(e);
+                    }
+                }
+            }
+
+            void clear() noexcept
+            {
+                m_first.store(m_next.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            }
+        };
+#endif
+
+        // An estimate of the memory held by a value: its size, plus the elements of containers.
+        template<typename T, typename = void>
+        struct has_capacity : std::false_type {};
+
+        template<typename T>
+        struct has_capacity<T, std::void_t<typename T::value_type, decltype(std::declval<const T&>().capacity())>> : std::true_type {};
+
+        template<typename T, typename = void>
+        struct has_size : std::false_type {};
+
+        template<typename T>
+        struct has_size<T, std::void_t<typename T::value_type, decltype(std::declval<const T&>().size())>> : std::true_type {};
+
+        template<typename T>
+        std::size_t estimate_value_size(const T& value) noexcept
+        {
+            if constexpr (has_capacity<T>::value)
+            {
+                return sizeof(T) + value.capacity() * sizeof(typename T::value_type);
+            }
+            else if constexpr (has_size<T>::value)
+            {
+                return sizeof(T) + value.size() * sizeof(typename T::value_type);
+            }
+            else
+            {
+                return sizeof(T);
+            }
+        }
+
+        // Waiters block on one of a fixed set of buckets chosen by the address of the state they wait on,
+        // so a state word does not need to carry its own mutex and condition variable.
+        struct parking_bucket
+        {
+            std::mutex mutex;
+            std::condition_variable cv;
+        };
+
+        inline parking_bucket& parking_bucket_for(const void* address)
+        {
+            static parking_bucket buckets[64];
+            return buckets[(reinterpret_cast<std::uintptr_t>(address) >> 4) % 64];
+        }
+
+#if CPPLAZY_ENABLE_CYCLE_DETECTION
+        class once_state;
+
+        inline std::atomic<void (*)(const char*)>& cycle_handler() noexcept
+        {
+            static std::atomic<void (*)(const char*)> handler{ nullptr };
+            return handler;
+        }
+
+        // What a thread is initializing and waiting for, so a waiting thread can follow the chain of owners.
+        // Records are recycled but never freed (like registry entries), so following a stale owner is harmless.
+        class init_thread
+        {
+            init_thread* m_next = nullptr; // Immutable once pushed
+            std::atomic<bool> m_in_use{ true };
+
+            static std::atomic<init_thread*>& head() noexcept
+            {
+                static std::atomic<init_thread*> threads{ nullptr };
+                return threads;
+            }
+
+            static init_thread* acquire()
+            {
+                static std::atomic<std::uint64_t> next_number{ 1 };
+                init_thread* entry = head().load(std::memory_order_acquire);
+                for (; entry; entry = entry->m_next)
+                {
+                    bool in_use = false;
+                    if (!entry->m_in_use.load(std::memory_order_relaxed) && entry->m_in_use.compare_exchange_strong(in_use, true, std::memory_order_acquire))
+                    {
+                        break;
+                    }
+                }
+                if (!entry)
+                {
+                    entry = new init_thread(); // Never deleted, see above
+                    entry->m_next = head().load(std::memory_order_relaxed);
+                    while (!head().compare_exchange_weak(entry->m_next, entry, std::memory_order_release, std::memory_order_relaxed))
+                    {
+                    }
+                }
+                entry->number.store(next_number.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+                return entry;
+            }
+
+        public:
+
+            std::atomic<std::uint64_t> number{ 0 }; // Shown in cycle reports
+            std::atomic<const once_state*> waiting_for{ nullptr };
+            const once_state* initializing = nullptr; // The innermost initialization running on this thread, only used by the thread itself
+
+            static init_thread& current()
+            {
+                struct holder
+                {
+                    init_thread* record = acquire();
+
+                    ~holder()
+                    {
+                        record->waiting_for.store(nullptr, std::memory_order_relaxed);
+                        record->m_in_use.store(false, std::memory_order_release);
+                    }
+                };
+                thread_local holder h;
+                return *h.record;
+            }
+        };
+
+        [[noreturn]] inline void report_cycle(const std::string& cycle)
+        {
+            if (void (*handler)(const char*) = cycle_handler().load(std::memory_order_acquire))
+            {
+                handler(cycle.c_str()); // May throw
+            }
+            else
+            {
+                std::fprintf(stderr, "cpplazy: initialization cycle: %s\n", cycle.c_str());
+            }
+            std::abort();
+        }
+#endif
+
+        // The one-byte state machine behind every once-only primitive in this header:
+        // uninitialized -> initializing -> initialized, or back to uninitialized if the initializer failed.
+        // Unlike std::once_flag it can be inspected, moved and reset without running anything.
+        class once_state
+        {
+            static constexpr std::uint8_t uninitialized = 0;
+            static constexpr std::uint8_t initializing = 1;
+            static constexpr std::uint8_t initialized = 2;
+            static constexpr std::uint8_t value_mask = 3;
+            static constexpr std::uint8_t parked = 4; // At least one thread is blocked on this state's bucket
+
+            mutable std::atomic<std::uint8_t> m_state;
+#if CPPLAZY_ENABLE_INSTRUMENTATION
+            mutable stats_counters m_stats;
+            mutable std::atomic<std::size_t> m_value_size{ 0 };
+            mutable registry_entry* m_entry = nullptr;
+#endif
+#if CPPLAZY_ENABLE_CYCLE_DETECTION
+            mutable std::atomic<init_thread*> m_owner{ nullptr };
+            mutable const once_state* m_outer = nullptr; // The initialization this one runs inside of, on the owner thread
+#if !CPPLAZY_ENABLE_INSTRUMENTATION
+            mutable std::unique_ptr<const std::string> m_name;
+#endif
+#endif
+
+        public:
+
+            constexpr once_state() noexcept : 
+                m_state(uninitialized) 
+            {
+            }
+
+            once_state(const once_state&) = delete;
+            once_state& operator=(const once_state&) = delete;
+
+#if CPPLAZY_ENABLE_INSTRUMENTATION
+            ~once_state()
+            {
+                if (m_entry)
+                {
+                    m_entry->release();
+                }
+            }
+#endif
+
+            // Lists the owning object in the global registry (see for_each_registered()), and names it in cycle reports.
+            // Does nothing without instrumentation or cycle detection.
+            void set_name(std::string name) const
+            {
+#if CPPLAZY_ENABLE_INSTRUMENTATION
+                if (m_entry)
+                {
+                    m_entry->release();
+                }
+                m_entry = registry_entry::acquire(this, std::move(name));
+#elif CPPLAZY_ENABLE_CYCLE_DETECTION
+                m_name.reset(new std::string(std::move(name)));
+#else
+                (void)name;
+#endif
+            }
+
+            // Called by the initializing thread before commit().
+            template<typename T>
+            void set_value(const T& value) const noexcept
+            {
+#if CPPLAZY_ENABLE_INSTRUMENTATION
+                m_value_size.store(estimate_value_size(value), std::memory_order_relaxed);
+#else
+                (void)value;
+#endif
+            }
+
+            bool is_initialized() const noexcept
+            {
+                return (m_state.load(std::memory_order_acquire) & value_mask) == initialized;
+            }
+
+            // Returns true if the caller has to run the initializer, and then call commit() or abort().
+            // Returns false if the value is already initialized. Blocks while another thread is initializing.
+            bool try_begin() const
+            {
+                return !is_initialized() && try_begin_slow();
+            }
+
+            void commit() const
+            {
+#if CPPLAZY_ENABLE_INSTRUMENTATION
+                // Before publishing, the object may be destroyed as soon as other threads see it
+                trace(trace_kind::init, m_stats.init_begin_ns());
+                m_stats.on_init_end(this, true);
+#endif
+#if CPPLAZY_ENABLE_CYCLE_DETECTION
+                end_owner();
+#endif
+                publish(initialized);
+            }
+
+            void abort() const
+            {
+#if CPPLAZY_ENABLE_INSTRUMENTATION
+                trace(trace_kind::failed_init, m_stats.init_begin_ns());
+                m_stats.on_init_end(this, false);
+#endif
+#if CPPLAZY_ENABLE_CYCLE_DETECTION
+                end_owner();
+#endif
+                publish(uninitialized);
+            }
+
+            // Blocks until some caller commits.
+            void wait() const
+            {
+#if CPPLAZY_ENABLE_INSTRUMENTATION
+                const std::int64_t wait_begin_ns = is_initialized() ? 0 : now_ns();
+#endif
+                for (std::uint8_t state = m_state.load(std::memory_order_acquire); (state & value_mask) != initialized; 
+                     state = m_state.load(std::memory_order_acquire))
+                {
+                    wait_for_owner(state & value_mask);
+                }
+#if CPPLAZY_ENABLE_INSTRUMENTATION
+                if (wait_begin_ns)
+                {
+                    trace(trace_kind::wait, wait_begin_ns);
+                    m_stats.on_wait(this, wait_begin_ns);
+                }
+#endif
+            }
+
+#if CPPLAZY_ENABLE_INSTRUMENTATION
+            lazy_stats stats() const noexcept
+            {
+                return m_stats.load();
+            }
+#endif
+
+#if CPPLAZY_ENABLE_INSTRUMENTATION
+            lazy_info info(const std::string& name) const
+            {
+                lazy_info info;
+                info.name = name;
+                switch (m_state.load(std::memory_order_acquire) & value_mask)
+                {
+                case initialized: info.state = lazy_state::initialized; break;
+                case initializing: info.state = lazy_state::initializing; break;
+                default: info.state = lazy_state::uninitialized; break;
+                }
+                info.value_size = info.state == lazy_state::initialized ? m_value_size.load(std::memory_order_relaxed) : 0;
+                info.stats = m_stats.load();
+                return info;
+            }
+#endif
+
+            // The functions below are not thread safe. They are meant for moving, swapping and resetting 
+            // the owning object, which must not be accessed concurrently anyway.
+            void store(bool is_initialized) noexcept
+            {
+                m_state.store(is_initialized ? initialized : uninitialized, std::memory_order_release);
+            }
+
+            // Takes over other's state (and name and counters), leaving other uninitialized and unnamed.
+            void take_over(once_state& other) noexcept
+            {
+                store(other.is_initialized());
+                other.store(false);
+#if CPPLAZY_ENABLE_INSTRUMENTATION
+                m_stats.swap(other.m_stats);
+                other.m_stats.reset();
+                m_value_size.store(other.m_value_size.exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+                if (m_entry)
+                {
+                    m_entry->release();
+                }
+                m_entry = other.m_entry;
+                other.m_entry = nullptr;
+                if (m_entry)
+                {
+                    m_entry->retarget(this);
+                }
+#elif CPPLAZY_ENABLE_CYCLE_DETECTION
+                m_name = std::move(other.m_name);
+#endif
+            }
+
+            void swap(once_state& other) noexcept
+            {
+                const bool was_initialized = is_initialized();
+                store(other.is_initialized());
+                other.store(was_initialized);
+#if CPPLAZY_ENABLE_INSTRUMENTATION
+                m_stats.swap(other.m_stats);
+                m_value_size.store(other.m_value_size.exchange(m_value_size.load(std::memory_order_relaxed), std::memory_order_relaxed), std::memory_order_relaxed);
+                std::swap(m_entry, other.m_entry);
+                if (m_entry)
+                {
+                    m_entry->retarget(this);
+                }
+                if (other.m_entry)
+                {
+                    other.m_entry->retarget(&other);
+                }
+#elif CPPLAZY_ENABLE_CYCLE_DETECTION
+                m_name.swap(other.m_name);
+#endif
+            }
+
+        private:
+
+            bool try_begin_slow() const
+            {
+#if CPPLAZY_ENABLE_INSTRUMENTATION
+                m_stats.on_access();
+#endif
+                std::uint8_t state = m_state.load(std::memory_order_acquire);
+                for (;;)
+                {
+                    switch (state & value_mask)
+                    {
+                    case initialized:
+                        return false;
+                    case uninitialized:
+                        if (m_state.compare_exchange_weak(state, initializing | (state & parked), std::memory_order_acquire))
+                        {
+#if CPPLAZY_ENABLE_INSTRUMENTATION
+                            m_stats.on_init_begin(this);
+#endif
+#if CPPLAZY_ENABLE_CYCLE_DETECTION
+                            begin_owner();
+#endif
+                            return true;
+                        }
+                        break;
+                    default:
+                    {
+#if CPPLAZY_ENABLE_INSTRUMENTATION
+                        const std::int64_t wait_begin_ns = now_ns();
+                        wait_for_owner(initializing);
+                        trace(trace_kind::wait, wait_begin_ns);
+                        m_stats.on_wait(this, wait_begin_ns);
+#else
+                        wait_for_owner(initializing);
+#endif
+                        state = m_state.load(std::memory_order_acquire);
+                        break;
+                    }
+                    }
+                }
+            }
+
+#if CPPLAZY_ENABLE_INSTRUMENTATION
+            void trace(trace_kind kind, std::int64_t begin_ns) const noexcept
+            {
+#if CPPLAZY_ENABLE_TRACING
+                trace_buffer::instance().record(kind, begin_ns, now_ns(), this, m_entry ? m_entry->name().c_str() : "");
+#else
+                (void)kind;
+                (void)begin_ns;
+#endif
+            }
+#endif
+
+            // Parks while the state is value. With cycle detection, first makes sure the thread 
+            // initializing this object isn't (through other objects and threads) waiting for the caller.
+            void wait_for_owner(std::uint8_t value) const
+            {
+#if CPPLAZY_ENABLE_CYCLE_DETECTION
+                init_thread& self = init_thread::current();
+                self.waiting_for.store(this, std::memory_order_seq_cst);
+                std::string cycle;
+                // A cycle is confirmed by a second walk, in case an owner moved on while the first walk read it
+                if (find_cycle(self, cycle) && find_cycle(self, cycle))
+                {
+                    self.waiting_for.store(nullptr, std::memory_order_relaxed);
+                    report_cycle(cycle);
+                }
+                park_while(value);
+                self.waiting_for.store(nullptr, std::memory_order_relaxed);
+#else
+                park_while(value);
+#endif
+            }
+
+#if CPPLAZY_ENABLE_CYCLE_DETECTION
+            void begin_owner() const
+            {
+                init_thread& self = init_thread::current();
+                m_outer = self.initializing;
+                self.initializing = this;
+                m_owner.store(&self, std::memory_order_seq_cst);
+            }
+
+            void end_owner() const
+            {
+                init_thread::current().initializing = m_outer;
+                m_outer = nullptr;
+                m_owner.store(nullptr, std::memory_order_seq_cst);
+            }
+
+            std::string display_name() const
+            {
+#if CPPLAZY_ENABLE_INSTRUMENTATION
+                const std::string* name = m_entry ? &m_entry->name() : nullptr;
+#else
+                const std::string* name = m_name.get();
+#endif
+                if (name && !name->empty())
+                {
+                    return *name;
+                }
+                char buffer[32];
+                std::snprintf(buffer, sizeof(buffer), "<unnamed %p>", static_cast<const void*>(this));
+                return buffer;
+            }
+
+            // Follows owner -> object it waits for -> owner... from this object. If that leads back to the calling thread,
+            // describes the cycle (e.g. "b [thread 2] -> a [thread 1] -> b") and returns true.
+            bool find_cycle(const init_thread& self, std::string& cycle) const
+            {
+                std::string chain;
+                const once_state* object = this;
+                for (int hops = 0; object && hops < 64; hops++)
+                {
+                    const init_thread* owner = object->m_owner.load(std::memory_order_seq_cst);
+                    if (!owner)
+                    {
+                        return false;
+                    }
+                    if (owner == &self)
+                    {
+                        // The caller's own initializations, from the one closing the cycle to the innermost
+                        const std::string thread = " [thread " + std::to_string(self.number.load(std::memory_order_relaxed)) + "]";
+                        std::string own;
+                        for (const once_state* outer = self.initializing; outer; outer = outer->m_outer)
+                        {
+                            own = outer->display_name() + thread + (own.empty() ? "" : " -> ") + own;
+                            if (outer == object)
+                            {
+                                break;
+                            }
+                        }
+                        cycle = own + chain + " -> " + object->display_name();
+                        return true;
+                    }
+                    chain += " -> " + object->display_name() + " [thread " + std::to_string(owner->number.load(std::memory_order_relaxed)) + "]";
+                    object = owner->waiting_for.load(std::memory_order_seq_cst);
+                }
+                return false;
+            }
+#endif
+
+            void park_while(std::uint8_t value) const
+            {
+                parking_bucket& bucket = parking_bucket_for(this);
+                std::unique_lock<std::mutex> lock(bucket.mutex);
+                std::uint8_t state = m_state.load(std::memory_order_relaxed);
+                while ((state & value_mask) == value)
+                {
+                    // Setting the parked bit under the bucket's mutex guarantees publish() will notify us
+                    if ((state & parked) || m_state.compare_exchange_weak(state, state | parked, std::memory_order_relaxed))
+                    {
+                        bucket.cv.wait(lock);
+                        state = m_state.load(std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            void publish(std::uint8_t value) const
+            {
+                if (m_state.exchange(value, std::memory_order_acq_rel) & parked)
+                {
+                    parking_bucket& bucket = parking_bucket_for(this);
+                    {
+                        std::lock_guard<std::mutex> lock(bucket.mutex);
+                    }
+                    bucket.cv.notify_all();
+                }
+            }
+        };
+
+        // Aborts the initialization if the init function throws, so other threads don't wait forever.
+        class init_guard
+        {
+            const once_state* m_state;
+
+        public:
+
+            explicit init_guard(const once_state& state) noexcept :
+                m_state(&state)
+            {
+            }
+
+            init_guard(const init_guard&) = delete;
+            init_guard& operator=(const init_guard&) = delete;
+
+            void commit() noexcept
+            {
+                m_state->commit();
+                m_state = nullptr;
+            }
+
+            ~init_guard()
+            {
+                if (m_state)
+                {
+                    m_state->abort();
+                }
+            }
+        };
+
+        // Initializes value with initFunc() unless it is already initialized. Shared by lazy<T> and lazy_static<T, F>.
+        template<typename T, typename F>
+        std::optional<T>* get_or_init(const once_state& state, std::optional<T>& value, const F& initFunc)
+        {
+            if (state.try_begin())
+            {
+#if CPPLAZY_HAS_EXCEPTIONS
+                try
+                {
+                    value = initFunc();
+                    state.set_value(*value);
+                    state.commit();
+                }
+                catch (...)
+                {
+                    // A failed initialization leaves the value empty, and the next access will try again
+                    state.abort();
+                }
+#else
+                value = initFunc();
+                state.set_value(*value);
+                state.commit();
+#endif
+            }
+
+            return &value;
+        }
+    }
+
+#if CPPLAZY_ENABLE_INSTRUMENTATION
+    // Replaces the global instrumentation hooks (null hooks are not called).
+    inline void set_instrumentation_hooks(const instrumentation_hooks& hooks) noexcept
+    {
+        detail::hooks().on_init_begin.store(hooks.on_init_begin, std::memory_order_release);
+        detail::hooks().on_init_end.store(hooks.on_init_end, std::memory_order_release);
+        detail::hooks().on_wait.store(hooks.on_wait, std::memory_order_release);
+    }
+#endif
+
+#if CPPLAZY_ENABLE_CYCLE_DETECTION
+    // Called with the chain of objects (e.g. "config [thread 1] -> db [thread 2] -> config") when an initializer would wait 
+    // for its own lazy object (see CPPLAZY_ENABLE_CYCLE_DETECTION). Null restores the default, which prints it to stderr.
+    // The process is aborted when the handler returns, but it may throw instead, out of the access that closed the cycle.
+    inline void set_cycle_handler(void (*handler)(const char* cycle)) noexcept
+    {
+        detail::cycle_handler().store(handler, std::memory_order_release);
+    }
+#endif
+
+    // Whether any perf counter could be opened for the calling thread (see CPPLAZY_ENABLE_PERF_COUNTERS).
+    inline bool perf_counters_available() noexcept
+    {
+#if CPPLAZY_ENABLE_PERF_COUNTERS
+        return detail::thread_perf_counters::instance().available();
+#else
+        return false;
+#endif
+    }
+
+    // Calls func(const lazy_info&) for every named lazy object (see the constructors taking a name), most recently named first.
+    // Thread safe and lock free, objects can be created and destroyed concurrently.
+    // Without CPPLAZY_ENABLE_INSTRUMENTATION, names are ignored, and nothing is listed.
+    template<typename Func>
+    void for_each_registered(Func&& func)
+    {
+#if CPPLAZY_ENABLE_INSTRUMENTATION
+        detail::registry_entry::for_each([&func](const std::string& name, const detail::once_state& state) { func(state.info(name)); });
+#else
+        (void)func;
+#endif
+    }
+
+    namespace detail
+    {
+        // Destroys values handed over by destroy_in_background, on a thread of its own (started on first use).
+        class reclaimer
+        {
+            struct garbage
+            {
+                virtual ~garbage() = default;
+            };
+
+            template<typename T>
+            struct holder : garbage
+            {
+                explicit holder(T&& value) : value(std::move(value)) {}
+                T value;
+            };
+
+            std::mutex m_mutex;
+            std::condition_variable m_cv;
+            std::vector<std::unique_ptr<garbage>> m_queue;
+            std::uint64_t m_retired = 0;
+            std::uint64_t m_destroyed = 0;
+            bool m_started = false;
+
+            void run()
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                for (;;)
+                {
+                    m_cv.wait(lock, [this] { return !m_queue.empty(); });
+                    std::vector<std::unique_ptr<garbage>> batch;
+                    batch.swap(m_queue);
+                    lock.unlock();
+                    const std::size_t count = batch.size();
+                    batch.clear();
+                    lock.lock();
+                    m_destroyed += count;
+                    m_cv.notify_all();
+                }
+            }
+
+        public:
+
+            // Never destroyed, and its thread is never joined: values still queued when the process exits are leaked.
+            static reclaimer& instance()
+            {
+                static reclaimer* r = new reclaimer();
+                return *r;
+            }
+
+            template<typename T>
+            void retire(T&& value)
+            {
+                std::unique_ptr<garbage> g(new holder<T>(std::move(value)));
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_started)
+                {
+                    std::thread([this] { run(); }).detach();
+                    m_started = true;
+                }
+                m_queue.push_back(std::move(g));
+                m_retired++;
+                m_cv.notify_all();
+            }
+
+            void wait_idle()
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                const std::uint64_t retired = m_retired;
+                m_cv.wait(lock, [this, retired] { return m_destroyed >= retired; });
+            }
+        };
+    }
+
+    // Destruction policies decide how lazy<T, Destroy> gets rid of its value when the lazy object is reset(), assigned to,
+    // or destroyed (destructing is true). A policy is a type with a static member function 
+    // `template<typename T> void destroy(std::optional<T>& value, bool destructing) noexcept` that leaves value empty.
+    // Write your own to hand values to an executor of your own.
+
+    // Destroys the value right away, on the calling thread (the default).
+    struct destroy_inline
+    {
+        template<typename T>
+        static void destroy(std::optional<T>& value, bool) noexcept
+        {
+            value.reset();
+        }
+    };
+
+    // Moves the value to a background thread which destroys it, so freeing big containers doesn't add to the latency
+    // of whichever thread drops the lazy object. Falls back to destroying inline if the hand-over fails.
+    // T's destructor must be safe to run on another thread.
+    struct destroy_in_background
+    {
+        template<typename T>
+        static void destroy(std::optional<T>& value, bool) noexcept
+        {
+            if (value)
+            {
+#if CPPLAZY_HAS_EXCEPTIONS
+                try
+                {
+                    detail::reclaimer::instance().retire(std::move(*value));
+                }
+                catch (...)
+                {
+                }
+#else
+                detail::reclaimer::instance().retire(std::move(*value));
+#endif
+            }
+            value.reset(); // Only destroys the moved-from shell
+        }
+    };
+
+    // The lazy object's destructor leaks the value (reset() and assignment still destroy it inline).
+    // Meant for lazy objects with static storage duration, whose destructor only runs at exit, where freeing memory
+    // the OS is about to reclaim just makes shutdown slower (and may touch objects that are already destroyed).
+    struct leak_on_destroy
+    {
+        template<typename T>
+        static void destroy(std::optional<T>& value, bool destructing) noexcept
+        {
+            if (value && destructing)
+            {
+                // Moved to the heap rather than destroyed, so the value's resources stay alive
+                new (std::nothrow) std::optional<T>(std::move(value));
+            }
+            value.reset();
+        }
+    };
+
+    // Blocks until every value handed to destroy_in_background so far is destroyed.
+    inline void wait_for_background_destruction()
+    {
+        detail::reclaimer::instance().wait_idle();
+    }
+
     // Provides support lazy initialization.
-    template<typename T>
+    // Destroy decides how the value is destroyed (see destroy_inline, destroy_in_background and leak_on_destroy).
+    template<typename T, typename Destroy = destroy_inline>
     class lazy
     {
-        mutable std::once_flag m_init_flag;
-        const std::function<T()> m_init_func;
-        mutable std::optional<T> m_value;
+        detail::once_state m_state;
+        std::function<T()> m_init_func;
+        mutable std::optional<T> m_value;
+
+    public:
+
+        explicit lazy(std::function<T()> initFunc) : 
+            m_init_func(std::move(initFunc)) 
+        {
+        }
+
+        // A named lazy object is listed by for_each_registered() when built with CPPLAZY_ENABLE_INSTRUMENTATION.
+        lazy(std::string name, std::function<T()> initFunc) :
+            m_init_func(std::move(initFunc))
+        {
+            m_state.set_name(std::move(name));
+        }
+        
+        ~lazy()
+        {
+            Destroy::destroy(m_value, true);
+        }
+
+        lazy(const lazy&) = delete; // It would make your code awkward if copying was allowed (how would you enforce the init function can be called twice?)
+        lazy& operator=(const lazy&) = delete;
+
+        // Moving, swapping, take() and reset() are not thread safe, and must not race with accessing the lazy object.
+        // The moved-from object is left uninitialized, without an init function (or a name).
+        lazy(lazy&& other) noexcept(std::is_nothrow_move_constructible<T>::value) :
+            m_init_func(std::move(other.m_init_func)),
+            m_value(std::move(other.m_value)) // The other object might be initialized already, in this case its value is taken instead of re-initializing
+        {
+            m_state.take_over(other.m_state);
+            other.m_value.reset();
+        }
+
+        lazy& operator=(lazy&& other) noexcept(std::is_nothrow_move_constructible<T>::value && std::is_nothrow_move_assignable<T>::value)
+        {
+            if (this != &other)
+            {
+                m_init_func = std::move(other.m_init_func);
+                Destroy::destroy(m_value, false);
+                m_value = std::move(other.m_value);
+                m_state.take_over(other.m_state);
+                other.m_value.reset();
+            }
+            return *this;
+        }
+
+        void swap(lazy& other) noexcept(std::is_nothrow_move_constructible<T>::value && std::is_nothrow_swappable<T>::value)
+        {
+            m_init_func.swap(other.m_init_func);
+            m_value.swap(other.m_value);
+            m_state.swap(other.m_state);
+        }
+
+        friend void swap(lazy& lhs, lazy& rhs) noexcept(noexcept(lhs.swap(rhs)))
+        {
+            lhs.swap(rhs);
+        }
+
+        // Moves the value out (initializing it first if needed), leaving the lazy object uninitialized.
+        // The next access will call the init function again.
+        std::optional<T> take()
+        {
+            std::optional<T> value = std::move(*get_or_init());
+            m_value.reset(); // Only the moved-from shell is left, no need for the destruction policy
+            m_state.store(false);
+            return value;
+        }
+
+        // Destroys the value (if any, see Destroy). The next access will call the init function again.
+        void reset() noexcept
+        {
+            Destroy::destroy(m_value, false);
+            m_state.store(false);
+        }
+
+        bool is_initialized() const noexcept
+        {
+            return m_state.is_initialized();
+        }
+
+#if CPPLAZY_ENABLE_INSTRUMENTATION
+        lazy_stats stats() const noexcept
+        {
+            return m_state.stats();
+        }
+#endif
+
+        std::optional<T>* operator->()
+        {
+            return get_or_init();
+        }
+
+        const std::optional<T>* operator->() const
+        {
+            return get_or_init();
+        }
+
+        T& operator*()
+        {
+            return get_or_init()->value();
+        }
+
+        const T& operator*() const
+        {
+            return get_or_init()->value();
+        }
+
+    private:
+
+        std::optional<T>* get_or_init() const
+        {
+            return detail::get_or_init(m_state, m_value, m_init_func);
+        }
+    };
+
+    // Runs a one-time action (registering signal handlers, opening log sinks...) on first use, storing nothing but the state.
+    // Same guarantees as lazy<T>: concurrent callers block until the action completes, 
+    // and if it throws, the next call to ensure() tries again.
+    // There is no value to destroy, so any destruction policy behaves the same.
+    template<typename Destroy>
+    class lazy<void, Destroy>
+    {
+        detail::once_state m_state;
+        std::function<void()> m_init_func;
 
     public:
 
-        explicit lazy(std::function<T()> initFunc) : 
-            m_init_func(std::move(initFunc)) 
+        explicit lazy(std::function<void()> initFunc) :
+            m_init_func(std::move(initFunc))
         {
         }
-        
-        lazy(const lazy&) = delete; // It would make your code awkward if copying was allowed (how would you enforce the init function can be called twice?)
+
+        lazy(std::string name, std::function<void()> initFunc) :
+            m_init_func(std::move(initFunc))
+        {
+            m_state.set_name(std::move(name));
+        }
+
+        lazy(const lazy&) = delete;
+        lazy& operator=(const lazy&) = delete;
 
         lazy(lazy&& other) noexcept :
             m_init_func(std::move(other.m_init_func))
         {
-            // The other object might be initialized already. 
-            // In this case the move c'tor needs to make sure this->m_value is set to the same value, and not re-initialize.
-            // Using call_once to determine it.
+            m_state.take_over(other.m_state);
+        }
+
+        lazy& operator=(lazy&& other) noexcept
+        {
+            if (this != &other)
+            {
+                m_init_func = std::move(other.m_init_func);
+                m_state.take_over(other.m_state);
+            }
+            return *this;
+        }
+
+        void swap(lazy& other) noexcept
+        {
+            m_init_func.swap(other.m_init_func);
+            m_state.swap(other.m_state);
+        }
+
+        friend void swap(lazy& lhs, lazy& rhs) noexcept
+        {
+            lhs.swap(rhs);
+        }
+
+        // The next call to ensure() will run the action again.
+        void reset() noexcept
+        {
+            m_state.store(false);
+        }
+
+        bool is_initialized() const noexcept
+        {
+            return m_state.is_initialized();
+        }
+
+#if CPPLAZY_ENABLE_INSTRUMENTATION
+        lazy_stats stats() const noexcept
+        {
+            return m_state.stats();
+        }
+#endif
+
+        // Runs the action unless it already completed. Returns false if the action threw.
+        bool ensure() const
+        {
+            return m_state.is_initialized() || run();
+        }
+
+    private:
+
+        bool run() const
+        {
+            if (m_state.try_begin())
+            {
+#if CPPLAZY_HAS_EXCEPTIONS
+                try
+                {
+                    m_init_func();
+                    m_state.commit();
+                }
+                catch (...)
+                {
+                    m_state.abort();
+                    return false;
+                }
+#else
+                m_init_func();
+                m_state.commit();
+#endif
+            }
+            return m_state.is_initialized();
+        }
+    };
+
+    using run_once = lazy<void>;
+
+    // Wraps the error returned by an initializer of lazy_expected (similar to C++23's std::unexpected).
+    template<typename E>
+    class unexpected
+    {
+        E m_error;
+
+    public:
+
+        explicit unexpected(E error) :
+            m_error(std::move(error))
+        {
+        }
+
+        E& error() noexcept
+        {
+            return m_error;
+        }
+
+        const E& error() const noexcept
+        {
+            return m_error;
+        }
+    };
+
+    // Either a value or an error (a subset of C++23's std::expected that never throws).
+    // Accessing the value of an expected holding an error (or vice versa) is undefined behavior, check has_value() first.
+    template<typename T, typename E>
+    class expected
+    {
+        std::variant<T, E> m_storage;
+
+    public:
+
+        template<typename U = T, typename = std::enable_if_t<std::is_constructible<T, U&&>::value && 
+                                                               !std::is_same<std::decay_t<U>, expected>::value &&
+                                                               !std::is_same<std::decay_t<U>, unexpected<E>>::value>>
+        expected(U&& value) :
+            m_storage(std::in_place_index<0>, std::forward<U>(value))
+        {
+        }
+
+        expected(unexpected<E> error) :
+            m_storage(std::in_place_index<1>, std::move(error.error()))
+        {
+        }
+
+        bool has_value() const noexcept
+        {
+            return m_storage.index() == 0;
+        }
+
+        explicit operator bool() const noexcept
+        {
+            return has_value();
+        }
+
+        T& operator*() noexcept
+        {
+            return *std::get_if<0>(&m_storage);
+        }
+
+        const T& operator*() const noexcept
+        {
+            return *std::get_if<0>(&m_storage);
+        }
+
+        T* operator->() noexcept
+        {
+            return std::get_if<0>(&m_storage);
+        }
+
+        const T* operator->() const noexcept
+        {
+            return std::get_if<0>(&m_storage);
+        }
+
+        template<typename U>
+        T value_or(U&& default_value) const
+        {
+            return has_value() ? **this : static_cast<T>(std::forward<U>(default_value));
+        }
+
+        const E& error() const noexcept
+        {
+            return *std::get_if<1>(&m_storage);
+        }
+    };
+
+    // Lazy initialization for code built without exceptions.
+    // The init function returns expected<T, E>, and its result (value or error) is cached and returned by reference.
+    // A failed initialization is not retried until reset() is called.
+    template<typename T, typename E>
+    class lazy_expected
+    {
+        detail::once_state m_state;
+        std::function<expected<T, E>()> m_init_func;
+        mutable std::optional<expected<T, E>> m_result;
+
+    public:
+
+        explicit lazy_expected(std::function<expected<T, E>()> initFunc) :
+            m_init_func(std::move(initFunc))
+        {
+        }
+
+        lazy_expected(std::string name, std::function<expected<T, E>()> initFunc) :
+            m_init_func(std::move(initFunc))
+        {
+            m_state.set_name(std::move(name));
+        }
+
+        lazy_expected(const lazy_expected&) = delete;
+        lazy_expected& operator=(const lazy_expected&) = delete;
+
+        lazy_expected(lazy_expected&& other) noexcept(std::is_nothrow_move_constructible<expected<T, E>>::value) :
+            m_init_func(std::move(other.m_init_func)),
+            m_result(std::move(other.m_result))
+        {
+            m_state.take_over(other.m_state);
+            other.m_result.reset();
+        }
+
+        lazy_expected& operator=(lazy_expected&& other) noexcept(std::is_nothrow_move_constructible<expected<T, E>>::value && 
+                                                                 std::is_nothrow_move_assignable<expected<T, E>>::value)
+        {
+            if (this != &other)
+            {
+                m_init_func = std::move(other.m_init_func);
+                m_result = std::move(other.m_result);
+                m_state.take_over(other.m_state);
+                other.m_result.reset();
+            }
+            return *this;
+        }
+
+        void reset() noexcept
+        {
+            m_result.reset();
+            m_state.store(false);
+        }
+
+        bool is_initialized() const noexcept
+        {
+            return m_state.is_initialized();
+        }
+
+#if CPPLAZY_ENABLE_INSTRUMENTATION
+        lazy_stats stats() const noexcept
+        {
+            return m_state.stats();
+        }
+#endif
+
+        const expected<T, E>& get() const
+        {
+            if (!m_state.is_initialized())
+            {
+                initialize();
+            }
+            return *m_result;
+        }
+
+        const expected<T, E>* operator->() const
+        {
+            return &get();
+        }
+
+        const expected<T, E>& operator*() const
+        {
+            return get();
+        }
+
+    private:
+
+        void initialize() const
+        {
+            if (m_state.try_begin())
+            {
+                detail::init_guard guard(m_state); // In case the init function throws anyway
+                m_result = m_init_func();
+                m_state.set_value(*m_result);
+                guard.commit();
+            }
+        }
+    };
+
+    // A write-once cell (similar to Rust's OnceCell): unlike lazy<T>, the value can be provided 
+    // by whoever has it first, either with set() or with get_or_init() on demand.
+    // All functions are thread safe, except for moving, take() and reset().
+    template<typename T>
+    class once_cell
+    {
+        detail::once_state m_state;
+        std::optional<T> m_value;
+
+    public:
+
+        once_cell() = default;
+
+        explicit once_cell(std::string name)
+        {
+            m_state.set_name(std::move(name));
+        }
+
+        once_cell(const once_cell&) = delete;
+        once_cell& operator=(const once_cell&) = delete;
+
+        once_cell(once_cell&& other) noexcept(std::is_nothrow_move_constructible<T>::value) :
+            m_value(std::move(other.m_value))
+        {
+            m_state.take_over(other.m_state);
+            other.m_value.reset();
+        }
+
+        once_cell& operator=(once_cell&& other) noexcept(std::is_nothrow_move_constructible<T>::value && std::is_nothrow_move_assignable<T>::value)
+        {
+            if (this != &other)
+            {
+                m_value = std::move(other.m_value);
+                m_state.take_over(other.m_state);
+                other.m_value.reset();
+            }
+            return *this;
+        }
+
+        // Returns false (and discards value) if the cell was already set.
+        // If another thread is setting the cell, waits for it to finish first.
+        template<typename U = T>
+        bool set(U&& value)
+        {
+            return emplace_if_empty([&value]() -> T { return std::forward<U>(value); });
+        }
+
+        // Returns nullptr if the cell was not set yet.
+        T* get() noexcept
+        {
+            return m_state.is_initialized() ? &*m_value : nullptr;
+        }
+
+        const T* get() const noexcept
+        {
+            return m_state.is_initialized() ? &*m_value : nullptr;
+        }
+
+        // Blocks until the cell is set.
+        T& wait()
+        {
+            m_state.wait();
+            return *m_value;
+        }
 
-            const bool was_other_initialized = [&other]()
+        const T& wait() const
+        {
+            m_state.wait();
+            return *m_value;
+        }
+
+        // Sets the cell to initFunc() if it is empty. If initFunc throws, the cell stays empty and the exception propagates.
+        template<typename F>
+        T& get_or_init(F&& initFunc)
+        {
+            if (!m_state.is_initialized())
             {
-                bool other_once_flag_used = true;
-                std::call_once(other.m_init_flag, [&other_once_flag_used]() { other_once_flag_used = false; });
-                return other_once_flag_used;
-            }();
-            
-            if (was_other_initialized)
+                emplace_if_empty(std::forward<F>(initFunc));
+            }
+            return *m_value;
+        }
+
+        bool is_initialized() const noexcept
+        {
+            return m_state.is_initialized();
+        }
+
+#if CPPLAZY_ENABLE_INSTRUMENTATION
+        lazy_stats stats() const noexcept
+        {
+            return m_state.stats();
+        }
+#endif
+
+        std::optional<T> take()
+        {
+            std::optional<T> value = std::move(m_value);
+            reset();
+            return value;
+        }
+
+        void reset() noexcept
+        {
+            m_value.reset();
+            m_state.store(false);
+        }
+
+    private:
+
+        template<typename F>
+        bool emplace_if_empty(F&& initFunc)
+        {
+            if (!m_state.try_begin())
             {
-                std::call_once(m_init_flag, [this, &other]() { m_value.swap(other.m_value); });
+                return false;
             }
+            detail::init_guard guard(m_state);
+            m_value.emplace(std::forward<F>(initFunc)());
+            m_state.set_value(*m_value);
+            guard.commit();
+            return true;
+        }
+    };
+
+    // A lazy object for namespace scope (or static members), which is constant initialized:
+    // unlike lazy<T>, constructing it runs no code before main, and it can't suffer from the static initialization order fiasco.
+    // F is stored as is (no std::function), and must be a literal type, e.g. a lambda without captures or a function pointer.
+    //
+    //  CPPLAZY_CONSTINIT cpplazy::lazy_static config{ [] { return load_config(); } };
+    template<typename T, typename F>
+    class lazy_static
+    {
+        friend class static_registration;
+
+        detail::once_state m_state;
+        const F m_init_func;
+        mutable std::optional<T> m_value;
+
+    public:
+
+        constexpr explicit lazy_static(F initFunc) noexcept(std::is_nothrow_move_constructible<F>::value) :
+            m_init_func(std::move(initFunc))
+        {
+        }
+
+        lazy_static(const lazy_static&) = delete;
+        lazy_static& operator=(const lazy_static&) = delete;
+
+        bool is_initialized() const noexcept
+        {
+            return m_state.is_initialized();
         }
 
+#if CPPLAZY_ENABLE_INSTRUMENTATION
+        lazy_stats stats() const noexcept
+        {
+            return m_state.stats();
+        }
+#endif
+
         std::optional<T>* operator->()
         {
             return get_or_init();
         }
 
-        const std::optional<T>* const operator->() const
+        const std::optional<T>* operator->() const
         {
             return get_or_init();
         }
@@ -90,18 +1972,83 @@ namespace cpplazy
 
         std::optional<T>* get_or_init() const
         {
-            try
+            return detail::get_or_init(m_state, m_value, m_init_func);
+        }
+    };
+
+    template<typename F>
+    lazy_static(F) -> lazy_static<std::invoke_result_t<const F&>, F>;
+
+    // Adds a lazy_static to a global list, for warming up all of them at once (see warm_up_statics()) or for introspection.
+    // With CPPLAZY_ENABLE_INSTRUMENTATION, it is also listed by for_each_registered() under the given name.
+    // A registration must have static storage duration, it is never removed from the list:
+    //
+    //  static cpplazy::static_registration config_registration{ config, "config" };
+    class static_registration
+    {
+        const char* m_name;
+        const void* m_object;
+        bool (*m_is_initialized)(const void*);
+        void (*m_warm_up)(const void*);
+        static_registration* m_next = nullptr;
+
+        static std::atomic<static_registration*>& head() noexcept
+        {
+            static std::atomic<static_registration*> registrations{ nullptr }; // Constant initialized
+            return registrations;
+        }
+
+    public:
+
+        template<typename T, typename F>
+        static_registration(const lazy_static<T, F>& object, const char* name) :
+            m_name(name),
+            m_object(&object),
+            m_is_initialized([](const void* o) { return static_cast<const lazy_static<T, F>*>(o)->is_initialized(); }),
+            m_warm_up([](const void* o) { static_cast<const lazy_static<T, F>*>(o)->operator->(); })
+        {
+            object.m_state.set_name(name);
+            std::atomic<static_registration*>& registrations = head();
+            m_next = registrations.load(std::memory_order_relaxed);
+            while (!registrations.compare_exchange_weak(m_next, this, std::memory_order_release, std::memory_order_relaxed))
             {
-                std::call_once(m_init_flag, [this]() { m_value = m_init_func(); });
             }
-            catch (...)
-            {
+        }
 
-            }
+        static_registration(const static_registration&) = delete;
+        static_registration& operator=(const static_registration&) = delete;
+
+        const char* name() const noexcept
+        {
+            return m_name;
+        }
+
+        bool is_initialized() const noexcept
+        {
+            return m_is_initialized(m_object);
+        }
 
-            return &m_value;
+        void warm_up() const
+        {
+            m_warm_up(m_object);
+        }
+
+        // Calls func(const static_registration&) for every registration, most recent first.
+        template<typename Func>
+        static void for_each(Func&& func)
+        {
+            for (const static_registration* r = head().load(std::memory_order_acquire); r; r = r->m_next)
+            {
+                func(*r);
+            }
         }
     };
 
+    // Initializes every registered lazy_static, e.g. at the end of startup, or before forking workers.
+    inline void warm_up_statics()
+    {
+        static_registration::for_each([](const static_registration& r) { r.warm_up(); });
+    }
+
     //TODO: Add deduction guids to allow cpplazy::lazy lazy_string{[](){return ""s;}; ?
 }
\ No newline at end of file
@@ -0,0 +1,512 @@
+// Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+// Copyright (c) 2020 Ziv Shahaf <ziv.shahaf@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// lazy_decoded<Fields...>: reads fields of a serialized message (protobuf wire format) only when they are accessed, 
+// straight from the original buffer, and caches each decoded field.
+//
+// Protobuf scalar types, and the C++ field types that read them:
+//  int32, int64, uint32, uint64    any integer type (negative int32/int64 are read back through truncation)
+//  sint32, sint64                  sint<std::int32_t>, sint<std::int64_t> (zigzag)
+//  fixed32, fixed64                any unsigned integer type
+//  sfixed32, sfixed64              any signed integer type (sfixed32 is sign extended into 64-bit ones)
+//  bool, enum                      bool, any enum type
+//  float, double                   float, double
+// Packed repeated integers are read as varints, so packed fixed32/fixed64/sfixed32/sfixed64 are not supported.
+
+#include "cpplazy.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+
+namespace cpplazy
+{
+    enum class wire_type : std::uint8_t
+    {
+        varint = 0,
+        fixed64 = 1,
+        length_delimited = 2,
+        fixed32 = 5
+    };
+
+    // One field of a message, as found in the buffer. data is the raw varint, the 4 or 8 little endian bytes, or the length delimited payload.
+    struct wire_field
+    {
+        std::uint32_t number;
+        wire_type type;
+        std::string_view data;
+    };
+
+    // A sint32/sint64 field (zigzag encoded), as in field<3, sint<std::int64_t>>. Converts to T.
+    template<typename T>
+    struct sint
+    {
+        static_assert(std::is_integral<T>::value && std::is_signed<T>::value, "sint holds a signed integer");
+        using value_type = T;
+
+        T value = 0;
+
+        operator T() const noexcept
+        {
+            return value;
+        }
+    };
+
+    namespace detail
+    {
+        // Reads a varint at pos, advancing it. Returns false if truncated or longer than 10 bytes.
+        inline bool read_varint(std::string_view buffer, std::size_t& pos, std::uint64_t& value) noexcept
+        {
+            value = 0;
+            for (unsigned shift = 0; shift < 70 && pos < buffer.size(); shift += 7)
+            {
+                const auto byte = static_cast<unsigned char>(buffer[pos++]);
+                value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+                if (!(byte & 0x80))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        inline std::uint64_t read_little_endian(std::string_view bytes) noexcept
+        {
+            std::uint64_t value = 0;
+            for (std::size_t i = bytes.size(); i-- > 0;)
+            {
+                value = (value << 8) | static_cast<unsigned char>(bytes[i]);
+            }
+            return value;
+        }
+
+        // Indexes every field of buffer in one pass. Stops at the first malformed field.
+        inline std::error_code index_fields(std::string_view buffer, std::vector<wire_field>& fields)
+        {
+            for (std::size_t pos = 0; pos < buffer.size();)
+            {
+                std::uint64_t key;
+                if (!read_varint(buffer, pos, key) || (key >> 3) == 0 || (key >> 3) > 0x1FFFFFFF)
+                {
+                    return std::make_error_code(std::errc::illegal_byte_sequence);
+                }
+                const std::size_t begin = pos;
+                std::size_t size;
+                std::uint64_t value;
+                switch (static_cast<wire_type>(key & 7))
+                {
+                case wire_type::varint:
+                    if (!read_varint(buffer, pos, value))
+                    {
+                        return std::make_error_code(std::errc::illegal_byte_sequence);
+                    }
+                    size = pos - begin;
+                    break;
+                case wire_type::fixed64:
+                    size = 8;
+                    break;
+                case wire_type::fixed32:
+                    size = 4;
+                    break;
+                case wire_type::length_delimited:
+                    if (!read_varint(buffer, pos, value) || value > buffer.size() - pos)
+                    {
+                        return std::make_error_code(std::errc::illegal_byte_sequence);
+                    }
+                    size = static_cast<std::size_t>(value);
+                    break;
+                default: // Groups are not supported
+                    return std::make_error_code(std::errc::illegal_byte_sequence);
+                }
+                const std::size_t data_begin = key % 8 == 0 ? begin : pos;
+                if (size > buffer.size() - data_begin)
+                {
+                    return std::make_error_code(std::errc::illegal_byte_sequence);
+                }
+                fields.push_back({ static_cast<std::uint32_t>(key >> 3), static_cast<wire_type>(key & 7), buffer.substr(data_begin, size) });
+                pos = data_begin + size;
+            }
+            return {};
+        }
+
+        template<typename T>
+        struct is_sint : std::false_type
+        {
+        };
+
+        template<typename T>
+        struct is_sint<sint<T>> : std::true_type
+        {
+        };
+
+        template<typename T>
+        using is_scalar_field = std::integral_constant<bool, std::is_arithmetic<T>::value || std::is_enum<T>::value || is_sint<T>::value>;
+
+        // Decodes one scalar (integer, sint, bool, enum, float or double). Returns false on a wire type mismatch or a malformed varint.
+        template<typename T>
+        bool decode_scalar(wire_type type, std::string_view data, T& value) noexcept
+        {
+            if constexpr (is_sint<T>::value)
+            {
+                std::uint64_t raw;
+                std::size_t pos = 0;
+                if (type != wire_type::varint || !read_varint(data, pos, raw))
+                {
+                    return false;
+                }
+                value.value = static_cast<typename T::value_type>(static_cast<std::int64_t>(raw >> 1) ^ -static_cast<std::int64_t>(raw & 1));
+                return true;
+            }
+            else if constexpr (std::is_floating_point<T>::value)
+            {
+                if (type != (sizeof(T) == 4 ? wire_type::fixed32 : wire_type::fixed64) || data.size() != sizeof(T))
+                {
+                    return false;
+                }
+                using bits = typename std::conditional<sizeof(T) == 4, std::uint32_t, std::uint64_t>::type;
+                const bits raw = static_cast<bits>(read_little_endian(data));
+                std::memcpy(&value, &raw, sizeof(T));
+                return true;
+            }
+            else
+            {
+                std::uint64_t raw;
+                if (type == wire_type::varint)
+                {
+                    std::size_t pos = 0;
+                    if (!read_varint(data, pos, raw))
+                    {
+                        return false;
+                    }
+                }
+                else if (type == wire_type::fixed32 || type == wire_type::fixed64)
+                {
+                    raw = read_little_endian(data);
+                    if (type == wire_type::fixed32 && std::is_signed<T>::value)
+                    {
+                        raw = static_cast<std::uint64_t>(static_cast<std::int64_t>(static_cast<std::int32_t>(raw))); // sfixed32 into a wider target
+                    }
+                }
+                else
+                {
+                    return false;
+                }
+                if constexpr (std::is_same<T, bool>::value)
+                {
+                    value = raw != 0;
+                }
+                else
+                {
+                    value = static_cast<T>(raw); // Negative int32/int64 are sign extended to 64 bits on the wire, truncating restores them
+                }
+                return true;
+            }
+        }
+
+        // Decodes consecutive scalars from a packed repeated field. Integers in packed fields are read as varints.
+        template<typename T>
+        void decode_packed(std::string_view data, std::vector<T>& values)
+        {
+            for (std::size_t pos = 0; pos < data.size();)
+            {
+                T value;
+                if constexpr (std::is_floating_point<T>::value)
+                {
+                    if (data.size() - pos < sizeof(T))
+                    {
+                        return;
+                    }
+                    decode_scalar(sizeof(T) == 4 ? wire_type::fixed32 : wire_type::fixed64, data.substr(pos, sizeof(T)), value);
+                    pos += sizeof(T);
+                }
+                else
+                {
+                    const std::size_t begin = pos;
+                    std::uint64_t raw;
+                    if (!read_varint(data, pos, raw))
+                    {
+                        return;
+                    }
+                    decode_scalar(wire_type::varint, data.substr(begin, pos - begin), value);
+                }
+                values.push_back(value);
+            }
+        }
+    }
+
+    // A serialized message, indexed on the first lookup. Does not own the buffer, which must outlive the view (and everything decoded from it).
+    // Thread safe (the index is built once).
+    class message_view
+    {
+        struct index
+        {
+            std::vector<wire_field> fields; // Sorted by number, in buffer order for each number
+            std::error_code error;
+        };
+
+        std::string_view m_buffer;
+        mutable once_cell<index> m_index;
+
+        const index& get_index() const
+        {
+            return m_index.get_or_init([this] {
+                index result;
+                result.error = detail::index_fields(m_buffer, result.fields);
+                if (!std::is_sorted(result.fields.begin(), result.fields.end(), by_number)) // Usually already sorted, fields are written in order
+                {
+                    std::stable_sort(result.fields.begin(), result.fields.end(), by_number);
+                }
+                return result;
+            });
+        }
+
+        static bool by_number(const wire_field& a, const wire_field& b) noexcept
+        {
+            return a.number < b.number;
+        }
+
+        std::pair<const wire_field*, const wire_field*> range(std::uint32_t number) const
+        {
+            const std::vector<wire_field>& fields = get_index().fields;
+            const auto found = std::equal_range(fields.begin(), fields.end(), wire_field{ number, wire_type::varint, {} }, by_number);
+            return { fields.data() + (found.first - fields.begin()), fields.data() + (found.second - fields.begin()) };
+        }
+
+    public:
+
+        message_view() = default;
+
+        explicit message_view(std::string_view buffer) noexcept :
+            m_buffer(buffer)
+        {
+        }
+
+        std::string_view bytes() const noexcept
+        {
+            return m_buffer;
+        }
+
+        bool is_indexed() const noexcept
+        {
+            return m_index.is_initialized();
+        }
+
+        // illegal_byte_sequence if the buffer is malformed (the fields before the malformed one are still available).
+        std::error_code error() const
+        {
+            return get_index().error;
+        }
+
+        bool has(std::uint32_t number) const
+        {
+            const auto found = range(number);
+            return found.first != found.second;
+        }
+
+        // The last occurrence of the field (which wins for non repeated fields), nullptr if absent.
+        const wire_field* find(std::uint32_t number) const
+        {
+            const auto found = range(number);
+            return found.first != found.second ? found.second - 1 : nullptr;
+        }
+
+        // Calls func(const wire_field&) for every occurrence of the field, in buffer order.
+        template<typename Func>
+        void for_each(std::uint32_t number, Func&& func) const
+        {
+            const auto found = range(number);
+            for (const wire_field* field = found.first; field != found.second; field++)
+            {
+                func(*field);
+            }
+        }
+    };
+
+    // How a field of type T is decoded. Specialize for custom types.
+    // Built in: the scalar types listed at the top of this file, std::string_view (points into the buffer), std::string, 
+    // std::vector<T> (repeated fields, packed or not), and any type constructible from the std::string_view of 
+    // a length delimited field (such as message_view and lazy_decoded, for nested messages).
+    // A missing field, or one with an unexpected wire type, decodes to T{}.
+    template<typename T, typename = void>
+    struct field_decoder
+    {
+        static T decode(const message_view& message, std::uint32_t number)
+        {
+            T value{};
+            if (const wire_field* field = message.find(number))
+            {
+                if constexpr (detail::is_scalar_field<T>::value)
+                {
+                    detail::decode_scalar(field->type, field->data, value);
+                }
+                else if (field->type == wire_type::length_delimited)
+                {
+                    if constexpr (std::is_same<T, std::string_view>::value)
+                    {
+                        value = field->data;
+                    }
+                    else if constexpr (std::is_same<T, std::string>::value)
+                    {
+                        value.assign(field->data.data(), field->data.size());
+                    }
+                    else
+                    {
+                        return T(field->data);
+                    }
+                }
+            }
+            return value;
+        }
+    };
+
+    template<typename T>
+    struct field_decoder<std::vector<T>>
+    {
+        static std::vector<T> decode(const message_view& message, std::uint32_t number)
+        {
+            std::vector<T> values;
+            message.for_each(number, [&values](const wire_field& field) {
+                if constexpr (detail::is_scalar_field<T>::value)
+                {
+                    if (field.type == wire_type::length_delimited)
+                    {
+                        detail::decode_packed(field.data, values);
+                        return;
+                    }
+                }
+                values.push_back(decode_one(field));
+            });
+            return values;
+        }
+
+    private:
+
+        static T decode_one(const wire_field& field)
+        {
+            if constexpr (detail::is_scalar_field<T>::value)
+            {
+                T value{};
+                detail::decode_scalar(field.type, field.data, value);
+                return value;
+            }
+            else if constexpr (std::is_same<T, std::string_view>::value)
+            {
+                return field.data;
+            }
+            else if constexpr (std::is_same<T, std::string>::value)
+            {
+                return std::string(field.data);
+            }
+            else
+            {
+                return T(field.data);
+            }
+        }
+    };
+
+    // Declares field Number of a lazy_decoded message, decoded as T.
+    template<std::uint32_t Number, typename T>
+    struct field
+    {
+        static constexpr std::uint32_t number = Number;
+        using type = T;
+    };
+
+    // A message whose fields are decoded on first access and cached, the rest of the buffer is never touched.
+    // The buffer is indexed once, on the first access to any field.
+    //
+    //  using order = cpplazy::lazy_decoded<cpplazy::field<1, std::uint64_t>, cpplazy::field<2, std::string_view>, cpplazy::field<7, std::vector<item>>>;
+    //  order o{ buffer };
+    //  std::uint64_t id = o.get<1>(); //Only decodes field 1
+    //
+    // Does not own the buffer. Thread safe, except for moving.
+    template<typename... Fields>
+    class lazy_decoded
+    {
+        static constexpr std::uint32_t numbers[] = { Fields::number..., 0 };
+
+        template<std::uint32_t Number>
+        static constexpr std::size_t slot() noexcept
+        {
+            std::size_t i = 0;
+            while (i < sizeof...(Fields) && numbers[i] != Number)
+            {
+                i++;
+            }
+            return i;
+        }
+
+        message_view m_message;
+        mutable std::tuple<once_cell<typename Fields::type>...> m_values;
+
+    public:
+
+        lazy_decoded() = default;
+
+        explicit lazy_decoded(std::string_view buffer) noexcept :
+            m_message(buffer)
+        {
+        }
+
+        // The decoded field, decoded now if this is the first access.
+        template<std::uint32_t Number>
+        const auto& get() const
+        {
+            constexpr std::size_t index = slot<Number>();
+            static_assert(index < sizeof...(Fields), "Number is not a declared field");
+            using type = typename std::tuple_element<index, std::tuple<typename Fields::type...>>::type;
+            return std::get<index>(m_values).get_or_init([this] { return field_decoder<type>::decode(m_message, Number); });
+        }
+
+        template<std::uint32_t Number>
+        bool is_decoded() const noexcept
+        {
+            constexpr std::size_t index = slot<Number>();
+            static_assert(index < sizeof...(Fields), "Number is not a declared field");
+            return std::get<index>(m_values).is_initialized();
+        }
+
+        // Whether the field is present in the buffer (a missing field still decodes to its default value).
+        bool has(std::uint32_t number) const
+        {
+            return m_message.has(number);
+        }
+
+        std::error_code error() const
+        {
+            return m_message.error();
+        }
+
+        // For fields that were not declared.
+        const message_view& message() const noexcept
+        {
+            return m_message;
+        }
+    };
+}
@@ -0,0 +1,584 @@
+// Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+// Copyright (c) 2020 Ziv Shahaf <ziv.shahaf@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// lazy_expr<T>: arithmetic over float and double arrays, built as an expression and evaluated in one SIMD pass when read.
+
+#include "cpplazy.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CPPLAZY_EXPR_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define CPPLAZY_EXPR_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Compiles one function for an instruction set the rest of the program may not be built for.
+// MSVC accepts any intrinsic without it.
+#if defined(__GNUC__) || defined(__clang__)
+#define CPPLAZY_TARGET(isa) __attribute__((target(isa)))
+#else
+#define CPPLAZY_TARGET(isa)
+#endif
+
+
+namespace cpplazy
+{
+    enum class simd_level
+    {
+        scalar,
+        sse2,
+        avx2,
+        neon // aarch64 only, where it is always present
+    };
+
+    namespace detail
+    {
+        inline simd_level detect_simd_level()
+        {
+#if defined(CPPLAZY_EXPR_X86) && (defined(__GNUC__) || defined(__clang__))
+            __builtin_cpu_init(); // May run before the constructor that initializes it, from a static initializer
+            if (__builtin_cpu_supports("avx2"))
+            {
+                return simd_level::avx2;
+            }
+            return __builtin_cpu_supports("sse2") ? simd_level::sse2 : simd_level::scalar;
+#elif defined(CPPLAZY_EXPR_X86)
+            int info[4];
+            __cpuid(info, 0);
+            const int highest = info[0];
+            __cpuid(info, 1);
+            const bool sse2 = (info[3] & (1 << 26)) != 0;
+            const bool os_saves_ymm = (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6; // OSXSAVE, and the OS saves the AVX registers
+            if (highest >= 7 && os_saves_ymm)
+            {
+                __cpuidex(info, 7, 0);
+                if (info[1] & (1 << 5))
+                {
+                    return simd_level::avx2;
+                }
+            }
+            return sse2 ? simd_level::sse2 : simd_level::scalar;
+#elif defined(CPPLAZY_EXPR_NEON)
+            return simd_level::neon;
+#else
+            return simd_level::scalar;
+#endif
+        }
+    }
+
+    // The widest instruction set of the running processor, detected on first use.
+    inline simd_level detected_simd_level()
+    {
+        static const simd_level level = detail::detect_simd_level();
+        return level;
+    }
+
+    namespace detail
+    {
+        enum class expr_op
+        {
+            add,
+            subtract,
+            multiply,
+            divide
+        };
+
+        // Elements evaluated at a time. Intermediate results of a block stay in the L1 cache.
+        constexpr std::size_t expr_block = 256;
+
+        // A block of values, or a scalar standing for all of them when values is null.
+        template<typename T>
+        struct expr_operand
+        {
+            const T* values;
+            T scalar;
+        };
+
+        template<expr_op Op, typename T>
+        T combine_scalar(T a, T b)
+        {
+            if constexpr (Op == expr_op::add)
+            {
+                return a + b;
+            }
+            else if constexpr (Op == expr_op::subtract)
+            {
+                return a - b;
+            }
+            else if constexpr (Op == expr_op::multiply)
+            {
+                return a * b;
+            }
+            else
+            {
+                return a / b;
+            }
+        }
+
+        template<expr_op Op, typename T>
+        void apply_scalar(T* out, const expr_operand<T>& a, const expr_operand<T>& b, std::size_t begin, std::size_t count)
+        {
+            for (std::size_t i = begin; i < count; i++)
+            {
+                out[i] = combine_scalar<Op>(a.values ? a.values[i] : a.scalar, b.values ? b.values[i] : b.scalar);
+            }
+        }
+
+        struct scalar_lanes
+        {
+            template<expr_op Op, typename T>
+            static void apply(T* out, const expr_operand<T>& a, const expr_operand<T>& b, std::size_t count)
+            {
+                apply_scalar<Op>(out, a, b, 0, count);
+            }
+        };
+
+        // The lane loop of an instruction set, in a function compiled for that set. Vector values never cross
+        // a call to code compiled without it, only pointers do, so mixing the sets is safe at any optimization level.
+#define CPPLAZY_EXPR_LANES(target) \
+        template<expr_op Op, typename T> \
+        target static void apply(T* out, const expr_operand<T>& a, const expr_operand<T>& b, std::size_t count) \
+        { \
+            using vector = decltype(load(out)); \
+            constexpr std::size_t width = sizeof(vector) / sizeof(T); \
+            std::size_t i = 0; \
+            if (a.values && b.values) \
+            { \
+                for (; i + width <= count; i += width) \
+                { \
+                    store(out + i, combine<Op>(load(a.values + i), load(b.values + i))); \
+                } \
+            } \
+            else if (a.values) \
+            { \
+                const vector right = broadcast(b.scalar); \
+                for (; i + width <= count; i += width) \
+                { \
+                    store(out + i, combine<Op>(load(a.values + i), right)); \
+                } \
+            } \
+            else if (b.values) \
+            { \
+                const vector left = broadcast(a.scalar); \
+                for (; i + width <= count; i += width) \
+                { \
+                    store(out + i, combine<Op>(left, load(b.values + i))); \
+                } \
+            } \
+            apply_scalar<Op>(out, a, b, i, count); \
+        }
+
+#if defined(CPPLAZY_EXPR_X86)
+#define CPPLAZY_SSE2 CPPLAZY_TARGET("sse2")
+#define CPPLAZY_AVX2 CPPLAZY_TARGET("avx2") // Without "fma": every level rounds each operation the same way
+
+        struct sse2_lanes
+        {
+            CPPLAZY_SSE2 static __m128 load(const float* p) { return _mm_loadu_ps(p); }
+            CPPLAZY_SSE2 static __m128d load(const double* p) { return _mm_loadu_pd(p); }
+            CPPLAZY_SSE2 static __m128 broadcast(float value) { return _mm_set1_ps(value); }
+            CPPLAZY_SSE2 static __m128d broadcast(double value) { return _mm_set1_pd(value); }
+            CPPLAZY_SSE2 static void store(float* p, __m128 value) { _mm_storeu_ps(p, value); }
+            CPPLAZY_SSE2 static void store(double* p, __m128d value) { _mm_storeu_pd(p, value); }
+
+            template<expr_op Op>
+            CPPLAZY_SSE2 static __m128 combine(__m128 a, __m128 b)
+            {
+                if constexpr (Op == expr_op::add) return _mm_add_ps(a, b);
+                else if constexpr (Op == expr_op::subtract) return _mm_sub_ps(a, b);
+                else if constexpr (Op == expr_op::multiply) return _mm_mul_ps(a, b);
+                else return _mm_div_ps(a, b);
+            }
+
+            template<expr_op Op>
+            CPPLAZY_SSE2 static __m128d combine(__m128d a, __m128d b)
+            {
+                if constexpr (Op == expr_op::add) return _mm_add_pd(a, b);
+                else if constexpr (Op == expr_op::subtract) return _mm_sub_pd(a, b);
+                else if constexpr (Op == expr_op::multiply) return _mm_mul_pd(a, b);
+                else return _mm_div_pd(a, b);
+            }
+
+            CPPLAZY_EXPR_LANES(CPPLAZY_SSE2)
+        };
+
+        struct avx2_lanes
+        {
+            CPPLAZY_AVX2 static __m256 load(const float* p) { return _mm256_loadu_ps(p); }
+            CPPLAZY_AVX2 static __m256d load(const double* p) { return _mm256_loadu_pd(p); }
+            CPPLAZY_AVX2 static __m256 broadcast(float value) { return _mm256_set1_ps(value); }
+            CPPLAZY_AVX2 static __m256d broadcast(double value) { return _mm256_set1_pd(value); }
+            CPPLAZY_AVX2 static void store(float* p, __m256 value) { _mm256_storeu_ps(p, value); }
+            CPPLAZY_AVX2 static void store(double* p, __m256d value) { _mm256_storeu_pd(p, value); }
+
+            template<expr_op Op>
+            CPPLAZY_AVX2 static __m256 combine(__m256 a, __m256 b)
+            {
+                if constexpr (Op == expr_op::add) return _mm256_add_ps(a, b);
+                else if constexpr (Op == expr_op::subtract) return _mm256_sub_ps(a, b);
+                else if constexpr (Op == expr_op::multiply) return _mm256_mul_ps(a, b);
+                else return _mm256_div_ps(a, b);
+            }
+
+            template<expr_op Op>
+            CPPLAZY_AVX2 static __m256d combine(__m256d a, __m256d b)
+            {
+                if constexpr (Op == expr_op::add) return _mm256_add_pd(a, b);
+                else if constexpr (Op == expr_op::subtract) return _mm256_sub_pd(a, b);
+                else if constexpr (Op == expr_op::multiply) return _mm256_mul_pd(a, b);
+                else return _mm256_div_pd(a, b);
+            }
+
+            CPPLAZY_EXPR_LANES(CPPLAZY_AVX2)
+        };
+
+#undef CPPLAZY_SSE2
+#undef CPPLAZY_AVX2
+#elif defined(CPPLAZY_EXPR_NEON)
+        struct neon_lanes
+        {
+            static float32x4_t load(const float* p) { return vld1q_f32(p); }
+            static float64x2_t load(const double* p) { return vld1q_f64(p); }
+            static float32x4_t broadcast(float value) { return vdupq_n_f32(value); }
+            static float64x2_t broadcast(double value) { return vdupq_n_f64(value); }
+            static void store(float* p, float32x4_t value) { vst1q_f32(p, value); }
+            static void store(double* p, float64x2_t value) { vst1q_f64(p, value); }
+
+            template<expr_op Op>
+            static float32x4_t combine(float32x4_t a, float32x4_t b)
+            {
+                if constexpr (Op == expr_op::add) return vaddq_f32(a, b);
+                else if constexpr (Op == expr_op::subtract) return vsubq_f32(a, b);
+                else if constexpr (Op == expr_op::multiply) return vmulq_f32(a, b);
+                else return vdivq_f32(a, b);
+            }
+
+            template<expr_op Op>
+            static float64x2_t combine(float64x2_t a, float64x2_t b)
+            {
+                if constexpr (Op == expr_op::add) return vaddq_f64(a, b);
+                else if constexpr (Op == expr_op::subtract) return vsubq_f64(a, b);
+                else if constexpr (Op == expr_op::multiply) return vmulq_f64(a, b);
+                else return vdivq_f64(a, b);
+            }
+
+            CPPLAZY_EXPR_LANES()
+        };
+#endif
+
+#undef CPPLAZY_EXPR_LANES
+
+        // Expression nodes. blocks is the scratch space, in expr_block sized blocks, a node needs for its
+        // own result and the results of the nodes below it.
+        template<typename T>
+        struct array_node
+        {
+            static constexpr std::size_t blocks = 0;
+
+            const T* values;
+            std::size_t count;
+
+            std::size_t size() const
+            {
+                return count;
+            }
+
+            T at(std::size_t index) const
+            {
+                return values[index];
+            }
+
+            template<typename Lanes>
+            expr_operand<T> evaluate(std::size_t begin, std::size_t, T*) const
+            {
+                return { values + begin, T() };
+            }
+
+            template<typename Lanes>
+            expr_operand<T> evaluate_into(std::size_t begin, std::size_t, T*, T*) const
+            {
+                return { values + begin, T() };
+            }
+        };
+
+        template<typename T>
+        struct scalar_node
+        {
+            static constexpr std::size_t blocks = 0;
+
+            T value;
+
+            std::size_t size() const
+            {
+                return (std::numeric_limits<std::size_t>::max)(); // Matches arrays of any size
+            }
+
+            T at(std::size_t) const
+            {
+                return value;
+            }
+
+            template<typename Lanes>
+            expr_operand<T> evaluate(std::size_t, std::size_t, T*) const
+            {
+                return { nullptr, value };
+            }
+
+            template<typename Lanes>
+            expr_operand<T> evaluate_into(std::size_t, std::size_t, T*, T*) const
+            {
+                return { nullptr, value };
+            }
+        };
+
+        template<expr_op Op, typename T, typename L, typename R>
+        struct binary_node
+        {
+            static constexpr std::size_t blocks = 1 + L::blocks + R::blocks;
+
+            L left;
+            R right;
+
+            std::size_t size() const
+            {
+                return (std::min)(left.size(), right.size());
+            }
+
+            T at(std::size_t index) const
+            {
+                return combine_scalar<Op>(left.at(index), right.at(index));
+            }
+
+            // The result goes to the first scratch block, the operands to the blocks after it
+            template<typename Lanes>
+            expr_operand<T> evaluate(std::size_t begin, std::size_t count, T* scratch) const
+            {
+                return evaluate_into<Lanes>(begin, count, scratch, scratch + expr_block);
+            }
+
+            template<typename Lanes>
+            expr_operand<T> evaluate_into(std::size_t begin, std::size_t count, T* out, T* scratch) const
+            {
+                const expr_operand<T> a = left.template evaluate<Lanes>(begin, count, scratch);
+                const expr_operand<T> b = right.template evaluate<Lanes>(begin, count, scratch + L::blocks * expr_block);
+                if (!a.values && !b.values)
+                {
+                    return { nullptr, combine_scalar<Op>(a.scalar, b.scalar) };
+                }
+                Lanes::template apply<Op>(out, a, b, count);
+                return { out, T() };
+            }
+        };
+
+        // One pass over the arrays, a block at a time. The root writes straight to the destination.
+        template<typename Lanes, typename T, typename Node>
+        void evaluate_blocks(const Node& node, T* out, std::size_t size)
+        {
+            alignas(64) T scratch[(Node::blocks + 1) * expr_block];
+            for (std::size_t begin = 0; begin < size; begin += expr_block)
+            {
+                const std::size_t count = (std::min)(expr_block, size - begin);
+                const expr_operand<T> result = node.template evaluate_into<Lanes>(begin, count, out + begin, scratch);
+                if (result.values != out + begin) // A lone array or scalar
+                {
+                    for (std::size_t i = 0; i < count; i++)
+                    {
+                        out[begin + i] = result.values ? result.values[i] : result.scalar;
+                    }
+                }
+            }
+        }
+
+        inline bool is_supported(simd_level level)
+        {
+            const simd_level detected = detected_simd_level();
+            switch (level)
+            {
+            case simd_level::scalar:
+                return true;
+            case simd_level::sse2:
+                return detected == simd_level::sse2 || detected == simd_level::avx2;
+            default:
+                return detected == level;
+            }
+        }
+
+        template<typename T, typename Node>
+        void evaluate(const Node& node, T* out, std::size_t size, simd_level level)
+        {
+            switch (is_supported(level) ? level : detected_simd_level())
+            {
+#if defined(CPPLAZY_EXPR_X86)
+            case simd_level::avx2:
+                evaluate_blocks<avx2_lanes>(node, out, size);
+                return;
+            case simd_level::sse2:
+                evaluate_blocks<sse2_lanes>(node, out, size);
+                return;
+#elif defined(CPPLAZY_EXPR_NEON)
+            case simd_level::neon:
+                evaluate_blocks<neon_lanes>(node, out, size);
+                return;
+#endif
+            default:
+                evaluate_blocks<scalar_lanes>(node, out, size);
+                return;
+            }
+        }
+    }
+
+    // An arithmetic expression over arrays of float or double. Operators build a bigger expression and compute
+    // nothing; evaluating it computes every element in one pass, without a temporary array per operation.
+    // The expression refers to the arrays, which must outlive it.
+    //
+    // std::vector<float> a = ..., b = ..., c = ...;
+    // std::vector<float> r = cpplazy::expr(a) * b + cpplazy::expr(c) * 2; // One fused loop, on the widest SIMD instructions available
+    // auto pending = cpplazy::expr(a) / b; // auto keeps the expression, not the values
+    // cpplazy::lazy<std::vector<float>> cached = pending.cached(); // Evaluated on first access
+    template<typename T, typename Node>
+    class lazy_expr
+    {
+        static_assert(std::is_same<T, float>::value || std::is_same<T, double>::value, "lazy_expr evaluates float and double arrays");
+
+        Node m_node;
+
+    public:
+
+        using value_type = T;
+
+        explicit lazy_expr(Node node) :
+            m_node(node)
+        {
+        }
+
+        // The size of the smallest array in the expression
+        std::size_t size() const
+        {
+            return m_node.size();
+        }
+
+        // Computes a single element
+        T operator[](std::size_t index) const
+        {
+            return m_node.at(index);
+        }
+
+        // Writes size() elements to out. A level the processor doesn't support falls back to the detected one.
+        void eval_into(T* out, simd_level level = detected_simd_level()) const
+        {
+            detail::evaluate(m_node, out, size(), level);
+        }
+
+        std::vector<T> eval(simd_level level = detected_simd_level()) const
+        {
+            std::vector<T> result(size());
+            eval_into(result.data(), level);
+            return result;
+        }
+
+        operator std::vector<T>() const
+        {
+            return eval();
+        }
+
+        // Evaluated on first access, from the array contents at that time
+        lazy<std::vector<T>> cached() const
+        {
+            const lazy_expr expression = *this;
+            return lazy<std::vector<T>>([expression] { return expression.eval(); });
+        }
+
+        const Node& node() const
+        {
+            return m_node;
+        }
+    };
+
+    template<typename T>
+    lazy_expr<T, detail::array_node<T>> expr(const T* values, std::size_t size)
+    {
+        return lazy_expr<T, detail::array_node<T>>({ values, size });
+    }
+
+    template<typename T, typename Allocator>
+    lazy_expr<T, detail::array_node<T>> expr(const std::vector<T, Allocator>& values)
+    {
+        return expr(values.data(), values.size());
+    }
+
+    template<typename T, typename Allocator>
+    void expr(std::vector<T, Allocator>&&) = delete; // The expression would outlive the temporary
+
+#define CPPLAZY_EXPR_OPERATOR(symbol, op) \
+    template<typename T, typename L, typename R> \
+    lazy_expr<T, detail::binary_node<detail::expr_op::op, T, L, R>> operator symbol(const lazy_expr<T, L>& left, const lazy_expr<T, R>& right) \
+    { \
+        return lazy_expr<T, detail::binary_node<detail::expr_op::op, T, L, R>>({ left.node(), right.node() }); \
+    } \
+    template<typename T, typename L, typename S, typename = std::enable_if_t<std::is_arithmetic<S>::value>> \
+    lazy_expr<T, detail::binary_node<detail::expr_op::op, T, L, detail::scalar_node<T>>> operator symbol(const lazy_expr<T, L>& left, S right) \
+    { \
+        return lazy_expr<T, detail::binary_node<detail::expr_op::op, T, L, detail::scalar_node<T>>>({ left.node(), { static_cast<T>(right) } }); \
+    } \
+    template<typename T, typename S, typename R, typename = std::enable_if_t<std::is_arithmetic<S>::value>> \
+    lazy_expr<T, detail::binary_node<detail::expr_op::op, T, detail::scalar_node<T>, R>> operator symbol(S left, const lazy_expr<T, R>& right) \
+    { \
+        return lazy_expr<T, detail::binary_node<detail::expr_op::op, T, detail::scalar_node<T>, R>>({ { static_cast<T>(left) }, right.node() }); \
+    } \
+    template<typename T, typename L, typename Allocator> \
+    auto operator symbol(const lazy_expr<T, L>& left, const std::vector<T, Allocator>& right) \
+    { \
+        return left symbol expr(right); \
+    } \
+    template<typename T, typename Allocator, typename R> \
+    auto operator symbol(const std::vector<T, Allocator>& left, const lazy_expr<T, R>& right) \
+    { \
+        return expr(left) symbol right; \
+    } \
+    template<typename T, typename L, typename Allocator> \
+    void operator symbol(const lazy_expr<T, L>&, std::vector<T, Allocator>&&) = delete; \
+    template<typename T, typename Allocator, typename R> \
+    void operator symbol(std::vector<T, Allocator>&&, const lazy_expr<T, R>&) = delete;
+
+    CPPLAZY_EXPR_OPERATOR(+, add)
+    CPPLAZY_EXPR_OPERATOR(-, subtract)
+    CPPLAZY_EXPR_OPERATOR(*, multiply)
+    CPPLAZY_EXPR_OPERATOR(/, divide)
+
+#undef CPPLAZY_EXPR_OPERATOR
+
+    template<typename T, typename Node>
+    auto operator-(const lazy_expr<T, Node>& operand)
+    {
+        return operand * T(-1); // Exact, and flips the sign of zeros too
+    }
+}
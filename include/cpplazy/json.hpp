@@ -0,0 +1,652 @@
+// Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+// Copyright (c) 2020 Ziv Shahaf <ziv.shahaf@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// json_document: a JSON document parsed in stages, each one only when first needed: the structural index on the first query, 
+// each object's (or array's) child index when it is first visited, and numbers and strings when they are read.
+
+#include "cpplazy.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+
+namespace cpplazy
+{
+    enum class json_type
+    {
+        invalid,    // Missing member, index out of range, or malformed
+        null,
+        boolean,
+        number,
+        string,
+        array,
+        object
+    };
+
+    namespace detail
+    {
+        inline unsigned count_trailing_zeros(std::uint64_t bits) noexcept
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            return static_cast<unsigned>(__builtin_ctzll(bits));
+#elif defined(_MSC_VER) && defined(_M_X64)
+            unsigned long index;
+            _BitScanForward64(&index, bits);
+            return index;
+#else
+            unsigned index = 0;
+            for (; !(bits & 1); bits >>= 1)
+            {
+                index++;
+            }
+            return index;
+#endif
+        }
+
+        // Bit i is set if an odd number of bits are set at or below i.
+        inline std::uint64_t prefix_xor(std::uint64_t bits) noexcept
+        {
+            bits ^= bits << 1;
+            bits ^= bits << 2;
+            bits ^= bits << 4;
+            bits ^= bits << 8;
+            bits ^= bits << 16;
+            bits ^= bits << 32;
+            return bits;
+        }
+
+        // Stage 1: the position of every structural character ({}[]:,) outside strings, every string's opening quote 
+        // and the first character of every other value. Works on 64 byte blocks turned into bit masks (branch free 
+        // loops the compiler vectorizes), the way simdjson does, with the matching bracket of every bracket.
+        struct json_structure
+        {
+            std::vector<std::uint32_t> tokens;
+            std::vector<std::uint32_t> match; // For brackets, the token index of the matching bracket
+            std::error_code error;
+
+            explicit json_structure(std::string_view text)
+            {
+                if (text.size() >= UINT32_MAX)
+                {
+                    error = std::make_error_code(std::errc::file_too_large);
+                    return;
+                }
+                tokens.reserve(text.size() / 6 + 2);
+                bool in_string = false;
+                bool escape_next = false;
+                bool previous_scalar = false;
+                for (std::size_t block = 0; block < text.size(); block += 64)
+                {
+                    const std::size_t n = std::min<std::size_t>(64, text.size() - block);
+                    const char* chars = text.data() + block;
+                    std::uint64_t quote = 0;
+                    std::uint64_t backslash = 0;
+                    std::uint64_t op = 0;
+                    std::uint64_t space = n < 64 ? ~std::uint64_t(0) << n : 0; // The padding reads as whitespace
+                    for (std::size_t i = 0; i < n; i++)
+                    {
+                        const char c = chars[i];
+                        quote |= std::uint64_t(c == '"') << i;
+                        backslash |= std::uint64_t(c == '\\') << i;
+                        op |= std::uint64_t(c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',') << i;
+                        space |= std::uint64_t(c == ' ' || c == '\t' || c == '\n' || c == '\r') << i;
+                    }
+
+                    // Backslashes are rare, so walking them one by one is cheaper than the branch free version
+                    std::uint64_t escaped = escape_next ? 1 : 0;
+                    escape_next = false;
+                    for (std::uint64_t rest = backslash; rest; rest &= rest - 1)
+                    {
+                        const unsigned bit = count_trailing_zeros(rest);
+                        if (!((escaped >> bit) & 1))
+                        {
+                            if (bit == 63)
+                            {
+                                escape_next = true;
+                            }
+                            else
+                            {
+                                escaped |= std::uint64_t(1) << (bit + 1);
+                            }
+                        }
+                    }
+
+                    const std::uint64_t real_quote = quote & ~escaped;
+                    const std::uint64_t inside = prefix_xor(real_quote) ^ (in_string ? ~std::uint64_t(0) : 0); // Opening quotes included, closing ones not
+                    in_string = inside >> 63;
+                    const std::uint64_t scalar = ~(op | space | real_quote | inside);
+                    const std::uint64_t scalar_start = scalar & ~((scalar << 1) | (previous_scalar ? 1 : 0));
+                    previous_scalar = scalar >> 63;
+
+                    for (std::uint64_t found = (op & ~inside) | (real_quote & inside) | scalar_start; found; found &= found - 1)
+                    {
+                        tokens.push_back(static_cast<std::uint32_t>(block + count_trailing_zeros(found)));
+                    }
+                }
+                if (in_string)
+                {
+                    error = std::make_error_code(std::errc::illegal_byte_sequence);
+                    return;
+                }
+
+                match.assign(tokens.size(), 0);
+                std::vector<std::uint32_t> open;
+                for (std::uint32_t t = 0; t < tokens.size(); t++)
+                {
+                    const char c = text[tokens[t]];
+                    if (c == '{' || c == '[')
+                    {
+                        open.push_back(t);
+                    }
+                    else if (c == '}' || c == ']')
+                    {
+                        if (open.empty() || text[tokens[open.back()]] != (c == '}' ? '{' : '['))
+                        {
+                            error = std::make_error_code(std::errc::illegal_byte_sequence);
+                            return;
+                        }
+                        match[open.back()] = t;
+                        match[t] = open.back();
+                        open.pop_back();
+                    }
+                }
+                if (!open.empty() || tokens.empty())
+                {
+                    error = std::make_error_code(std::errc::illegal_byte_sequence);
+                }
+            }
+        };
+
+        // The end of the string whose opening quote is at begin (the position of the closing quote), npos if unterminated.
+        inline std::size_t json_string_end(std::string_view text, std::size_t begin) noexcept
+        {
+            for (std::size_t pos = begin + 1; pos < text.size(); pos++)
+            {
+                if (text[pos] == '\\')
+                {
+                    pos++;
+                }
+                else if (text[pos] == '"')
+                {
+                    return pos;
+                }
+            }
+            return std::string_view::npos;
+        }
+
+        inline void append_utf8(std::string& out, std::uint32_t code)
+        {
+            if (code < 0x80)
+            {
+                out += static_cast<char>(code);
+            }
+            else if (code < 0x800)
+            {
+                out += static_cast<char>(0xC0 | (code >> 6));
+                out += static_cast<char>(0x80 | (code & 0x3F));
+            }
+            else if (code < 0x10000)
+            {
+                out += static_cast<char>(0xE0 | (code >> 12));
+                out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (code & 0x3F));
+            }
+            else
+            {
+                out += static_cast<char>(0xF0 | (code >> 18));
+                out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+                out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (code & 0x3F));
+            }
+        }
+
+        // Decodes the escapes of a string's contents (without the quotes). Returns false if malformed.
+        inline bool json_unescape(std::string_view raw, std::string& out)
+        {
+            out.clear();
+            out.reserve(raw.size());
+            auto hex4 = [&raw](std::size_t pos, std::uint32_t& value) {
+                if (raw.size() - pos < 4)
+                {
+                    return false;
+                }
+                return std::from_chars(raw.data() + pos, raw.data() + pos + 4, value, 16).ptr == raw.data() + pos + 4;
+            };
+            for (std::size_t pos = 0; pos < raw.size(); pos++)
+            {
+                if (raw[pos] != '\\')
+                {
+                    out += raw[pos];
+                    continue;
+                }
+                if (++pos == raw.size())
+                {
+                    return false;
+                }
+                switch (raw[pos])
+                {
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u':
+                {
+                    std::uint32_t code;
+                    if (!hex4(pos + 1, code))
+                    {
+                        return false;
+                    }
+                    pos += 4;
+                    std::uint32_t low;
+                    if (code >= 0xD800 && code < 0xDC00 && raw.substr(pos + 1, 2) == "\\u" && hex4(pos + 3, low) && low >= 0xDC00 && low < 0xE000)
+                    {
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                        pos += 6;
+                    }
+                    append_utf8(out, code);
+                    break;
+                }
+                default:
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Stage 2: the members of one object, or the elements of one array.
+        struct json_children
+        {
+            struct member
+            {
+                std::string_view key; // Into the text, or into unescaped_keys
+                std::uint32_t value;  // Token index
+            };
+
+            std::vector<member> members;
+            std::vector<std::uint32_t> by_key; // Member indexes sorted by key, for large objects
+            std::vector<std::unique_ptr<std::string>> unescaped_keys;
+
+            static constexpr std::size_t sorted_threshold = 16;
+
+            const member* find(std::string_view key) const
+            {
+                if (by_key.empty())
+                {
+                    for (const member& m : members)
+                    {
+                        if (m.key == key)
+                        {
+                            return &m;
+                        }
+                    }
+                    return nullptr;
+                }
+                const auto found = std::lower_bound(by_key.begin(), by_key.end(), key, [this](std::uint32_t i, std::string_view k) { return members[i].key < k; });
+                return found != by_key.end() && members[*found].key == key ? &members[*found] : nullptr;
+            }
+        };
+
+        struct json_state
+        {
+            std::string text;
+            once_cell<json_structure> structure;
+            std::mutex children_mutex;
+            std::unordered_map<std::uint32_t, std::unique_ptr<once_cell<json_children>>> children;
+
+            const json_structure& get_structure()
+            {
+                return structure.get_or_init([this] { return json_structure(text); });
+            }
+
+            // Builds the child index of the container at token (the first time it is visited).
+            const json_children& get_children(std::uint32_t token)
+            {
+                once_cell<json_children>* cell;
+                {
+                    std::lock_guard<std::mutex> lock(children_mutex);
+                    std::unique_ptr<once_cell<json_children>>& slot = children[token];
+                    if (!slot)
+                    {
+                        slot.reset(new once_cell<json_children>());
+                    }
+                    cell = slot.get();
+                }
+                return cell->get_or_init([this, token] { return build_children(token); });
+            }
+
+            json_children build_children(std::uint32_t token) const
+            {
+                const json_structure& s = *structure.get();
+                const bool is_object = text[s.tokens[token]] == '{';
+                const std::uint32_t close = s.match[token];
+                json_children result;
+                std::uint32_t t = token + 1;
+                while (t < close)
+                {
+                    std::string_view key;
+                    if (is_object)
+                    {
+                        // "key" : value
+                        const std::size_t begin = s.tokens[t];
+                        const std::size_t end = text[begin] == '"' ? json_string_end(text, begin) : std::string_view::npos;
+                        if (end == std::string_view::npos || t + 2 >= close || text[s.tokens[t + 1]] != ':')
+                        {
+                            break;
+                        }
+                        key = std::string_view(text).substr(begin + 1, end - begin - 1);
+                        if (key.find('\\') != std::string_view::npos)
+                        {
+                            std::unique_ptr<std::string> unescaped(new std::string());
+                            if (!json_unescape(key, *unescaped))
+                            {
+                                break;
+                            }
+                            key = *unescaped;
+                            result.unescaped_keys.push_back(std::move(unescaped));
+                        }
+                        t += 2;
+                    }
+                    const char c = text[s.tokens[t]];
+                    if (c == ',' || c == ':' || c == '}' || c == ']')
+                    {
+                        break; // Missing value
+                    }
+                    result.members.push_back({ key, t });
+                    t = (c == '{' || c == '[') ? s.match[t] + 1 : t + 1; // Skips nested containers without looking into them
+                    if (t < close)
+                    {
+                        if (text[s.tokens[t]] != ',')
+                        {
+                            break;
+                        }
+                        t++;
+                    }
+                }
+                if (is_object && result.members.size() > json_children::sorted_threshold)
+                {
+                    result.by_key.resize(result.members.size());
+                    for (std::uint32_t i = 0; i < result.by_key.size(); i++)
+                    {
+                        result.by_key[i] = i;
+                    }
+                    // Stable, so the first of duplicate keys is found, like the linear search does
+                    std::stable_sort(result.by_key.begin(), result.by_key.end(), [&result](std::uint32_t a, std::uint32_t b) { return result.members[a].key < result.members[b].key; });
+                }
+                return result;
+            }
+        };
+    }
+
+    // A value in a json_document: a cheap handle (a pointer and a token index), valid as long as the document.
+    // Lookups return invalid values (never throw) when a member is missing, or the value is not of the expected type.
+    class json_value
+    {
+        friend class json_document;
+
+        detail::json_state* m_state = nullptr;
+        std::uint32_t m_token = 0;
+
+        json_value(detail::json_state* state, std::uint32_t token) noexcept :
+            m_state(state),
+            m_token(token)
+        {
+        }
+
+        char first() const noexcept
+        {
+            return m_state ? m_state->text[m_state->structure.get()->tokens[m_token]] : '\0';
+        }
+
+        std::size_t position() const noexcept
+        {
+            return m_state->structure.get()->tokens[m_token];
+        }
+
+        // The text of a scalar value (up to the next token, without trailing whitespace).
+        std::string_view scalar_text() const noexcept
+        {
+            const detail::json_structure& s = *m_state->structure.get();
+            const std::size_t begin = s.tokens[m_token];
+            std::size_t end = m_token + 1 < s.tokens.size() ? s.tokens[m_token + 1] : m_state->text.size();
+            while (end > begin && (m_state->text[end - 1] == ' ' || m_state->text[end - 1] == '\t' || m_state->text[end - 1] == '\n' || m_state->text[end - 1] == '\r'))
+            {
+                end--;
+            }
+            return std::string_view(m_state->text).substr(begin, end - begin);
+        }
+
+    public:
+
+        json_value() = default;
+
+        json_type type() const noexcept
+        {
+            switch (first())
+            {
+            case '{': return json_type::object;
+            case '[': return json_type::array;
+            case '"': return json_type::string;
+            case 't':
+            case 'f': return json_type::boolean;
+            case 'n': return json_type::null;
+            case '-':
+            case '0': case '1': case '2': case '3': case '4':
+            case '5': case '6': case '7': case '8': case '9': return json_type::number;
+            default: return json_type::invalid;
+            }
+        }
+
+        explicit operator bool() const noexcept
+        {
+            return type() != json_type::invalid;
+        }
+
+        // The member named key of an object.
+        json_value operator[](std::string_view key) const
+        {
+            if (type() != json_type::object)
+            {
+                return {};
+            }
+            const detail::json_children::member* found = m_state->get_children(m_token).find(key);
+            return found ? json_value(m_state, found->value) : json_value();
+        }
+
+        // The element at index of an array, or the member at index of an object.
+        json_value operator[](std::size_t index) const
+        {
+            if (type() != json_type::array && type() != json_type::object)
+            {
+                return {};
+            }
+            const detail::json_children& children = m_state->get_children(m_token);
+            return index < children.members.size() ? json_value(m_state, children.members[index].value) : json_value();
+        }
+
+        // The key of the member at index of an object (empty otherwise).
+        std::string_view key(std::size_t index) const
+        {
+            if (type() != json_type::object)
+            {
+                return {};
+            }
+            const detail::json_children& children = m_state->get_children(m_token);
+            return index < children.members.size() ? children.members[index].key : std::string_view();
+        }
+
+        // The number of elements or members, 0 for other types.
+        std::size_t size() const
+        {
+            const json_type t = type();
+            return t == json_type::array || t == json_type::object ? m_state->get_children(m_token).members.size() : 0;
+        }
+
+        std::optional<bool> as_bool() const noexcept
+        {
+            const std::string_view text = type() == json_type::boolean ? scalar_text() : std::string_view();
+            if (text == "true")
+            {
+                return true;
+            }
+            if (text == "false")
+            {
+                return false;
+            }
+            return std::nullopt;
+        }
+
+        std::optional<std::int64_t> as_int64() const noexcept
+        {
+            if (type() != json_type::number)
+            {
+                return std::nullopt;
+            }
+            const std::string_view text = scalar_text();
+            std::int64_t value;
+            const auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+            return result.ec == std::errc() && result.ptr == text.data() + text.size() ? std::optional<std::int64_t>(value) : std::nullopt;
+        }
+
+        std::optional<double> as_double() const
+        {
+            if (type() != json_type::number)
+            {
+                return std::nullopt;
+            }
+            const std::string_view text = scalar_text();
+            double value;
+#if defined(__cpp_lib_to_chars)
+            const auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+            return result.ec == std::errc() && result.ptr == text.data() + text.size() ? std::optional<double>(value) : std::nullopt;
+#else
+            const std::string copy(text); // strtod needs a terminator
+            char* end;
+            value = std::strtod(copy.c_str(), &end);
+            return end == copy.c_str() + copy.size() ? std::optional<double>(value) : std::nullopt;
+#endif
+        }
+
+        // The string, with its escapes decoded.
+        std::optional<std::string> as_string() const
+        {
+            const std::optional<std::string_view> raw = raw_string();
+            std::string value;
+            if (!raw || !detail::json_unescape(*raw, value))
+            {
+                return std::nullopt;
+            }
+            return value;
+        }
+
+        // The string as it is in the text (escapes not decoded), without copying.
+        std::optional<std::string_view> raw_string() const noexcept
+        {
+            if (type() != json_type::string)
+            {
+                return std::nullopt;
+            }
+            const std::size_t begin = position();
+            const std::size_t end = detail::json_string_end(m_state->text, begin);
+            if (end == std::string_view::npos)
+            {
+                return std::nullopt;
+            }
+            return std::string_view(m_state->text).substr(begin + 1, end - begin - 1);
+        }
+    };
+
+    // A JSON document that is parsed only as far as it is queried.
+    //
+    //  cpplazy::json_document doc{ read_file("events.json") };
+    //  std::optional<double> latency = doc["stats"]["latency"]["p99"].as_double(); //Indexes the structure once, then only the 3 objects on the path
+    //
+    // Structural errors (unbalanced brackets, unterminated strings) are found by the first query. Other errors only 
+    // show when the malformed part is read, as invalid values. Up to 4GB. Thread safe, except for moving.
+    class json_document
+    {
+        std::unique_ptr<detail::json_state> m_state; // Values keep pointing to it when the document is moved
+
+    public:
+
+        explicit json_document(std::string text) :
+            m_state(new detail::json_state())
+        {
+            m_state->text = std::move(text);
+        }
+
+        std::string_view text() const noexcept
+        {
+            return m_state->text;
+        }
+
+        // Builds the structural index if it was not yet. Invalid if error() is set.
+        json_value root() const
+        {
+            return error() ? json_value() : json_value(m_state.get(), 0);
+        }
+
+        json_value operator[](std::string_view key) const
+        {
+            return root()[key];
+        }
+
+        json_value operator[](std::size_t index) const
+        {
+            return root()[index];
+        }
+
+        std::error_code error() const
+        {
+            return m_state->get_structure().error;
+        }
+
+        bool is_indexed() const noexcept
+        {
+            return m_state->structure.is_initialized();
+        }
+
+        // How many objects and arrays have had their child index built.
+        std::size_t indexed_containers() const
+        {
+            std::lock_guard<std::mutex> lock(m_state->children_mutex);
+            return m_state->children.size();
+        }
+    };
+}
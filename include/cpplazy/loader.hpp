@@ -0,0 +1,677 @@
+// Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+// Copyright (c) 2020 Ziv Shahaf <ziv.shahaf@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// file_lazy<T> and batch_loader: lazy objects built from a file's contents, which can be loaded together in one batch
+// (with io_uring where available) instead of one blocking read after another.
+
+#include "cpplazy.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define CPPLAZY_HAS_IO_URING 1
+#endif
+#endif
+
+#ifndef CPPLAZY_HAS_IO_URING
+#define CPPLAZY_HAS_IO_URING 0
+#endif
+
+
+namespace cpplazy
+{
+    enum class load_backend
+    {
+        automatic,      // io_uring if the kernel supports it, thread_pool otherwise
+        io_uring,       // All reads submitted at once from one thread, Linux 5.1 and later
+        thread_pool     // Blocking preadv() on a few threads
+    };
+
+    namespace detail
+    {
+        // One file of a batch. The loader fills data, then calls complete.
+        struct load_request
+        {
+            std::string path;
+            std::function<void(std::string&& data, std::error_code error)> complete;
+            std::string data;
+            std::error_code error;
+#if !defined(_WIN32)
+            int fd = -1;
+            std::size_t done = 0;
+            iovec iov = {};
+#endif
+
+            void finish()
+            {
+#if !defined(_WIN32)
+                if (fd >= 0)
+                {
+                    ::close(fd);
+                    fd = -1;
+                }
+#endif
+                if (error)
+                {
+                    data.clear();
+                }
+#if CPPLAZY_HAS_EXCEPTIONS
+                try
+                {
+                    complete(std::move(data), error);
+                }
+                catch (...)
+                {
+                    // A failed parse leaves the object uninitialized, the next access reads the file again
+                }
+#else
+                complete(std::move(data), error);
+#endif
+            }
+
+#if !defined(_WIN32)
+            // Opens the file and sizes data. Returns false if there is nothing to read (empty, or error).
+            bool open()
+            {
+                fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                struct stat st;
+                if (fd < 0 || ::fstat(fd, &st) != 0)
+                {
+                    error = std::error_code(errno, std::generic_category());
+                    return false;
+                }
+                data.resize(static_cast<std::size_t>(st.st_size));
+                return !data.empty();
+            }
+
+            // The next chunk to read into iov. Reads are capped at 1GB, the kernel returns short reads beyond 2GB anyway.
+            void next_chunk()
+            {
+                iov.iov_base = &data[done];
+                iov.iov_len = std::min<std::size_t>(data.size() - done, std::size_t(1) << 30);
+            }
+
+            // Accounts for the result of a read. Returns true once the request is complete (or failed).
+            bool on_read(long long result)
+            {
+                if (result < 0)
+                {
+                    error = std::error_code(static_cast<int>(-result), std::generic_category());
+                    return true;
+                }
+                if (result == 0)
+                {
+                    data.resize(done); // The file got shorter since fstat()
+                    return true;
+                }
+                done += static_cast<std::size_t>(result);
+                return done == data.size();
+            }
+#endif
+        };
+
+        inline void read_whole_file(load_request& request)
+        {
+#if defined(_WIN32)
+            if (std::FILE* file = std::fopen(request.path.c_str(), "rb"))
+            {
+                char chunk[65536];
+                for (std::size_t n; (n = std::fread(chunk, 1, sizeof(chunk), file)) > 0;)
+                {
+                    request.data.append(chunk, n);
+                }
+                if (std::ferror(file))
+                {
+                    request.error = std::make_error_code(std::errc::io_error);
+                }
+                std::fclose(file);
+            }
+            else
+            {
+                request.error = std::error_code(errno, std::generic_category());
+            }
+#else
+            if (request.open())
+            {
+                for (;;)
+                {
+                    request.next_chunk();
+                    const ssize_t n = ::preadv(request.fd, &request.iov, 1, static_cast<off_t>(request.done));
+                    if (n < 0 && errno == EINTR)
+                    {
+                        continue;
+                    }
+                    if (request.on_read(n < 0 ? -errno : n))
+                    {
+                        break;
+                    }
+                }
+            }
+#endif
+            request.finish();
+        }
+
+        inline void load_with_thread_pool(std::vector<std::unique_ptr<load_request>>& requests, unsigned queue_depth)
+        {
+            std::atomic<std::size_t> next{ 0 };
+            auto worker = [&requests, &next] {
+                for (std::size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < requests.size();)
+                {
+                    read_whole_file(*requests[i]);
+                }
+            };
+            const std::size_t threads = std::min<std::size_t>({ requests.size(), queue_depth, 16 });
+            std::vector<std::thread> pool;
+            for (std::size_t t = 1; t < threads; t++)
+            {
+                pool.emplace_back(worker);
+            }
+            worker();
+            for (auto& t : pool)
+            {
+                t.join();
+            }
+        }
+
+#if CPPLAZY_HAS_IO_URING
+        // A minimal io_uring (through raw system calls, without liburing) that only reads.
+        class read_ring
+        {
+            int m_fd = -1;
+            void* m_sq_ring = MAP_FAILED;
+            void* m_cq_ring = MAP_FAILED;
+            void* m_sqes = MAP_FAILED;
+            std::size_t m_sq_ring_size = 0;
+            std::size_t m_cq_ring_size = 0;
+            std::size_t m_sqes_size = 0;
+            unsigned* m_sq_tail = nullptr;
+            unsigned m_sq_mask = 0;
+            unsigned* m_sq_array = nullptr;
+            unsigned* m_cq_head = nullptr;
+            unsigned* m_cq_tail = nullptr;
+            unsigned m_cq_mask = 0;
+            io_uring_cqe* m_cqes = nullptr;
+            unsigned m_entries = 0;
+            unsigned m_unsubmitted = 0;
+
+            template<typename T>
+            static T* at(void* ring, unsigned offset) noexcept
+            {
+                return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+            }
+
+        public:
+
+            explicit read_ring(unsigned entries)
+            {
+                io_uring_params params = {};
+                m_fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+                if (m_fd < 0)
+                {
+                    return;
+                }
+                m_entries = params.sq_entries;
+                m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+                m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+                if (params.features & IORING_FEAT_SINGLE_MMAP)
+                {
+                    m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+                }
+                m_sq_ring = ::mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+                if (m_sq_ring == MAP_FAILED)
+                {
+                    return;
+                }
+                if (params.features & IORING_FEAT_SINGLE_MMAP)
+                {
+                    m_cq_ring = m_sq_ring;
+                }
+                else
+                {
+                    m_cq_ring = ::mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+                }
+                m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+                m_sqes = ::mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+                if (m_cq_ring == MAP_FAILED || m_sqes == MAP_FAILED)
+                {
+                    return;
+                }
+                m_sq_tail = at<unsigned>(m_sq_ring, params.sq_off.tail);
+                m_sq_mask = *at<unsigned>(m_sq_ring, params.sq_off.ring_mask);
+                m_sq_array = at<unsigned>(m_sq_ring, params.sq_off.array);
+                m_cq_head = at<unsigned>(m_cq_ring, params.cq_off.head);
+                m_cq_tail = at<unsigned>(m_cq_ring, params.cq_off.tail);
+                m_cq_mask = *at<unsigned>(m_cq_ring, params.cq_off.ring_mask);
+                m_cqes = at<io_uring_cqe>(m_cq_ring, params.cq_off.cqes);
+            }
+
+            read_ring(const read_ring&) = delete;
+            read_ring& operator=(const read_ring&) = delete;
+
+            ~read_ring()
+            {
+                if (m_sqes != MAP_FAILED)
+                {
+                    ::munmap(m_sqes, m_sqes_size);
+                }
+                if (m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring)
+                {
+                    ::munmap(m_cq_ring, m_cq_ring_size);
+                }
+                if (m_sq_ring != MAP_FAILED)
+                {
+                    ::munmap(m_sq_ring, m_sq_ring_size);
+                }
+                if (m_fd >= 0)
+                {
+                    ::close(m_fd);
+                }
+            }
+
+            bool valid() const noexcept
+            {
+                return m_cqes != nullptr;
+            }
+
+            // The number of reads that can be in flight at once.
+            unsigned entries() const noexcept
+            {
+                return m_entries;
+            }
+
+            // Queues a read of request's next chunk (never more than entries() in flight).
+            void queue_read(load_request& request, std::uint64_t user_data) noexcept
+            {
+                const unsigned tail = *m_sq_tail; // Only this thread writes the tail
+                const unsigned index = tail & m_sq_mask;
+                io_uring_sqe& sqe = static_cast<io_uring_sqe*>(m_sqes)[index];
+                std::memset(&sqe, 0, sizeof(sqe));
+                sqe.opcode = IORING_OP_READV;
+                sqe.fd = request.fd;
+                sqe.addr = reinterpret_cast<std::uintptr_t>(&request.iov);
+                sqe.len = 1;
+                sqe.off = request.done;
+                sqe.user_data = user_data;
+                m_sq_array[index] = index;
+                __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+                m_unsubmitted++;
+            }
+
+            // Submits the queued reads, and waits for at least one completion if wait is true. Returns false on failure.
+            bool submit(bool wait) noexcept
+            {
+                for (;;)
+                {
+                    const long submitted = ::syscall(__NR_io_uring_enter, m_fd, m_unsubmitted, wait ? 1u : 0u, wait ? IORING_ENTER_GETEVENTS : 0u, nullptr, 0);
+                    if (submitted >= 0)
+                    {
+                        m_unsubmitted -= static_cast<unsigned>(submitted);
+                        return true;
+                    }
+                    if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                    {
+                        return false;
+                    }
+                }
+            }
+
+            // Takes back the reads queued since the last submit (the kernel hasn't seen them). Returns how many.
+            unsigned unqueue() noexcept
+            {
+                const unsigned count = m_unsubmitted;
+                __atomic_store_n(m_sq_tail, *m_sq_tail - count, __ATOMIC_RELEASE);
+                m_unsubmitted = 0;
+                return count;
+            }
+
+            // Waits for count more completions without submitting anything, calling func(user_data, result) for each. 
+            // Returns false on failure.
+            template<typename Func>
+            bool wait(unsigned count, Func&& func)
+            {
+                while (count > 0)
+                {
+                    if (::syscall(__NR_io_uring_enter, m_fd, 0u, 1u, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                    {
+                        return false;
+                    }
+                    reap([&](std::uint64_t user_data, int result) {
+                        count--;
+                        func(user_data, result);
+                    });
+                }
+                return true;
+            }
+
+            // Calls func(user_data, result) for every completion available.
+            template<typename Func>
+            void reap(Func&& func)
+            {
+                unsigned head = *m_cq_head; // Only this thread writes the head
+                const unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+                for (; head != tail; head++)
+                {
+                    const io_uring_cqe& cqe = m_cqes[head & m_cq_mask];
+                    const std::uint64_t user_data = cqe.user_data;
+                    const int result = cqe.res;
+                    __atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+                    func(user_data, result);
+                }
+            }
+        };
+
+        // Returns false if io_uring can't be used (the batch is untouched then).
+        inline bool load_with_io_uring(std::vector<std::unique_ptr<load_request>>& requests, unsigned queue_depth)
+        {
+            read_ring ring(std::max(1u, std::min(queue_depth, 4096u)));
+            if (!ring.valid())
+            {
+                return false;
+            }
+
+            std::size_t next = 0;
+            unsigned in_flight = 0;
+            while (next < requests.size() || in_flight > 0)
+            {
+                // Opening is synchronous, but the reads of the files opened so far are already in flight meanwhile
+                while (next < requests.size() && in_flight < ring.entries())
+                {
+                    load_request& request = *requests[next];
+                    if (request.open())
+                    {
+                        request.next_chunk();
+                        ring.queue_read(request, next);
+                        in_flight++;
+                    }
+                    else
+                    {
+                        request.finish();
+                    }
+                    next++;
+                }
+                if (in_flight == 0)
+                {
+                    continue;
+                }
+                if (!ring.submit(true))
+                {
+                    // Should not happen once the ring is set up. Every unfinished request (fd still open) has one read queued 
+                    // or in flight: wait for those the kernel has, only then can their buffers be read into again.
+                    const bool drained = ring.wait(in_flight - ring.unqueue(), [](std::uint64_t, int) {});
+                    for (std::size_t i = 0; i < next; i++)
+                    {
+                        if (requests[i]->fd < 0)
+                        {
+                            continue;
+                        }
+                        if (!drained)
+                        {
+                            // The kernel may still write into this request's buffer, so it's never freed
+                            load_request* abandoned = requests[i].release();
+                            ::close(abandoned->fd);
+                            requests[i].reset(new load_request);
+                            requests[i]->path = abandoned->path;
+                            requests[i]->complete = abandoned->complete;
+                            requests[i]->error = std::make_error_code(std::errc::io_error);
+                            requests[i]->finish();
+                            continue;
+                        }
+                        requests[i]->done = 0;
+                        ::close(requests[i]->fd);
+                        requests[i]->fd = -1;
+                        read_whole_file(*requests[i]);
+                    }
+                    for (; next < requests.size(); next++)
+                    {
+                        read_whole_file(*requests[next]);
+                    }
+                    return true;
+                }
+                ring.reap([&](std::uint64_t index, int result) {
+                    load_request& request = *requests[index];
+                    if (request.on_read(result))
+                    {
+                        in_flight--;
+                        request.finish(); // Each object completes as soon as its own data arrived
+                    }
+                    else
+                    {
+                        request.next_chunk();
+                        ring.queue_read(request, index); // Reuses the request's slot
+                    }
+                });
+            }
+            return true;
+        }
+#endif
+    }
+
+    class batch_loader;
+
+    // A lazy object whose value is parsed from the contents of a file. 
+    // Accessing it reads the file (blocking) unless a batch_loader already loaded it. 
+    // parse(bytes, error) gets the whole file, or the error if it could not be read, and may throw (the next access reads the file again).
+    //
+    //  cpplazy::file_lazy<dictionary> words{ "/usr/share/dict/words", [](std::string bytes, std::error_code error) { return dictionary(bytes); } };
+    //
+    // Thread safe, like once_cell<T>. Must not be moved or destroyed while a batch_loader has it.
+    template<typename T>
+    class file_lazy
+    {
+        friend class batch_loader;
+
+        std::string m_path;
+        std::function<T(std::string bytes, std::error_code error)> m_parse;
+        once_cell<T> m_value;
+
+        void complete(std::string&& bytes, std::error_code error)
+        {
+            m_value.get_or_init([&] { return m_parse(std::move(bytes), error); }); // Accessors arriving now wait instead of reading the file again
+        }
+
+    public:
+
+        file_lazy(std::string path, std::function<T(std::string bytes, std::error_code error)> parse) :
+            m_path(std::move(path)),
+            m_parse(std::move(parse))
+        {
+        }
+
+        const std::string& path() const noexcept
+        {
+            return m_path;
+        }
+
+        bool is_initialized() const noexcept
+        {
+            return m_value.is_initialized();
+        }
+
+        T& operator*()
+        {
+            return get();
+        }
+
+        T* operator->()
+        {
+            return &get();
+        }
+
+        // Reads and parses the file, unless already done.
+        T& get()
+        {
+            if (T* value = m_value.get())
+            {
+                return *value;
+            }
+            return m_value.get_or_init([this] {
+                detail::load_request request;
+                request.path = m_path;
+                std::optional<T> value;
+#if CPPLAZY_HAS_EXCEPTIONS
+                // finish() swallows exceptions, rethrow them here so the initialization fails
+                std::exception_ptr failure;
+                request.complete = [this, &value, &failure](std::string&& bytes, std::error_code error) {
+                    try
+                    {
+                        value.emplace(m_parse(std::move(bytes), error));
+                    }
+                    catch (...)
+                    {
+                        failure = std::current_exception();
+                    }
+                };
+                detail::read_whole_file(request);
+                if (failure)
+                {
+                    std::rethrow_exception(failure);
+                }
+#else
+                request.complete = [this, &value](std::string&& bytes, std::error_code error) { value.emplace(m_parse(std::move(bytes), error)); };
+                detail::read_whole_file(request);
+#endif
+                return std::move(*value);
+            });
+        }
+    };
+
+    // Loads many file_lazy objects at once: all their reads are submitted together (io_uring), or spread over 
+    // a few threads (preadv), so warming N files takes about as long as the slowest one instead of the sum of all.
+    // Each object is initialized as soon as its own file arrived.
+    //
+    //  cpplazy::batch_loader loader;
+    //  loader.add(words);
+    //  loader.add(rules);
+    //  loader.submit(); //Returns right away, words and rules are usable whenever (accessing them early just reads them directly)
+    //  loader.wait();
+    //
+    // Not thread safe itself. The destructor waits for the submitted batch.
+    class batch_loader
+    {
+        std::vector<std::unique_ptr<detail::load_request>> m_pending;
+        std::vector<std::unique_ptr<detail::load_request>> m_submitted;
+        std::thread m_worker;
+        load_backend m_backend;
+        unsigned m_queue_depth;
+        std::atomic<load_backend> m_used{ load_backend::automatic };
+
+    public:
+
+        // queue_depth: how many reads are in flight at once (io_uring), or the most threads used (thread_pool, at most 16).
+        explicit batch_loader(load_backend backend = load_backend::automatic, unsigned queue_depth = 64) :
+            m_backend(backend),
+            m_queue_depth(std::max(1u, queue_depth))
+        {
+        }
+
+        batch_loader(const batch_loader&) = delete;
+        batch_loader& operator=(const batch_loader&) = delete;
+
+        ~batch_loader()
+        {
+            wait();
+        }
+
+        // Adds obj to the next batch, unless it is already initialized.
+        template<typename T>
+        void add(file_lazy<T>& obj)
+        {
+            if (obj.is_initialized())
+            {
+                return;
+            }
+            std::unique_ptr<detail::load_request> request(new detail::load_request());
+            request->path = obj.path();
+            request->complete = [&obj](std::string&& data, std::error_code error) { obj.complete(std::move(data), error); };
+            m_pending.push_back(std::move(request));
+        }
+
+        // Starts loading everything added since the last submit(), on a background thread. Waits for the previous batch first.
+        void submit()
+        {
+            wait();
+            if (m_pending.empty())
+            {
+                return;
+            }
+            m_submitted.swap(m_pending);
+            m_worker = std::thread([this] {
+#if CPPLAZY_HAS_IO_URING
+                if (m_backend != load_backend::thread_pool && detail::load_with_io_uring(m_submitted, m_queue_depth))
+                {
+                    m_used.store(load_backend::io_uring, std::memory_order_relaxed);
+                    return;
+                }
+#endif
+                detail::load_with_thread_pool(m_submitted, m_queue_depth);
+                m_used.store(load_backend::thread_pool, std::memory_order_relaxed);
+            });
+        }
+
+        // Blocks until the submitted batch is loaded.
+        void wait()
+        {
+            if (m_worker.joinable())
+            {
+                m_worker.join();
+                m_submitted.clear();
+            }
+        }
+
+        // submit() and wait().
+        void load()
+        {
+            submit();
+            wait();
+        }
+
+        // The backend used by the last batch (automatic if none completed yet).
+        load_backend backend() const noexcept
+        {
+            return m_used.load(std::memory_order_relaxed);
+        }
+    };
+}
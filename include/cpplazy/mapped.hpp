@@ -0,0 +1,342 @@
+// Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+// Copyright (c) 2020 Ziv Shahaf <ziv.shahaf@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// lazy_mapped<T>: a file memory mapped on first access, and read in place as an array of T.
+
+#include "cpplazy.hpp"
+#include <cerrno>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace cpplazy
+{
+    // Hints for how a mapped file will be read (see madvise()). Ignored where not supported.
+    enum class map_advice
+    {
+        normal,
+        sequential,     // Read ahead aggressively, and drop pages behind
+        random,         // Don't read ahead
+        will_need       // Start reading the whole file in the background
+    };
+
+    struct map_options
+    {
+        bool populate = false;              // Fault in every page while mapping (MAP_POPULATE), so no access page-faults later
+        map_advice advice = map_advice::normal;
+    };
+
+    // A contiguous read only range of T inside a mapping (C++17 has no std::span).
+    template<typename T>
+    class mapped_span
+    {
+        const T* m_data = nullptr;
+        std::size_t m_size = 0;
+
+    public:
+
+        constexpr mapped_span() noexcept = default;
+
+        constexpr mapped_span(const T* data, std::size_t size) noexcept :
+            m_data(data),
+            m_size(size)
+        {
+        }
+
+        const T* data() const noexcept { return m_data; }
+        std::size_t size() const noexcept { return m_size; }
+        bool empty() const noexcept { return m_size == 0; }
+        const T* begin() const noexcept { return m_data; }
+        const T* end() const noexcept { return m_data + m_size; }
+        const T& operator[](std::size_t index) const noexcept { return m_data[index]; }
+    };
+
+    namespace detail
+    {
+        // A whole file mapped read only. Unmapped when destroyed.
+        class file_mapping
+        {
+            const char* m_data = nullptr;
+            std::size_t m_size = 0;
+
+        public:
+
+            file_mapping() noexcept = default;
+
+            file_mapping(const file_mapping&) = delete;
+            file_mapping& operator=(const file_mapping&) = delete;
+
+            file_mapping(file_mapping&& other) noexcept :
+                m_data(other.m_data),
+                m_size(other.m_size)
+            {
+                other.m_data = nullptr;
+                other.m_size = 0;
+            }
+
+            file_mapping& operator=(file_mapping&& other) noexcept
+            {
+                if (this != &other)
+                {
+                    unmap();
+                    std::swap(m_data, other.m_data);
+                    std::swap(m_size, other.m_size);
+                }
+                return *this;
+            }
+
+            ~file_mapping()
+            {
+                unmap();
+            }
+
+            // Empty files map to an empty (but successful) mapping.
+            static std::error_code map(const std::string& path, const map_options& options, file_mapping& mapping)
+            {
+#if defined(_WIN32)
+                (void)options;
+                HANDLE file = ::CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+                if (file == INVALID_HANDLE_VALUE)
+                {
+                    return std::error_code(static_cast<int>(::GetLastError()), std::system_category());
+                }
+                std::error_code error;
+                LARGE_INTEGER size;
+                if (!::GetFileSizeEx(file, &size))
+                {
+                    error = std::error_code(static_cast<int>(::GetLastError()), std::system_category());
+                }
+                else if (size.QuadPart > 0)
+                {
+                    HANDLE section = ::CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                    const void* data = section ? ::MapViewOfFile(section, FILE_MAP_READ, 0, 0, 0) : nullptr;
+                    if (!data)
+                    {
+                        error = std::error_code(static_cast<int>(::GetLastError()), std::system_category());
+                    }
+                    else
+                    {
+                        mapping = file_mapping();
+                        mapping.m_data = static_cast<const char*>(data);
+                        mapping.m_size = static_cast<std::size_t>(size.QuadPart);
+                    }
+                    if (section)
+                    {
+                        ::CloseHandle(section); // The view keeps the section alive
+                    }
+                }
+                ::CloseHandle(file);
+                return error;
+#else
+                const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                if (fd < 0)
+                {
+                    return std::error_code(errno, std::generic_category());
+                }
+                std::error_code error;
+                struct stat st;
+                if (::fstat(fd, &st) != 0)
+                {
+                    error = std::error_code(errno, std::generic_category());
+                }
+                else if (st.st_size > 0)
+                {
+                    int flags = MAP_SHARED;
+#if defined(MAP_POPULATE)
+                    flags |= options.populate ? MAP_POPULATE : 0;
+#endif
+                    void* data = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, flags, fd, 0);
+                    if (data == MAP_FAILED)
+                    {
+                        error = std::error_code(errno, std::generic_category());
+                    }
+                    else
+                    {
+                        mapping = file_mapping();
+                        mapping.m_data = static_cast<const char*>(data);
+                        mapping.m_size = static_cast<std::size_t>(st.st_size);
+                        mapping.advise(options.advice);
+                    }
+                }
+                ::close(fd); // The mapping stays valid
+                return error;
+#endif
+            }
+
+            std::string_view bytes() const noexcept
+            {
+                return std::string_view(m_data, m_size);
+            }
+
+        private:
+
+            void advise(map_advice advice) const noexcept
+            {
+#if !defined(_WIN32)
+                int posix_advice = MADV_NORMAL;
+                switch (advice)
+                {
+                case map_advice::sequential: posix_advice = MADV_SEQUENTIAL; break;
+                case map_advice::random: posix_advice = MADV_RANDOM; break;
+                case map_advice::will_need: posix_advice = MADV_WILLNEED; break;
+                default: return;
+                }
+                ::madvise(const_cast<char*>(m_data), m_size, posix_advice); // Only a hint, failures don't matter
+#else
+                (void)advice;
+#endif
+            }
+
+            void unmap() noexcept
+            {
+                if (m_data)
+                {
+#if defined(_WIN32)
+                    ::UnmapViewOfFile(m_data);
+#else
+                    ::munmap(const_cast<char*>(m_data), m_size);
+#endif
+                    m_data = nullptr;
+                    m_size = 0;
+                }
+            }
+        };
+    }
+
+    // Memory maps a file on first access, and reads it in place as an array of T (or as one T, or through view<U>()), 
+    // without copying it into memory owned by the process: the page cache is shared with every other reader of the file.
+    //
+    //  cpplazy::lazy_mapped<record> records{ "/data/reference.bin", { true, cpplazy::map_advice::random } };
+    //  for (const record& r : records.elements()) ...
+    //
+    // Like lazy_expected, a failure to map the file (see error()) is cached until reset() is called. 
+    // Mapping is thread safe, moving and reset() are not. T is read as is, it must be trivially copyable, 
+    // and the file must have been written with the same layout (endianness, padding).
+    template<typename T>
+    class lazy_mapped
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "lazy_mapped<T> reads T directly from the file, T must be trivially copyable");
+
+        lazy_expected<detail::file_mapping, std::error_code> m_mapping;
+
+        std::string_view mapped_bytes() const
+        {
+            const auto& mapping = m_mapping.get();
+            return mapping.has_value() ? mapping->bytes() : std::string_view();
+        }
+
+    public:
+
+        explicit lazy_mapped(std::string path, map_options options = {}) :
+            m_mapping([path = std::move(path), options]() -> expected<detail::file_mapping, std::error_code> {
+                detail::file_mapping mapping;
+                if (std::error_code error = detail::file_mapping::map(path, options, mapping))
+                {
+                    return unexpected<std::error_code>(error);
+                }
+                return mapping;
+            })
+        {
+        }
+
+        bool is_initialized() const noexcept
+        {
+            return m_mapping.is_initialized();
+        }
+
+        // Unmaps the file. The next access maps it again.
+        void reset() noexcept
+        {
+            m_mapping.reset();
+        }
+
+        // Maps the file if needed. Returns the error if it could not be mapped.
+        std::error_code error() const
+        {
+            const auto& mapping = m_mapping.get();
+            return mapping.has_value() ? std::error_code() : mapping.error();
+        }
+
+        // The whole file (empty if it could not be mapped).
+        std::string_view bytes() const
+        {
+            return mapped_bytes();
+        }
+
+        // The file as an array of T, any trailing partial T is ignored.
+        mapped_span<T> elements() const
+        {
+            const std::string_view bytes = mapped_bytes();
+            return mapped_span<T>(reinterpret_cast<const T*>(bytes.data()), bytes.size() / sizeof(T));
+        }
+
+        std::size_t size() const
+        {
+            return elements().size();
+        }
+
+        const T& operator[](std::size_t index) const
+        {
+            return elements()[index];
+        }
+
+        // The file as one T (e.g. a header struct). Null if the file is shorter than T.
+        const T* operator->() const
+        {
+            const mapped_span<T> all = elements();
+            return all.empty() ? nullptr : all.data();
+        }
+
+        const T& operator*() const
+        {
+            return *operator->();
+        }
+
+        // count U's starting offset bytes into the file (e.g. a flat table after a header).
+        // Empty if the range does not fit in the file, or offset is not aligned for U.
+        template<typename U>
+        mapped_span<U> view(std::size_t offset, std::size_t count) const
+        {
+            static_assert(std::is_trivially_copyable<U>::value, "view<U>() reads U directly from the file, U must be trivially copyable");
+            const std::string_view bytes = mapped_bytes();
+            if (offset > bytes.size() || count > (bytes.size() - offset) / sizeof(U) || offset % alignof(U) != 0)
+            {
+                return mapped_span<U>();
+            }
+            return mapped_span<U>(reinterpret_cast<const U*>(bytes.data() + offset), count);
+        }
+    };
+}
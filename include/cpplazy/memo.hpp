@@ -0,0 +1,321 @@
+// Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+// Copyright (c) 2020 Ziv Shahaf <ziv.shahaf@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// memo_seq<T>: a lazy sequence that remembers every element it produced, for repeated iteration and random access.
+
+#include "seq.hpp"
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <utility>
+
+
+namespace cpplazy
+{
+    template<typename T, std::size_t ChunkSize>
+    class memo_seq;
+
+    namespace detail
+    {
+        // Pulls from a memo_seq by index, so several sequences can iterate the same memo_seq.
+        template<typename Memo>
+        class memo_source
+        {
+            Memo* m_memo;
+            std::size_t m_index;
+
+        public:
+
+            using value_type = typename Memo::value_type;
+
+            memo_source(Memo* memo, std::size_t index) noexcept :
+                m_memo(memo),
+                m_index(index)
+            {
+            }
+
+            std::optional<value_type> next()
+            {
+                if (const value_type* value = m_memo->get(m_index))
+                {
+                    m_index++;
+                    return *value;
+                }
+                return std::nullopt;
+            }
+
+            template<typename Sink>
+            bool run(Sink& sink)
+            {
+                while (const value_type* value = m_memo->get(m_index))
+                {
+                    m_index++;
+                    if (!sink(*value))
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            }
+        };
+    }
+
+    // A sequence whose elements are produced once, on demand, and kept: iterating it again, or reading seq[i], 
+    // never runs the source again. For sequences that are expensive or endless (primes, hashes, Fibonacci numbers).
+    //
+    //  cpplazy::memo_seq<std::uint64_t> primes{ cpplazy::iota<std::uint64_t>(2).filter(is_prime) };
+    //  std::uint64_t p = primes[999]; //Produces the first 1000 primes
+    //  for (std::uint64_t q : primes.view().take(10)) ... //Reads the first 10 from memory
+    //
+    // Elements are stored in chunks of ChunkSize that never move, so references to them stay valid. Reading elements 
+    // already produced is lock free. Producing new ones takes a lock, so only one thread extends the sequence at a time, 
+    // and the others wait for it (or read what is already there). Up to 1M chunks: past capacity(), get() returns null 
+    // without pulling from the source, is_full() is true and is_complete() stays false.
+    template<typename T, std::size_t ChunkSize = 1024>
+    class memo_seq
+    {
+        static constexpr std::size_t chunks_per_block = 1024;
+        static constexpr std::size_t max_blocks = 1024;
+
+        struct block
+        {
+            std::atomic<T*> chunks[chunks_per_block] = {};
+        };
+
+        lazy_seq<T> m_source;
+        std::atomic<block*> m_blocks[max_blocks] = {};
+        std::atomic<std::size_t> m_size{ 0 };
+        std::atomic<bool> m_exhausted{ false };
+        std::mutex m_producer;
+
+        T* slot(std::size_t index) const noexcept
+        {
+            const std::size_t chunk = index / ChunkSize;
+            return m_blocks[chunk / chunks_per_block].load(std::memory_order_acquire)->chunks[chunk % chunks_per_block].load(std::memory_order_acquire) + index % ChunkSize;
+        }
+
+        // Makes room for element index, below capacity() (called by the producer only).
+        T* reserve(std::size_t index)
+        {
+            const std::size_t chunk = index / ChunkSize;
+            std::atomic<block*>& b = m_blocks[chunk / chunks_per_block];
+            if (!b.load(std::memory_order_relaxed))
+            {
+                b.store(new block(), std::memory_order_release);
+            }
+            std::atomic<T*>& c = b.load(std::memory_order_relaxed)->chunks[chunk % chunks_per_block];
+            if (!c.load(std::memory_order_relaxed))
+            {
+                c.store(static_cast<T*>(::operator new(sizeof(T) * ChunkSize, std::align_val_t(alignof(T)))), std::memory_order_release);
+            }
+            return c.load(std::memory_order_relaxed) + index % ChunkSize;
+        }
+
+        // Produces elements up to index. Returns false if the source ends before, or the memo is full.
+        bool produce(std::size_t index)
+        {
+            std::lock_guard<std::mutex> lock(m_producer);
+            std::size_t size = m_size.load(std::memory_order_relaxed);
+            while (size <= index)
+            {
+                if (m_exhausted.load(std::memory_order_relaxed) || size == capacity())
+                {
+                    return false; // Full is checked before pulling, so no element of the source is lost
+                }
+                std::optional<T> value = m_source.next();
+                if (!value)
+                {
+                    m_exhausted.store(true, std::memory_order_release);
+                    return false;
+                }
+                new (reserve(size)) T(std::move(*value));
+                m_size.store(++size, std::memory_order_release); // Published one by one, readers don't wait for the whole batch
+            }
+            return true;
+        }
+
+    public:
+
+        using value_type = T;
+
+        template<typename Source>
+        explicit memo_seq(lazy_seq<T, Source> source) :
+            m_source(std::move(source))
+        {
+        }
+
+        memo_seq(const memo_seq&) = delete;
+        memo_seq& operator=(const memo_seq&) = delete;
+
+        ~memo_seq()
+        {
+            const std::size_t size = m_size.load(std::memory_order_relaxed);
+            for (std::size_t i = 0; i < size; i++)
+            {
+                slot(i)->~T();
+            }
+            for (std::atomic<block*>& b : m_blocks)
+            {
+                block* blk = b.load(std::memory_order_relaxed);
+                if (!blk)
+                {
+                    break;
+                }
+                for (std::atomic<T*>& c : blk->chunks)
+                {
+                    if (T* chunk = c.load(std::memory_order_relaxed))
+                    {
+                        ::operator delete(chunk, std::align_val_t(alignof(T)));
+                    }
+                }
+                delete blk;
+            }
+        }
+
+        // Element index, produced if needed. Null if the sequence ends before it.
+        const T* get(std::size_t index)
+        {
+            if (index >= m_size.load(std::memory_order_acquire))
+            {
+                // Past the end for good: answered without taking the producer lock. The size is loaded again, 
+                // elements produced before the end was seen are published by then.
+                if (m_exhausted.load(std::memory_order_acquire))
+                {
+                    return index < m_size.load(std::memory_order_acquire) ? slot(index) : nullptr;
+                }
+                if (index >= capacity() || !produce(index))
+                {
+                    return nullptr;
+                }
+            }
+            return slot(index);
+        }
+
+        // Element index, which must exist (see get() otherwise).
+        const T& operator[](std::size_t index)
+        {
+            return *get(index);
+        }
+
+        // How many elements were produced so far.
+        std::size_t produced() const noexcept
+        {
+            return m_size.load(std::memory_order_acquire);
+        }
+
+        // Whether the source ended (then produced() is the sequence's length).
+        bool is_complete() const noexcept
+        {
+            return m_exhausted.load(std::memory_order_acquire);
+        }
+
+        // The most elements a memo_seq can hold.
+        static constexpr std::size_t capacity() noexcept
+        {
+            return max_blocks * chunks_per_block * ChunkSize;
+        }
+
+        // Whether capacity() elements were produced, while the source may have more.
+        bool is_full() const noexcept
+        {
+            return produced() == capacity();
+        }
+
+        // A lazy_seq over the elements from first, reading the memo (and extending it when it gets to the end).
+        lazy_seq<T, detail::memo_source<memo_seq>> view(std::size_t first = 0) noexcept
+        {
+            return lazy_seq<T, detail::memo_source<memo_seq>>(detail::memo_source<memo_seq>(this, first));
+        }
+
+        class iterator
+        {
+            memo_seq* m_memo = nullptr;
+            std::size_t m_index = 0;
+            const T* m_current = nullptr;
+
+        public:
+
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = T;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const T*;
+            using reference = const T&;
+
+            iterator() = default;
+
+            iterator(memo_seq* memo, std::size_t index) :
+                m_memo(memo),
+                m_index(index),
+                m_current(memo->get(index))
+            {
+            }
+
+            const T& operator*() const noexcept
+            {
+                return *m_current;
+            }
+
+            const T* operator->() const noexcept
+            {
+                return m_current;
+            }
+
+            iterator& operator++()
+            {
+                m_current = m_memo->get(++m_index);
+                return *this;
+            }
+
+            iterator operator++(int)
+            {
+                iterator previous = *this;
+                ++*this;
+                return previous;
+            }
+
+            // Ends are all equal
+            bool operator==(const iterator& other) const noexcept
+            {
+                return m_current == other.m_current;
+            }
+
+            bool operator!=(const iterator& other) const noexcept
+            {
+                return !(*this == other);
+            }
+        };
+
+        iterator begin()
+        {
+            return iterator(this, 0);
+        }
+
+        iterator end() noexcept
+        {
+            return iterator();
+        }
+    };
+}
@@ -0,0 +1,292 @@
+// Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+// Copyright (c) 2020 Ziv Shahaf <ziv.shahaf@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// Dumps the named lazy objects (see cpplazy::for_each_registered()) as Prometheus text or JSON.
+// Only lists objects when built with CPPLAZY_ENABLE_INSTRUMENTATION.
+
+#include "cpplazy.hpp"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+namespace cpplazy
+{
+    enum class metrics_format
+    {
+        prometheus,
+        json
+    };
+
+    namespace detail
+    {
+        inline void append_escaped(std::string& out, const std::string& value)
+        {
+            for (char c : value)
+            {
+                switch (c)
+                {
+                case '\\': out += "\\\\"; break;
+                case '"': out += "\\\""; break;
+                case '\n': out += "\\n"; break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20)
+                    {
+                        char buffer[8];
+                        std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                        out += buffer;
+                    }
+                    else
+                    {
+                        out += c;
+                    }
+                }
+            }
+        }
+
+        inline std::string seconds(std::chrono::nanoseconds duration)
+        {
+            char buffer[32];
+            std::snprintf(buffer, sizeof(buffer), "%.9f", std::chrono::duration<double>(duration).count());
+            return buffer;
+        }
+
+        inline const char* to_string(lazy_state state)
+        {
+            switch (state)
+            {
+            case lazy_state::initialized: return "initialized";
+            case lazy_state::initializing: return "initializing";
+            default: return "uninitialized";
+            }
+        }
+
+        inline std::string format_prometheus(const std::vector<lazy_info>& lazies)
+        {
+            struct metric
+            {
+                const char* name;
+                const char* type;
+                const char* help;
+                std::string (*value)(const lazy_info&);
+            };
+            static const metric metrics[] = {
+                { "cpplazy_initialized", "gauge", "Whether the lazy object is initialized.", [](const lazy_info& i) { return std::string(i.state == lazy_state::initialized ? "1" : "0"); } },
+                { "cpplazy_value_bytes", "gauge", "Estimated memory held by the value.", [](const lazy_info& i) { return std::to_string(i.value_size); } },
+                { "cpplazy_init_seconds", "gauge", "Time spent in the last successful initialization.", [](const lazy_info& i) { return seconds(i.stats.init_time); } },
+                { "cpplazy_first_access_seconds", "gauge", "Time from process start to the first access (0 if never accessed).", [](const lazy_info& i) { return seconds(i.stats.first_access); } },
+                { "cpplazy_init_failures_total", "counter", "Initializations that failed.", [](const lazy_info& i) { return std::to_string(i.stats.failures); } },
+                { "cpplazy_waits_total", "counter", "Times a thread blocked waiting for another thread's initialization.", [](const lazy_info& i) { return std::to_string(i.stats.waits); } },
+                { "cpplazy_wait_seconds_total", "counter", "Total time threads spent blocked.", [](const lazy_info& i) { return seconds(i.stats.total_wait); } },
+                { "cpplazy_max_wait_seconds", "gauge", "Longest time a thread spent blocked.", [](const lazy_info& i) { return seconds(i.stats.max_wait); } },
+#if CPPLAZY_ENABLE_PERF_COUNTERS
+                { "cpplazy_init_cycles", "gauge", "CPU cycles spent in the last successful initialization.", [](const lazy_info& i) { return std::to_string(i.stats.cycles); } },
+                { "cpplazy_init_instructions", "gauge", "Instructions retired in the last successful initialization.", [](const lazy_info& i) { return std::to_string(i.stats.instructions); } },
+                { "cpplazy_init_cache_misses", "gauge", "Last level cache misses in the last successful initialization.", [](const lazy_info& i) { return std::to_string(i.stats.cache_misses); } },
+                { "cpplazy_init_page_faults", "gauge", "Page faults in the last successful initialization.", [](const lazy_info& i) { return std::to_string(i.stats.page_faults); } },
+#endif
+            };
+
+            std::string out;
+            for (const metric& m : metrics)
+            {
+                out += std::string("# HELP ") + m.name + " " + m.help + "\n";
+                out += std::string("# TYPE ") + m.name + " " + m.type + "\n";
+                for (const lazy_info& info : lazies)
+                {
+                    out += m.name;
+                    out += "{name=\"";
+                    append_escaped(out, info.name);
+                    out += "\"} " + m.value(info) + "\n";
+                }
+            }
+            return out;
+        }
+
+        inline std::string format_json(const std::vector<lazy_info>& lazies)
+        {
+            std::string out = "{\"lazies\":[";
+            for (size_t i = 0; i < lazies.size(); i++)
+            {
+                const lazy_info& info = lazies[i];
+                out += i ? ",{\"name\":\"" : "{\"name\":\"";
+                append_escaped(out, info.name);
+                out += "\",\"state\":\"" + std::string(to_string(info.state)) + "\"";
+                out += ",\"value_bytes\":" + std::to_string(info.value_size);
+                out += ",\"init_seconds\":" + seconds(info.stats.init_time);
+                out += ",\"first_access_seconds\":" + seconds(info.stats.first_access);
+                out += ",\"failures\":" + std::to_string(info.stats.failures);
+                out += ",\"waits\":" + std::to_string(info.stats.waits);
+                out += ",\"total_wait_seconds\":" + seconds(info.stats.total_wait);
+                out += ",\"max_wait_seconds\":" + seconds(info.stats.max_wait);
+#if CPPLAZY_ENABLE_PERF_COUNTERS
+                out += ",\"cycles\":" + std::to_string(info.stats.cycles);
+                out += ",\"instructions\":" + std::to_string(info.stats.instructions);
+                out += ",\"cache_misses\":" + std::to_string(info.stats.cache_misses);
+                out += ",\"page_faults\":" + std::to_string(info.stats.page_faults);
+#endif
+                out += "}";
+            }
+            out += "]}\n";
+            return out;
+        }
+
+        inline bool write_all(int fd, const std::string& data)
+        {
+            size_t written = 0;
+            while (written < data.size())
+            {
+#if defined(_WIN32)
+                const int n = ::_write(fd, data.data() + written, static_cast<unsigned int>(data.size() - written));
+#else
+                const ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+                if (n < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+#endif
+                if (n <= 0)
+                {
+                    return false;
+                }
+                written += static_cast<size_t>(n);
+            }
+            return true;
+        }
+    }
+
+    // A snapshot of every named lazy object.
+    inline std::vector<lazy_info> registered_lazies()
+    {
+        std::vector<lazy_info> lazies;
+        for_each_registered([&lazies](const lazy_info& info) { lazies.push_back(info); });
+        return lazies;
+    }
+
+    inline std::string format_metrics(metrics_format format = metrics_format::prometheus)
+    {
+        const std::vector<lazy_info> lazies = registered_lazies();
+        return format == metrics_format::json ? detail::format_json(lazies) : detail::format_prometheus(lazies);
+    }
+
+    // Returns false if writing failed.
+    inline bool write_metrics(int fd, metrics_format format = metrics_format::prometheus)
+    {
+        return detail::write_all(fd, format_metrics(format));
+    }
+
+    // Replaces the file atomically (writes a temporary file and renames it), so scrapers never see a partial dump.
+    inline bool write_metrics(const std::string& path, metrics_format format = metrics_format::prometheus)
+    {
+        const std::string temp_path = path + ".tmp";
+        std::FILE* file = std::fopen(temp_path.c_str(), "wb");
+        if (!file)
+        {
+            return false;
+        }
+        const std::string data = format_metrics(format);
+        const bool written = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+        if (std::fclose(file) != 0 || !written)
+        {
+            std::remove(temp_path.c_str());
+            return false;
+        }
+#if defined(_WIN32)
+        std::remove(path.c_str()); // rename() does not replace existing files on Windows
+#endif
+        return std::rename(temp_path.c_str(), path.c_str()) == 0;
+    }
+
+#if !defined(_WIN32)
+    namespace detail
+    {
+        inline std::atomic<int>& metrics_signal_fd() noexcept
+        {
+            static std::atomic<int> fd{ -1 };
+            return fd;
+        }
+
+        inline void on_metrics_signal(int)
+        {
+            // Only async-signal-safe calls here, the dump itself happens on the background thread
+            const int saved_errno = errno;
+            const char wake = 0;
+            (void)!::write(metrics_signal_fd().load(std::memory_order_relaxed), &wake, 1);
+            errno = saved_errno;
+        }
+    }
+
+    // Dumps the metrics to path whenever the process receives signal (e.g. SIGUSR1).
+    // The signal handler only wakes a background thread which does the actual work.
+    // Can be called once per process, returns false if already installed, or on failure.
+    inline bool dump_metrics_on_signal(int signal, std::string path, metrics_format format = metrics_format::prometheus)
+    {
+        int fds[2];
+        if (detail::metrics_signal_fd().load() != -1 || ::pipe(fds) != 0)
+        {
+            return false;
+        }
+        ::fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        ::fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+        ::fcntl(fds[1], F_SETFL, O_NONBLOCK); // A burst of signals must never block the handler
+        int unset = -1;
+        if (!detail::metrics_signal_fd().compare_exchange_strong(unset, fds[1]))
+        {
+            ::close(fds[0]);
+            ::close(fds[1]);
+            return false;
+        }
+
+        std::thread([read_fd = fds[0], path = std::move(path), format] {
+            char wake;
+            for (;;)
+            {
+                const ssize_t n = ::read(read_fd, &wake, 1);
+                if (n > 0)
+                {
+                    write_metrics(path, format);
+                }
+                else if (n == 0 || errno != EINTR)
+                {
+                    return;
+                }
+            }
+        }).detach();
+
+        struct sigaction action = {};
+        action.sa_handler = &detail::on_metrics_signal;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        return ::sigaction(signal, &action, nullptr) == 0;
+    }
+#endif
+}
@@ -0,0 +1,568 @@
+// Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+// Copyright (c) 2020 Ziv Shahaf <ziv.shahaf@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// lazy_pages<T>: a huge array whose pages are filled on first touch. Linux only.
+
+#include "cpplazy.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <memory>
+#include <system_error>
+
+#if !defined(__linux__)
+#error "lazy_pages<T> needs userfaultfd or memfd_create, which are Linux only"
+#endif
+
+#include <fcntl.h>
+#include <linux/userfaultfd.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+namespace cpplazy
+{
+    // How lazy_pages<T> finds out a page is touched for the first time.
+    // Only touches from user code fill pages: a system call given an unfilled range (e.g. read(fd, pages.data() + i, n), 
+    // or write() from it) fails with EFAULT, both in signal mode and with userfaultfd in user mode only (kernels 5.11 and later). 
+    // Call lazy_pages::prefault() on the range first.
+    enum class page_fault_mode
+    {
+        automatic,      // userfaultfd if the kernel allows it, signal otherwise
+        userfaultfd,    // Faults are resolved by a thread of the object's own, the faulting thread sleeps in the kernel meanwhile
+        signal          // Pages start PROT_NONE, and are filled by a SIGSEGV handler on the faulting thread
+    };
+
+    namespace detail
+    {
+        // A region of lazy_pages in signal mode. Looked up by the SIGSEGV handler, so it must not allocate or lock.
+        struct fault_region
+        {
+            char* view;                             // What the user reads, PROT_NONE until filled
+            char* alias;                            // The same memory, always writable, filled before the view is opened
+            std::size_t size;
+            std::size_t granule;
+            std::atomic<std::uint8_t>* states;      // Per granule: 0 empty, 1 filling, 2 filled
+            void (*fill)(const fault_region&, std::size_t granule_index, char* destination);
+            const void* owner;
+            std::atomic<std::size_t>* filled;
+        };
+
+        class fault_regions
+        {
+            static constexpr std::size_t capacity = 64;
+
+            static std::atomic<fault_region*>* slots() noexcept
+            {
+                static std::atomic<fault_region*> regions[capacity];
+                return regions;
+            }
+
+            static struct sigaction& previous_action() noexcept
+            {
+                static struct sigaction action;
+                return action;
+            }
+
+            static void on_fault(int signal, siginfo_t* info, void* context)
+            {
+                char* address = static_cast<char*>(info->si_addr);
+                for (std::size_t i = 0; i < capacity; i++)
+                {
+                    const fault_region* region = slots()[i].load(std::memory_order_acquire);
+                    if (region && address >= region->view && address < region->view + region->size)
+                    {
+                        resolve(*region, static_cast<std::size_t>(address - region->view) / region->granule);
+                        return; // The faulting instruction runs again
+                    }
+                }
+
+                // Not ours: hand it to whoever was installed before, or to the default action
+                const struct sigaction& previous = previous_action();
+                if ((previous.sa_flags & SA_SIGINFO) && previous.sa_sigaction)
+                {
+                    previous.sa_sigaction(signal, info, context);
+                }
+                else if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN)
+                {
+                    previous.sa_handler(signal);
+                }
+                else
+                {
+                    ::signal(signal, SIG_DFL); // The fault happens again and kills the process as usual
+                }
+            }
+
+            static void resolve(const fault_region& region, std::size_t granule_index)
+            {
+                std::atomic<std::uint8_t>& state = region.states[granule_index];
+                std::uint8_t empty = 0;
+                if (state.compare_exchange_strong(empty, 1, std::memory_order_acquire))
+                {
+                    const std::size_t offset = granule_index * region.granule;
+                    region.fill(region, granule_index, region.alias + offset);
+                    ::mprotect(region.view + offset, region.granule, PROT_READ | PROT_WRITE);
+                    region.filled->fetch_add(1, std::memory_order_relaxed);
+                    state.store(2, std::memory_order_release);
+                }
+                else
+                {
+                    // Another thread is filling this granule
+                    while (state.load(std::memory_order_acquire) != 2)
+                    {
+                        ::sched_yield();
+                    }
+                }
+            }
+
+        public:
+
+            static std::error_code add(fault_region* region)
+            {
+                static const bool installed = [] {
+                    struct sigaction action = {};
+                    action.sa_sigaction = &on_fault;
+                    sigemptyset(&action.sa_mask);
+                    action.sa_flags = SA_SIGINFO | SA_NODEFER | SA_RESTART; // SA_NODEFER: a fill function may touch another lazy_pages
+                    return ::sigaction(SIGSEGV, &action, &previous_action()) == 0;
+                }();
+                if (!installed)
+                {
+                    return std::error_code(errno, std::generic_category());
+                }
+                for (std::size_t i = 0; i < capacity; i++)
+                {
+                    fault_region* expected = nullptr;
+                    if (slots()[i].compare_exchange_strong(expected, region, std::memory_order_acq_rel))
+                    {
+                        return std::error_code();
+                    }
+                }
+                return std::make_error_code(std::errc::too_many_files_open);
+            }
+
+            static void remove(fault_region* region) noexcept
+            {
+                for (std::size_t i = 0; i < capacity; i++)
+                {
+                    fault_region* expected = region;
+                    if (slots()[i].compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel))
+                    {
+                        return;
+                    }
+                }
+            }
+        };
+
+        inline std::size_t system_page_size() noexcept
+        {
+            static const std::size_t size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+            return size;
+        }
+    }
+
+    // A huge array of T, filled one granule (a page, or a multiple of it such as 2MB) at a time, on first touch:
+    // touching 1% of a 10GB table only costs 1% of the fill work (and memory).
+    //
+    //  cpplazy::lazy_pages<float> table{ 2'500'000'000, [](std::size_t first, float* values, std::size_t count) {
+    //      for (std::size_t i = 0; i < count; i++) values[i] = compute(first + i);
+    //  } };
+    //  float f = table[123'456'789]; //Only fills the page holding this element
+    //
+    // fill(first, elements, count) initializes elements [first, first + count). elements points to a scratch buffer, not into data().
+    // It runs on a thread of the object's own (userfaultfd), or inside a SIGSEGV handler on the faulting thread (signal),
+    // so it must not throw, must not touch this object, and in signal mode should avoid taking locks the faulting code may hold.
+    // If the region can't be set up, error() tells why, and data() is null. T must be trivially copyable, and fit evenly in a 4KB page.
+    // The object can't be moved, since faults are routed to its address.
+    template<typename T>
+    class lazy_pages
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "lazy_pages<T> fills memory directly, T must be trivially copyable");
+        static_assert(4096 % sizeof(T) == 0, "lazy_pages<T> fills whole pages, sizeof(T) must divide the page size");
+
+    public:
+
+        using fill_func = std::function<void(std::size_t first, T* elements, std::size_t count)>;
+
+    private:
+
+        std::size_t m_count;
+        fill_func m_fill;
+        std::size_t m_granule;
+        std::size_t m_bytes;
+        page_fault_mode m_mode = page_fault_mode::automatic;
+        std::error_code m_error;
+        char* m_data = nullptr;
+        std::atomic<std::size_t> m_filled{ 0 };
+
+        // userfaultfd
+        int m_uffd = -1;
+        int m_stop_pipe[2] = { -1, -1 };
+        char* m_scratch = nullptr;
+        std::thread m_fault_thread;
+
+        // signal
+        char* m_alias = nullptr;
+        std::unique_ptr<std::atomic<std::uint8_t>[]> m_states;
+        detail::fault_region m_region = {};
+
+        void fill_granule(std::size_t granule_index, char* destination) const
+        {
+            const std::size_t per_granule = m_granule / sizeof(T);
+            const std::size_t first = granule_index * per_granule;
+            if (first < m_count)
+            {
+                m_fill(first, reinterpret_cast<T*>(destination), std::min(per_granule, m_count - first));
+            }
+        }
+
+        std::error_code set_up_userfaultfd()
+        {
+            int uffd = static_cast<int>(::syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY));
+            if (uffd < 0 && errno == EINVAL)
+            {
+                uffd = static_cast<int>(::syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK)); // Kernels before 5.11
+            }
+            if (uffd < 0)
+            {
+                return std::error_code(errno, std::generic_category());
+            }
+            m_uffd = uffd;
+
+            uffdio_api api = {};
+            api.api = UFFD_API;
+            if (::ioctl(m_uffd, UFFDIO_API, &api) != 0)
+            {
+                return std::error_code(errno, std::generic_category());
+            }
+
+            void* data = ::mmap(nullptr, m_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (data == MAP_FAILED)
+            {
+                return std::error_code(errno, std::generic_category());
+            }
+            m_data = static_cast<char*>(data);
+
+            uffdio_register registration = {};
+            registration.range.start = reinterpret_cast<std::uintptr_t>(m_data);
+            registration.range.len = m_bytes;
+            registration.mode = UFFDIO_REGISTER_MODE_MISSING;
+            if (::ioctl(m_uffd, UFFDIO_REGISTER, &registration) != 0)
+            {
+                return std::error_code(errno, std::generic_category());
+            }
+
+            void* scratch = ::mmap(nullptr, m_granule, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (scratch == MAP_FAILED)
+            {
+                return std::error_code(errno, std::generic_category());
+            }
+            m_scratch = static_cast<char*>(scratch);
+
+            if (::pipe2(m_stop_pipe, O_CLOEXEC) != 0)
+            {
+                return std::error_code(errno, std::generic_category());
+            }
+            m_fault_thread = std::thread([this] { serve_faults(); });
+            return std::error_code();
+        }
+
+        void serve_faults()
+        {
+            pollfd fds[2] = { { m_uffd, POLLIN, 0 }, { m_stop_pipe[0], POLLIN, 0 } };
+            for (;;)
+            {
+                if (::poll(fds, 2, -1) < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    return;
+                }
+                if (fds[1].revents)
+                {
+                    return;
+                }
+
+                uffd_msg message;
+                if (::read(m_uffd, &message, sizeof(message)) != sizeof(message) || message.event != UFFD_EVENT_PAGEFAULT)
+                {
+                    continue;
+                }
+                const std::size_t granule_index = (static_cast<std::size_t>(message.arg.pagefault.address) - reinterpret_cast<std::uintptr_t>(m_data)) / m_granule;
+                std::memset(m_scratch, 0, m_granule);
+                fill_granule(granule_index, m_scratch);
+
+                uffdio_copy copy = {};
+                copy.dst = reinterpret_cast<std::uintptr_t>(m_data + granule_index * m_granule);
+                copy.src = reinterpret_cast<std::uintptr_t>(m_scratch);
+                copy.len = m_granule;
+                m_filled.fetch_add(1, std::memory_order_relaxed); // Before the copy, which wakes the faulting thread
+                if (::ioctl(m_uffd, UFFDIO_COPY, &copy) != 0)
+                {
+                    m_filled.fetch_sub(1, std::memory_order_relaxed);
+                    if (errno == EEXIST)
+                    {
+                        // Another fault on the same granule was resolved first, wake whoever waits on this one
+                        uffdio_range range = { copy.dst, m_granule };
+                        ::ioctl(m_uffd, UFFDIO_WAKE, &range);
+                    }
+                }
+            }
+        }
+
+        std::error_code set_up_signal()
+        {
+            // Allocated before anything that would need tearing down
+            const std::size_t granules = m_bytes / m_granule;
+            m_states.reset(new std::atomic<std::uint8_t>[granules]);
+            for (std::size_t i = 0; i < granules; i++)
+            {
+                m_states[i].store(0, std::memory_order_relaxed);
+            }
+
+            const int fd = static_cast<int>(::syscall(__NR_memfd_create, "cpplazy_pages", MFD_CLOEXEC));
+            if (fd < 0)
+            {
+                return std::error_code(errno, std::generic_category());
+            }
+            std::error_code error;
+            if (::ftruncate(fd, static_cast<off_t>(m_bytes)) != 0)
+            {
+                error = std::error_code(errno, std::generic_category());
+            }
+            else
+            {
+                void* view = ::mmap(nullptr, m_bytes, PROT_NONE, MAP_SHARED | MAP_NORESERVE, fd, 0);
+                void* alias = view == MAP_FAILED ? MAP_FAILED : ::mmap(nullptr, m_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0);
+                if (alias == MAP_FAILED)
+                {
+                    error = std::error_code(errno, std::generic_category());
+                    if (view != MAP_FAILED)
+                    {
+                        ::munmap(view, m_bytes);
+                    }
+                }
+                else
+                {
+                    m_data = static_cast<char*>(view);
+                    m_alias = static_cast<char*>(alias);
+                }
+            }
+            ::close(fd); // The mappings keep the memory alive
+            if (error)
+            {
+                return error;
+            }
+
+            m_region.view = m_data;
+            m_region.alias = m_alias;
+            m_region.size = m_bytes;
+            m_region.granule = m_granule;
+            m_region.states = m_states.get();
+            m_region.owner = this;
+            m_region.filled = &m_filled;
+            m_region.fill = [](const detail::fault_region& region, std::size_t granule_index, char* destination) {
+                static_cast<const lazy_pages*>(region.owner)->fill_granule(granule_index, destination);
+            };
+            return detail::fault_regions::add(&m_region);
+        }
+
+        void tear_down() noexcept
+        {
+            if (m_fault_thread.joinable())
+            {
+                const char stop = 0;
+                (void)!::write(m_stop_pipe[1], &stop, 1);
+                m_fault_thread.join();
+            }
+            if (m_region.view)
+            {
+                detail::fault_regions::remove(&m_region);
+                m_region.view = nullptr;
+            }
+            for (int fd : { m_uffd, m_stop_pipe[0], m_stop_pipe[1] })
+            {
+                if (fd >= 0)
+                {
+                    ::close(fd);
+                }
+            }
+            m_uffd = m_stop_pipe[0] = m_stop_pipe[1] = -1;
+            for (char** mapping : { &m_data, &m_alias })
+            {
+                if (*mapping)
+                {
+                    ::munmap(*mapping, m_bytes);
+                    *mapping = nullptr;
+                }
+            }
+            if (m_scratch)
+            {
+                ::munmap(m_scratch, m_granule);
+                m_scratch = nullptr;
+            }
+        }
+
+        void set_up(page_fault_mode mode)
+        {
+            if (mode != page_fault_mode::signal)
+            {
+                m_error = set_up_userfaultfd();
+                m_mode = page_fault_mode::userfaultfd;
+                if (m_error && mode == page_fault_mode::automatic)
+                {
+                    tear_down();
+                    m_error.clear();
+                    mode = page_fault_mode::signal;
+                }
+            }
+            if (mode == page_fault_mode::signal)
+            {
+                m_error = set_up_signal();
+                m_mode = page_fault_mode::signal;
+            }
+        }
+
+    public:
+
+        // granule is rounded up to a multiple of the system page size (0 for one page). 
+        // Larger granules (e.g. 2MB) mean fewer faults, each filling more.
+        lazy_pages(std::size_t count, fill_func fill, std::size_t granule = 0, page_fault_mode mode = page_fault_mode::automatic) :
+            m_count(count),
+            m_fill(std::move(fill))
+        {
+            const std::size_t page = detail::system_page_size();
+            if (granule > SIZE_MAX - page || count > (SIZE_MAX - granule - page) / sizeof(T))
+            {
+                m_granule = page;
+                m_bytes = 0;
+                m_error = std::make_error_code(std::errc::value_too_large); // count * sizeof(T), rounded up, would wrap
+                return;
+            }
+            m_granule = granule <= page ? page : (granule + page - 1) / page * page;
+            m_bytes = count ? (count * sizeof(T) + m_granule - 1) / m_granule * m_granule : m_granule;
+
+            // The destructor doesn't run if the constructor throws (allocating, or starting the fault thread)
+#if CPPLAZY_HAS_EXCEPTIONS
+            try
+            {
+                set_up(mode);
+            }
+            catch (...)
+            {
+                tear_down();
+                throw;
+            }
+#else
+            set_up(mode);
+#endif
+            if (m_error)
+            {
+                tear_down();
+            }
+        }
+
+        lazy_pages(const lazy_pages&) = delete;
+        lazy_pages& operator=(const lazy_pages&) = delete;
+
+        ~lazy_pages()
+        {
+            tear_down();
+        }
+
+        std::error_code error() const noexcept
+        {
+            return m_error;
+        }
+
+        // The mechanism in use (after automatic picked one).
+        page_fault_mode mode() const noexcept
+        {
+            return m_mode;
+        }
+
+        // The number of granules filled so far.
+        std::size_t filled() const noexcept
+        {
+            return m_filled.load(std::memory_order_relaxed);
+        }
+
+        std::size_t granule_size() const noexcept
+        {
+            return m_granule;
+        }
+
+        std::size_t size() const noexcept
+        {
+            return m_count;
+        }
+
+        T* data() noexcept
+        {
+            return reinterpret_cast<T*>(m_data);
+        }
+
+        const T* data() const noexcept
+        {
+            return reinterpret_cast<const T*>(m_data);
+        }
+
+        // Fills the granules holding elements [first, first + count) now, by touching them. Needed before passing 
+        // that range to a system call, which gets EFAULT rather than filling it (see page_fault_mode).
+        void prefault(std::size_t first, std::size_t count) const noexcept
+        {
+            if (!m_data || first >= m_count || count == 0)
+            {
+                return;
+            }
+            const std::size_t last = first + std::min(count, m_count - first); // Exclusive
+            const std::size_t first_granule = first * sizeof(T) / m_granule;
+            const std::size_t last_granule = (last * sizeof(T) - 1) / m_granule;
+            for (std::size_t g = first_granule; g <= last_granule; g++)
+            {
+                static_cast<void>(*static_cast<const volatile char*>(m_data + g * m_granule));
+            }
+        }
+
+        T* begin() noexcept { return data(); }
+        T* end() noexcept { return data() + (m_data ? m_count : 0); }
+        const T* begin() const noexcept { return data(); }
+        const T* end() const noexcept { return data() + (m_data ? m_count : 0); }
+
+        T& operator[](std::size_t index) noexcept
+        {
+            return data()[index];
+        }
+
+        const T& operator[](std::size_t index) const noexcept
+        {
+            return data()[index];
+        }
+    };
+}
@@ -0,0 +1,509 @@
+// Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+// Copyright (c) 2020 Ziv Shahaf <ziv.shahaf@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// Parallel reduce(), for_each() and collect() for lazy_seq pipelines, on a shared work stealing thread pool.
+
+#include "cpplazy.hpp"
+#include "seq.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+
+namespace cpplazy
+{
+    struct sequential_policy
+    {
+    };
+
+    struct parallel_policy
+    {
+        unsigned threads = 0;       // Including the calling thread, 0 for std::thread::hardware_concurrency()
+        std::size_t grain = 0;      // Source elements per chunk, 0 to split in up to 1024 chunks
+    };
+
+    inline constexpr sequential_policy sequential{};
+    inline constexpr parallel_policy parallel{};
+
+    namespace detail
+    {
+        template<typename Source, typename = void>
+        struct is_splittable : std::false_type
+        {
+        };
+
+        template<typename Source>
+        struct is_splittable<Source, std::void_t<decltype(std::declval<const Source&>().size()), decltype(std::declval<const Source&>().slice(0, 0)), 
+            decltype(std::declval<const Source&>().can_split())>> : std::true_type
+        {
+        };
+
+        // The chunks of one parallel call. Each participant owns a contiguous range of chunk indexes, takes chunks from 
+        // its front, and once it is empty steals half of the remaining range of another participant, from the back.
+        // A range is one 64 bit word (begin and end), so taking and stealing are single compare and swaps.
+        class parallel_job
+        {
+            std::function<void(std::size_t chunk)> m_work;
+            std::unique_ptr<std::atomic<std::uint64_t>[]> m_ranges;
+            unsigned m_slots;
+            std::atomic<unsigned> m_next_slot{ 0 };
+            std::atomic<std::size_t> m_unclaimed;
+            std::atomic<std::size_t> m_remaining;
+            std::mutex m_mutex;
+            std::condition_variable m_done;
+#if CPPLAZY_HAS_EXCEPTIONS
+            std::exception_ptr m_error;
+#endif
+            std::atomic<bool> m_failed{ false };
+
+            static std::uint64_t pack(std::uint64_t begin, std::uint64_t end) noexcept
+            {
+                return begin << 32 | end;
+            }
+
+            bool take_own(unsigned slot, std::size_t& chunk) noexcept
+            {
+                std::atomic<std::uint64_t>& range = m_ranges[slot];
+                std::uint64_t current = range.load(std::memory_order_acquire);
+                for (;;)
+                {
+                    const std::uint64_t begin = current >> 32, end = current & 0xFFFFFFFF;
+                    if (begin >= end)
+                    {
+                        return false;
+                    }
+                    if (range.compare_exchange_weak(current, pack(begin + 1, end), std::memory_order_acq_rel))
+                    {
+                        chunk = static_cast<std::size_t>(begin);
+                        return true;
+                    }
+                }
+            }
+
+            // Moves the back half of a victim's range into slot's (now empty) range, and takes the first chunk of it.
+            bool steal(unsigned slot, std::size_t& chunk) noexcept
+            {
+                for (unsigned i = 1; i <= m_slots; i++)
+                {
+                    std::atomic<std::uint64_t>& victim = m_ranges[(slot + i) % m_slots];
+                    std::uint64_t current = victim.load(std::memory_order_acquire);
+                    for (;;)
+                    {
+                        const std::uint64_t begin = current >> 32, end = current & 0xFFFFFFFF;
+                        if (begin >= end)
+                        {
+                            break;
+                        }
+                        const std::uint64_t middle = begin + (end - begin) / 2;
+                        if (victim.compare_exchange_weak(current, pack(begin, middle), std::memory_order_acq_rel))
+                        {
+                            chunk = static_cast<std::size_t>(middle);
+                            if (middle + 1 < end)
+                            {
+                                m_ranges[slot].store(pack(middle + 1, end), std::memory_order_release); // Only this thread takes from an empty range
+                            }
+                            return true;
+                        }
+                    }
+                }
+                return false;
+            }
+
+            void finish_chunk() noexcept
+            {
+                if (m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_done.notify_all();
+                }
+            }
+
+        public:
+
+            std::atomic<unsigned> active{ 0 }; // Pool workers inside participate()
+
+            parallel_job(std::size_t chunks, unsigned slots, std::function<void(std::size_t)> work) :
+                m_work(std::move(work)),
+                m_ranges(new std::atomic<std::uint64_t>[slots]),
+                m_slots(slots),
+                m_unclaimed(chunks),
+                m_remaining(chunks)
+            {
+                // The initial split: slot i gets the i-th share of consecutive chunks
+                for (unsigned i = 0; i < slots; i++)
+                {
+                    m_ranges[i].store(pack(chunks * i / slots, chunks * (i + 1) / slots), std::memory_order_relaxed);
+                }
+            }
+
+            bool has_work() const noexcept
+            {
+                return m_unclaimed.load(std::memory_order_relaxed) > 0 && m_next_slot.load(std::memory_order_relaxed) < m_slots;
+            }
+
+            // Runs chunks until there are none left to take or steal.
+            void participate()
+            {
+                const unsigned slot = m_next_slot.fetch_add(1, std::memory_order_relaxed);
+                if (slot >= m_slots)
+                {
+                    return; // Enough threads already
+                }
+                std::size_t chunk;
+                while (take_own(slot, chunk) || steal(slot, chunk))
+                {
+                    m_unclaimed.fetch_sub(1, std::memory_order_relaxed);
+                    if (!m_failed.load(std::memory_order_relaxed)) // After a failure, the remaining chunks are skipped
+                    {
+#if CPPLAZY_HAS_EXCEPTIONS
+                        try
+                        {
+                            m_work(chunk);
+                        }
+                        catch (...)
+                        {
+                            std::lock_guard<std::mutex> lock(m_mutex);
+                            if (!m_error)
+                            {
+                                m_error = std::current_exception();
+                            }
+                            m_failed.store(true, std::memory_order_relaxed);
+                        }
+#else
+                        m_work(chunk);
+#endif
+                    }
+                    finish_chunk();
+                }
+            }
+
+            void wait()
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_done.wait(lock, [this] { return m_remaining.load(std::memory_order_acquire) == 0; });
+            }
+
+            void rethrow()
+            {
+#if CPPLAZY_HAS_EXCEPTIONS
+                if (m_error)
+                {
+                    std::rethrow_exception(m_error);
+                }
+#endif
+            }
+        };
+
+        // The threads running parallel jobs. Grows as needed up to the most threads a policy asked for, 
+        // and lives (leaked, like the reclaimer) until the process exits.
+        class parallel_pool
+        {
+            std::mutex m_mutex;
+            std::condition_variable m_wake;
+            std::vector<parallel_job*> m_jobs;
+            unsigned m_workers = 0;
+
+            void work()
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                for (;;)
+                {
+                    parallel_job* job = nullptr;
+                    m_wake.wait(lock, [this, &job] {
+                        for (parallel_job* candidate : m_jobs)
+                        {
+                            if (candidate->has_work())
+                            {
+                                job = candidate;
+                                return true;
+                            }
+                        }
+                        return false;
+                    });
+                    job->active.fetch_add(1, std::memory_order_relaxed); // Under the lock, so run() sees it before removing the job
+                    lock.unlock();
+                    job->participate();
+                    job->active.fetch_sub(1, std::memory_order_release);
+                    lock.lock();
+                }
+            }
+
+        public:
+
+            static parallel_pool& instance()
+            {
+                static parallel_pool* pool = new parallel_pool();
+                return *pool;
+            }
+
+            // Runs job on the calling thread and on up to workers pool threads, and returns once every chunk ran.
+            void run(parallel_job& job, unsigned workers)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    for (; m_workers < std::min(workers, 255u); m_workers++)
+                    {
+                        std::thread(&parallel_pool::work, this).detach();
+                    }
+                    m_jobs.push_back(&job);
+                }
+                m_wake.notify_all();
+                job.participate(); // Also makes progress when every pool thread is busy, e.g. with the job that called this one
+                job.wait();
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_jobs.erase(std::find(m_jobs.begin(), m_jobs.end(), &job));
+                }
+                while (job.active.load(std::memory_order_acquire) != 0) // Workers still returning from participate()
+                {
+                    std::this_thread::yield();
+                }
+                job.rethrow();
+            }
+        };
+
+        // How a parallel call splits its source. Chunk boundaries depend only on the size and the grain, never on 
+        // the threads, so results combined in chunk order are the same whatever the scheduling.
+        struct chunk_plan
+        {
+            std::size_t size;
+            std::size_t per_chunk;
+            std::size_t chunks;
+            unsigned slots;
+
+            chunk_plan(const parallel_policy& policy, std::size_t source_size) :
+                size(source_size)
+            {
+                const std::size_t grain = policy.grain ? policy.grain : std::max<std::size_t>(1, (size + 1023) / 1024);
+                per_chunk = std::max<std::size_t>(grain, (size + 0xFFFFFFFE) / 0xFFFFFFFF); // Chunk indexes fit in 32 bits
+                chunks = (size + per_chunk - 1) / per_chunk;
+                const unsigned threads = policy.threads ? policy.threads : std::max(1u, std::thread::hardware_concurrency());
+                slots = static_cast<unsigned>(std::min<std::size_t>(threads, chunks));
+            }
+        };
+
+        // Calls chunk_func(index, slice) for each chunk of source's elements, in parallel.
+        template<typename Source, typename ChunkFunc>
+        void run_chunks(const chunk_plan& plan, const Source& source, ChunkFunc&& chunk_func)
+        {
+            auto work = [&](std::size_t chunk) {
+                const std::size_t begin = chunk * plan.per_chunk;
+                chunk_func(chunk, source.slice(begin, std::min(plan.size, begin + plan.per_chunk)));
+            };
+            if (plan.slots <= 1)
+            {
+                for (std::size_t chunk = 0; chunk < plan.chunks; chunk++)
+                {
+                    work(chunk);
+                }
+                return;
+            }
+            parallel_job job(plan.chunks, plan.slots, work);
+            parallel_pool::instance().run(job, plan.slots - 1);
+        }
+
+        template<typename Source, typename Result, typename Op>
+        Result parallel_reduce(const chunk_plan& plan, const Source& source, Result init, Op& op)
+        {
+            std::vector<std::optional<Result>> partials(plan.chunks); // Per chunk, each written by the thread that ran the chunk
+            run_chunks(plan, source, [&partials, &op](std::size_t chunk, auto slice) {
+                std::optional<Result>& partial = partials[chunk];
+                auto sink = [&partial, &op](auto&& value) {
+                    partial = partial ? op(std::move(*partial), std::forward<decltype(value)>(value)) : Result(std::forward<decltype(value)>(value));
+                    return true;
+                };
+                slice.run(sink);
+            });
+            for (std::optional<Result>& partial : partials)
+            {
+                if (partial)
+                {
+                    init = op(std::move(init), std::move(*partial));
+                }
+            }
+            return init;
+        }
+
+        template<typename Source, typename Result, typename Op, typename Combine>
+        Result parallel_fold(const chunk_plan& plan, const Source& source, Result identity, Op& op, Combine& combine)
+        {
+            std::vector<std::optional<Result>> partials(plan.chunks);
+            run_chunks(plan, source, [&partials, &identity, &op](std::size_t chunk, auto slice) {
+                Result partial = identity;
+                auto sink = [&partial, &op](auto&& value) {
+                    partial = op(std::move(partial), std::forward<decltype(value)>(value));
+                    return true;
+                };
+                slice.run(sink);
+                partials[chunk] = std::move(partial);
+            });
+            Result result = std::move(identity);
+            for (std::optional<Result>& partial : partials)
+            {
+                result = combine(std::move(result), std::move(*partial));
+            }
+            return result;
+        }
+
+        template<typename Source, typename Func>
+        void parallel_for_each(const chunk_plan& plan, const Source& source, Func& func)
+        {
+            run_chunks(plan, source, [&func](std::size_t, auto slice) {
+                auto sink = [&func](auto&& value) {
+                    func(std::forward<decltype(value)>(value));
+                    return true;
+                };
+                slice.run(sink);
+            });
+        }
+
+        template<typename T, typename Source>
+        std::vector<T> parallel_collect(const chunk_plan& plan, const Source& source)
+        {
+            std::vector<std::vector<T>> parts(plan.chunks);
+            run_chunks(plan, source, [&parts](std::size_t chunk, auto slice) {
+                auto sink = [&values = parts[chunk]](auto&& value) {
+                    values.emplace_back(std::forward<decltype(value)>(value));
+                    return true;
+                };
+                slice.run(sink);
+            });
+            std::size_t total = 0;
+            for (const std::vector<T>& part : parts)
+            {
+                total += part.size();
+            }
+            std::vector<T> values;
+            values.reserve(total);
+            for (std::vector<T>& part : parts)
+            {
+                std::move(part.begin(), part.end(), std::back_inserter(values));
+            }
+            return values;
+        }
+    }
+
+    // The same as seq.reduce(init, op).
+    template<typename T, typename Source, typename Result, typename Op>
+    Result reduce(const sequential_policy&, lazy_seq<T, Source> seq, Result init, Op op)
+    {
+        return seq.reduce(std::move(init), std::move(op));
+    }
+
+    // Reduces chunks of the sequence in parallel, each starting from its first element, then folds init and the 
+    // per chunk results in order. With an associative op, the result is the same as seq.reduce(init, op) (up to 
+    // rounding for floating point), and the same from run to run whatever the threads. op is called concurrently, 
+    // and must accept (Result, Result) and (Result, T).
+    //
+    //  double total = cpplazy::reduce(cpplazy::parallel, cpplazy::from(prices).map(tax), 0.0, std::plus<>());
+    //
+    // Pipelines that can't be split (only sources over random access ranges, with map, filter and flat_map stages, can) 
+    // run sequentially. Functions in the pipeline are copied for each chunk.
+    template<typename T, typename Source, typename Result, typename Op>
+    Result reduce(const parallel_policy& policy, lazy_seq<T, Source> seq, Result init, Op op)
+    {
+        if constexpr (detail::is_splittable<Source>::value)
+        {
+            if (seq.source().can_split())
+            {
+                return detail::parallel_reduce(detail::chunk_plan(policy, seq.source().size()), seq.source(), std::move(init), op);
+            }
+        }
+        return seq.reduce(std::move(init), std::move(op));
+    }
+
+    template<typename T, typename Source, typename Result, typename Op, typename Combine>
+    Result reduce(const sequential_policy&, lazy_seq<T, Source> seq, Result identity, Op op, Combine)
+    {
+        return seq.reduce(std::move(identity), std::move(op));
+    }
+
+    // For folds into another type: each chunk starts from a copy of identity and folds its elements with op(Result, T), 
+    // then the per chunk results are folded in order with combine(Result, Result).
+    //
+    //  std::size_t chars = cpplazy::reduce(cpplazy::parallel, cpplazy::from(lines), std::size_t(0), 
+    //      [](std::size_t n, const std::string& line) { return n + line.size(); }, std::plus<>());
+    template<typename T, typename Source, typename Result, typename Op, typename Combine>
+    Result reduce(const parallel_policy& policy, lazy_seq<T, Source> seq, Result identity, Op op, Combine combine)
+    {
+        if constexpr (detail::is_splittable<Source>::value)
+        {
+            if (seq.source().can_split())
+            {
+                return detail::parallel_fold(detail::chunk_plan(policy, seq.source().size()), seq.source(), std::move(identity), op, combine);
+            }
+        }
+        return seq.reduce(std::move(identity), std::move(op));
+    }
+
+    template<typename T, typename Source, typename Func>
+    void for_each(const sequential_policy&, lazy_seq<T, Source> seq, Func func)
+    {
+        seq.for_each(std::move(func));
+    }
+
+    // Calls func for every element, concurrently and in no particular order.
+    template<typename T, typename Source, typename Func>
+    void for_each(const parallel_policy& policy, lazy_seq<T, Source> seq, Func func)
+    {
+        if constexpr (detail::is_splittable<Source>::value)
+        {
+            if (seq.source().can_split())
+            {
+                detail::parallel_for_each(detail::chunk_plan(policy, seq.source().size()), seq.source(), func);
+                return;
+            }
+        }
+        seq.for_each(std::move(func));
+    }
+
+    template<typename T, typename Source>
+    std::vector<T> collect(const sequential_policy&, lazy_seq<T, Source> seq)
+    {
+        return seq.collect();
+    }
+
+    // The elements in sequence order, like seq.collect(): each chunk collects into its own vector, concatenated in order.
+    template<typename T, typename Source>
+    std::vector<T> collect(const parallel_policy& policy, lazy_seq<T, Source> seq)
+    {
+        if constexpr (detail::is_splittable<Source>::value)
+        {
+            if (seq.source().can_split())
+            {
+                return detail::parallel_collect<T>(detail::chunk_plan(policy, seq.source().size()), seq.source());
+            }
+        }
+        return seq.collect();
+    }
+}
@@ -0,0 +1,262 @@
+// Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+// Copyright (c) 2020 Ziv Shahaf <ziv.shahaf@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// persistent_lazy<T>: a lazy object that saves its value to a snapshot file, so the next process loads it instead of computing it.
+
+#include "cpplazy.hpp"
+#include "mapped.hpp"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+namespace cpplazy
+{
+    enum class snapshot_status
+    {
+        none,           // Not initialized yet
+        loaded,         // Loaded from the snapshot file
+        written,        // Computed, and saved to the snapshot file
+        write_failed    // Computed, but the snapshot could not be written
+    };
+
+    namespace detail
+    {
+        // Snapshot file layout: magic, key size, payload size, FNV-1a hash of the payload (native endian 64 bit), key, payload
+        constexpr char snapshot_magic[8] = { 'C', 'P', 'P', 'L', 'Z', 'S', 'N', '1' };
+        constexpr std::size_t snapshot_header_size = sizeof(snapshot_magic) + 3 * sizeof(std::uint64_t);
+
+        inline std::uint64_t fnv1a(std::string_view data) noexcept
+        {
+            std::uint64_t hash = 14695981039346656037ull;
+            for (char c : data)
+            {
+                hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+            }
+            return hash;
+        }
+
+        // Returns the payload if the file is a complete snapshot written for key, or an empty view.
+        inline std::string_view snapshot_payload(std::string_view file, const std::string& key) noexcept
+        {
+            if (file.size() < snapshot_header_size || std::memcmp(file.data(), snapshot_magic, sizeof(snapshot_magic)) != 0)
+            {
+                return {};
+            }
+            std::uint64_t sizes[3]; // key size, payload size, hash
+            std::memcpy(sizes, file.data() + sizeof(snapshot_magic), sizeof(sizes));
+            if (sizes[0] != key.size() || file.size() - snapshot_header_size < key.size() || 
+                file.size() - snapshot_header_size - key.size() != sizes[1] ||
+                file.compare(snapshot_header_size, key.size(), key) != 0)
+            {
+                return {};
+            }
+            const std::string_view payload = file.substr(snapshot_header_size + key.size());
+            return fnv1a(payload) == sizes[2] ? payload : std::string_view();
+        }
+
+        // Writes a temporary file next to path and renames it over path, so readers see either the old snapshot or the new one.
+        // On POSIX the directory is synced too, so the new snapshot survives a crash. On Windows the write is atomic but not durable
+        // (after a crash, the old snapshot may be back).
+        inline bool write_snapshot(const std::string& path, const std::string& key, const std::string& payload)
+        {
+            // Unique per process and per write, several processes (or threads writing the same path) may write at once
+            static std::atomic<std::uint64_t> writes{ 0 };
+            const std::string unique = std::to_string(writes.fetch_add(1, std::memory_order_relaxed));
+#if defined(_WIN32)
+            const std::string temp_path = path + ".tmp" + std::to_string(::_getpid()) + "." + unique;
+#else
+            const std::string temp_path = path + ".tmp" + std::to_string(::getpid()) + "." + unique;
+#endif
+            std::FILE* file = std::fopen(temp_path.c_str(), "wb");
+            if (!file)
+            {
+                return false;
+            }
+            const std::uint64_t sizes[3] = { key.size(), payload.size(), fnv1a(payload) };
+            bool written = std::fwrite(snapshot_magic, 1, sizeof(snapshot_magic), file) == sizeof(snapshot_magic) &&
+                           std::fwrite(sizes, 1, sizeof(sizes), file) == sizeof(sizes) &&
+                           std::fwrite(key.data(), 1, key.size(), file) == key.size() &&
+                           std::fwrite(payload.data(), 1, payload.size(), file) == payload.size() &&
+                           std::fflush(file) == 0;
+#if !defined(_WIN32)
+            written = written && ::fsync(::fileno(file)) == 0; // The rename must not reach the disk before the data
+#endif
+            if (std::fclose(file) != 0 || !written)
+            {
+                std::remove(temp_path.c_str());
+                return false;
+            }
+#if defined(_WIN32)
+            std::remove(path.c_str()); // rename() does not replace existing files on Windows
+#endif
+            if (std::rename(temp_path.c_str(), path.c_str()) != 0)
+            {
+                std::remove(temp_path.c_str());
+                return false;
+            }
+#if !defined(_WIN32)
+            // The rename is in the directory's data. Best effort: the snapshot is already in place if this fails.
+            const std::size_t slash = path.rfind('/');
+            const std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+            const int directory_fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (directory_fd >= 0)
+            {
+                ::fsync(directory_fd);
+                ::close(directory_fd);
+            }
+#endif
+            return true;
+        }
+    }
+
+    // A lazy object for values that are expensive to compute from inputs that rarely change (tokenizer tables, compiled rules...).
+    // On first access, the value is loaded from the snapshot file at path if it was written for the same key 
+    // (e.g. a hash of the inputs and a format version). Otherwise it is computed with initFunc, and the snapshot is (re)written.
+    //
+    //  cpplazy::persistent_lazy<rule_set> rules{ "/var/cache/myapp/rules.snapshot", rules_hash + "-v3", 
+    //      [] { return compile_rules(); }, &save_rules, &load_rules };
+    //
+    // serialize returns the bytes to save. deserialize gets a view of the (memory mapped) snapshot, valid only during the call, 
+    // and returns std::nullopt if it can't use it, in which case the value is computed. Same thread safety as lazy<T>.
+    template<typename T>
+    class persistent_lazy
+    {
+    public:
+
+        using serialize_func = std::function<std::string(const T&)>;
+        using deserialize_func = std::function<std::optional<T>(std::string_view)>;
+
+    private:
+
+        std::shared_ptr<std::atomic<snapshot_status>> m_status; // Shared with the init function, which is moved along with the object
+        lazy<T> m_value;
+
+        static T load_or_compute(const std::string& path, const std::string& key, const std::function<T()>& initFunc, 
+                                 const serialize_func& serialize, const deserialize_func& deserialize, std::atomic<snapshot_status>& status)
+        {
+            std::optional<T> loaded = load(path, key, deserialize);
+            if (loaded)
+            {
+                status.store(snapshot_status::loaded, std::memory_order_release);
+                return std::move(*loaded);
+            }
+
+            T value = initFunc();
+            status.store(save(path, key, value, serialize) ? snapshot_status::written : snapshot_status::write_failed, std::memory_order_release);
+            return value;
+        }
+
+        static std::optional<T> load(const std::string& path, const std::string& key, const deserialize_func& deserialize)
+        {
+            detail::file_mapping file;
+            detail::file_mapping::map(path, map_options(), file); // A missing snapshot leaves the mapping empty
+            const std::string_view payload = detail::snapshot_payload(file.bytes(), key);
+            if (payload.data() == nullptr)
+            {
+                return std::nullopt;
+            }
+#if CPPLAZY_HAS_EXCEPTIONS
+            try
+            {
+                return deserialize(payload);
+            }
+            catch (...)
+            {
+                return std::nullopt; // A snapshot that can't be read is recomputed, like a missing one
+            }
+#else
+            return deserialize(payload);
+#endif
+        }
+
+        static bool save(const std::string& path, const std::string& key, const T& value, const serialize_func& serialize)
+        {
+#if CPPLAZY_HAS_EXCEPTIONS
+            try
+            {
+                return detail::write_snapshot(path, key, serialize(value));
+            }
+            catch (...)
+            {
+                return false; // The value is still good, only the next start will be slow
+            }
+#else
+            return detail::write_snapshot(path, key, serialize(value));
+#endif
+        }
+
+    public:
+
+        persistent_lazy(std::string path, std::string key, std::function<T()> initFunc, serialize_func serialize, deserialize_func deserialize) :
+            m_status(std::make_shared<std::atomic<snapshot_status>>(snapshot_status::none)),
+            m_value([path = std::move(path), key = std::move(key), initFunc = std::move(initFunc), serialize = std::move(serialize), 
+                     deserialize = std::move(deserialize), status = m_status] {
+                return load_or_compute(path, key, initFunc, serialize, deserialize, *status);
+            })
+        {
+        }
+
+        // Where the value came from (none until initialized, or after being moved from).
+        snapshot_status status() const noexcept
+        {
+            return m_status ? m_status->load(std::memory_order_acquire) : snapshot_status::none;
+        }
+
+        bool is_initialized() const noexcept
+        {
+            return m_value.is_initialized();
+        }
+
+        std::optional<T>* operator->()
+        {
+            return m_value.operator->();
+        }
+
+        const std::optional<T>* operator->() const
+        {
+            return m_value.operator->();
+        }
+
+        T& operator*()
+        {
+            return *m_value;
+        }
+
+        const T& operator*() const
+        {
+            return *m_value;
+        }
+    };
+}
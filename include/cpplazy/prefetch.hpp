@@ -0,0 +1,309 @@
+// Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+// Copyright (c) 2020 Ziv Shahaf <ziv.shahaf@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// prefetching(seq, depth, executor): a lazy_seq adaptor that produces up to depth elements ahead, on another thread.
+
+#include "cpplazy.hpp"
+#include "seq.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+
+
+namespace cpplazy
+{
+    // Runs each prefetching producer on a thread of its own.
+    struct thread_executor
+    {
+        void operator()(std::function<void()> task) const
+        {
+            std::thread(std::move(task)).detach(); // The consumer waits for the producer to finish, not for the thread
+        }
+    };
+
+    namespace detail
+    {
+        // A bounded single producer, single consumer queue. Each side only writes its own index.
+        template<typename T>
+        class spsc_ring
+        {
+            std::unique_ptr<std::optional<T>[]> m_slots;
+            std::size_t m_capacity;
+            alignas(64) std::atomic<std::size_t> m_head{ 0 }; // Next to pop, written by the consumer
+            alignas(64) std::atomic<std::size_t> m_tail{ 0 }; // Next to push, written by the producer
+
+        public:
+
+            explicit spsc_ring(std::size_t capacity) :
+                m_slots(new std::optional<T>[capacity]),
+                m_capacity(capacity)
+            {
+            }
+
+            bool try_push(T& value)
+            {
+                const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+                if (tail - m_head.load(std::memory_order_acquire) == m_capacity)
+                {
+                    return false;
+                }
+                m_slots[tail % m_capacity].emplace(std::move(value));
+                m_tail.store(tail + 1, std::memory_order_seq_cst); // seq_cst: see prefetch_state::wait_for
+                return true;
+            }
+
+            std::optional<T> try_pop()
+            {
+                const std::size_t head = m_head.load(std::memory_order_relaxed);
+                if (head == m_tail.load(std::memory_order_seq_cst))
+                {
+                    return std::nullopt;
+                }
+                std::optional<T>& slot = m_slots[head % m_capacity];
+                std::optional<T> value = std::move(slot);
+                slot.reset();
+                m_head.store(head + 1, std::memory_order_seq_cst);
+                return value;
+            }
+
+            bool empty() const noexcept
+            {
+                return m_head.load(std::memory_order_seq_cst) == m_tail.load(std::memory_order_seq_cst);
+            }
+
+            bool full() const noexcept
+            {
+                return m_tail.load(std::memory_order_seq_cst) - m_head.load(std::memory_order_seq_cst) == m_capacity;
+            }
+        };
+
+        // Shared by the consumer and the producer task, which may outlive the consumer by a few instructions.
+        template<typename Source>
+        struct prefetch_state
+        {
+            using value_type = typename Source::value_type;
+
+            std::optional<Source> source; // Destroyed by the producer when it is done
+            spsc_ring<value_type> ring;
+            std::atomic<bool> cancelled{ false };
+            std::atomic<bool> finished{ false };
+            std::atomic<bool> producer_waiting{ false };
+            std::atomic<bool> consumer_waiting{ false };
+            std::mutex mutex;
+            std::condition_variable wake;
+#if CPPLAZY_HAS_EXCEPTIONS
+            std::exception_ptr error;
+#endif
+
+            prefetch_state(Source&& s, std::size_t depth) :
+                source(std::move(s)),
+                ring(depth)
+            {
+            }
+
+            // Sleeps until ready() (the ring and flags are lock free, the mutex is only taken to sleep and to wake up). 
+            // The sleeper sets its flag before checking ready(), the other side changes the ring before checking the flag, 
+            // all seq_cst, so one of them always sees the other.
+            template<typename Ready>
+            void wait_for(std::atomic<bool>& waiting, Ready ready)
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                waiting.store(true, std::memory_order_seq_cst);
+                wake.wait(lock, ready);
+                waiting.store(false, std::memory_order_relaxed);
+            }
+
+            void notify(std::atomic<bool>& waiting)
+            {
+                if (waiting.load(std::memory_order_seq_cst))
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    wake.notify_all();
+                }
+            }
+
+            void produce()
+            {
+#if CPPLAZY_HAS_EXCEPTIONS
+                try
+                {
+                    produce_elements();
+                }
+                catch (...)
+                {
+                    error = std::current_exception(); // Published by finished
+                }
+#else
+                produce_elements();
+#endif
+                source.reset();
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    finished.store(true, std::memory_order_seq_cst);
+                    wake.notify_all();
+                }
+            }
+
+        private:
+
+            void produce_elements()
+            {
+                while (!cancelled.load(std::memory_order_relaxed))
+                {
+                    std::optional<value_type> value = source->next();
+                    if (!value)
+                    {
+                        return;
+                    }
+                    while (!ring.try_push(*value))
+                    {
+                        // Backpressure: the consumer is depth elements behind
+                        wait_for(producer_waiting, [this] { return cancelled.load(std::memory_order_seq_cst) || !ring.full(); });
+                        if (cancelled.load(std::memory_order_relaxed))
+                        {
+                            return;
+                        }
+                    }
+                    notify(consumer_waiting);
+                }
+            }
+        };
+
+        template<typename Source, typename Executor>
+        class prefetch_source
+        {
+            std::shared_ptr<prefetch_state<Source>> m_state;
+            Executor m_executor;
+            bool m_started = false;
+
+            // Started only once the executor accepted the task: if it throws, there is no producer to wait for.
+            void start()
+            {
+                std::shared_ptr<prefetch_state<Source>> state = m_state;
+                m_executor([state] { state->produce(); });
+                m_started = true;
+            }
+
+        public:
+
+            using value_type = typename Source::value_type;
+
+            prefetch_source(Source&& source, std::size_t depth, Executor executor) :
+                m_state(std::make_shared<prefetch_state<Source>>(std::move(source), depth ? depth : 1)),
+                m_executor(std::move(executor))
+            {
+            }
+
+            prefetch_source(prefetch_source&& other) noexcept :
+                m_state(std::move(other.m_state)),
+                m_executor(std::move(other.m_executor)),
+                m_started(other.m_started)
+            {
+                other.m_started = false;
+            }
+
+            prefetch_source& operator=(prefetch_source&&) = delete;
+
+            // Stops the producer, and waits until it is done with the source (after the element it is producing, if any).
+            ~prefetch_source()
+            {
+                if (m_started)
+                {
+                    m_state->cancelled.store(true, std::memory_order_seq_cst);
+                    std::unique_lock<std::mutex> lock(m_state->mutex);
+                    m_state->wake.notify_all();
+                    m_state->wake.wait(lock, [this] { return m_state->finished.load(std::memory_order_seq_cst); });
+                }
+            }
+
+            std::optional<value_type> next()
+            {
+                if (!m_started)
+                {
+                    start();
+                }
+                for (;;)
+                {
+                    if (std::optional<value_type> value = m_state->ring.try_pop())
+                    {
+                        m_state->notify(m_state->producer_waiting);
+                        return value;
+                    }
+                    if (m_state->finished.load(std::memory_order_seq_cst))
+                    {
+                        if (std::optional<value_type> value = m_state->ring.try_pop()) // Pushed just before finishing
+                        {
+                            return value;
+                        }
+#if CPPLAZY_HAS_EXCEPTIONS
+                        if (m_state->error)
+                        {
+                            std::rethrow_exception(std::exchange(m_state->error, nullptr));
+                        }
+#endif
+                        return std::nullopt;
+                    }
+                    m_state->wait_for(m_state->consumer_waiting, [this] { return !m_state->ring.empty() || m_state->finished.load(std::memory_order_seq_cst); });
+                }
+            }
+
+            template<typename Sink>
+            bool run(Sink& sink)
+            {
+                while (auto value = next())
+                {
+                    if (!sink(std::move(*value)))
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            }
+        };
+    }
+
+    // Produces the elements of seq on another thread (started by executor, on first use), up to depth elements ahead 
+    // of the consumer, so producing (I/O, decoding) overlaps with consuming. When the consumer is depth elements behind, 
+    // the producer waits. Destroying the sequence (e.g. after stopping early) stops the producer, and waits for it 
+    // to finish the element in progress, so seq may reference data owned by the caller.
+    //
+    //  for (const image& img : cpplazy::prefetching(cpplazy::from(paths).map(decode_image), 8)) ...
+    //
+    // executor is called once with a std::function<void()> to run (thread_executor by default). It must run it 
+    // asynchronously: running it inline deadlocks as soon as the ring is full, since nothing consumes yet. If it 
+    // throws, the exception reaches the consumer and the next access calls it again. Exceptions thrown by seq are 
+    // rethrown to the consumer after the elements produced before.
+    template<typename T, typename Source, typename Executor = thread_executor>
+    auto prefetching(lazy_seq<T, Source> seq, std::size_t depth = 16, Executor executor = {})
+    {
+        using source = detail::prefetch_source<Source, Executor>;
+        return lazy_seq<T, source>(source(std::move(seq.source()), depth, std::move(executor)));
+    }
+}
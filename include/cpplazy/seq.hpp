@@ -0,0 +1,1052 @@
+// Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+// Copyright (c) 2020 Ziv Shahaf <ziv.shahaf@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// lazy_seq<T>: a lazily evaluated sequence whose combinators (map, filter, take_while, flat_map, zip, chunk) 
+// fuse into a single loop, without intermediate containers.
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+namespace cpplazy
+{
+    template<typename T, typename Source>
+    class lazy_seq;
+
+    namespace detail
+    {
+        // A source (or stage) of a sequence has:
+        //  using value_type = ...;
+        //  std::optional<value_type> next();   Pulls the next element, nullopt when exhausted.
+        //  template<typename Sink> bool run(Sink& sink);   Pushes the remaining elements into sink(value), which returns 
+        //      false to stop. Returns false if the sink stopped it. One inlined loop for the whole pipeline, so the 
+        //      compiler can vectorize it, where next() runs every stage once per element.
+        // Sources over random access ranges, and the element wise stages on top of them, can also be split (see parallel.hpp):
+        //  std::size_t size() const;   How many source elements are left.
+        //  auto slice(std::size_t begin, std::size_t end) const;   A copy of the pipeline over elements [begin, end) of those.
+        //  bool can_split() const;   False when the pipeline can't be split right now: it is endless, or holds elements 
+        //      the slices would leave out (the rest of a flat_map inner sequence).
+
+        template<typename Iterator>
+        using is_random_access = std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<Iterator>::iterator_category>;
+
+        // A type erased source, so lazy_seq<T> can be stored in members or returned from non template functions.
+        template<typename T>
+        class any_source
+        {
+            struct base
+            {
+                virtual ~base() = default;
+                virtual std::optional<T> next() = 0;
+            };
+
+            template<typename Source>
+            struct holder : base
+            {
+                Source source;
+
+                explicit holder(Source&& s) :
+                    source(std::move(s))
+                {
+                }
+
+                std::optional<T> next() override
+                {
+                    if (auto value = source.next())
+                    {
+                        return std::optional<T>(std::move(*value));
+                    }
+                    return std::nullopt;
+                }
+            };
+
+            std::unique_ptr<base> m_source;
+
+        public:
+
+            using value_type = T;
+
+            any_source() = default;
+
+            template<typename Source, typename = std::enable_if_t<!std::is_same<std::decay_t<Source>, any_source>::value>>
+            explicit any_source(Source&& source) :
+                m_source(new holder<std::decay_t<Source>>(std::forward<Source>(source)))
+            {
+            }
+
+            std::optional<T> next()
+            {
+                return m_source ? m_source->next() : std::nullopt;
+            }
+
+            template<typename Sink>
+            bool run(Sink& sink)
+            {
+                while (auto value = next())
+                {
+                    if (!sink(std::move(*value)))
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            }
+        };
+
+        template<typename Iterator>
+        class iterator_source
+        {
+            Iterator m_current;
+            Iterator m_end;
+
+        public:
+
+            using value_type = std::decay_t<decltype(*std::declval<Iterator>())>;
+
+            iterator_source(Iterator begin, Iterator end) :
+                m_current(begin),
+                m_end(end)
+            {
+            }
+
+            std::optional<value_type> next()
+            {
+                if (m_current == m_end)
+                {
+                    return std::nullopt;
+                }
+                return *m_current++;
+            }
+
+            template<typename Sink>
+            bool run(Sink& sink)
+            {
+                for (; m_current != m_end; ++m_current)
+                {
+                    if (!sink(*m_current))
+                    {
+                        ++m_current;
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            template<typename I = Iterator, typename = std::enable_if_t<is_random_access<I>::value>>
+            std::size_t size() const
+            {
+                return static_cast<std::size_t>(m_end - m_current);
+            }
+
+            template<typename I = Iterator, typename = std::enable_if_t<is_random_access<I>::value>>
+            iterator_source slice(std::size_t begin, std::size_t end) const
+            {
+                return iterator_source(m_current + begin, m_current + end);
+            }
+
+            bool can_split() const
+            {
+                return true;
+            }
+        };
+
+        // Owns a container, e.g. the result of a flat_map function.
+        template<typename Container, bool RandomAccess = is_random_access<decltype(std::begin(std::declval<Container&>()))>::value>
+        class container_source
+        {
+            Container m_container;
+            std::size_t m_index = 0; // Not an iterator, which moving the container (e.g. a std::array) would invalidate
+
+        public:
+
+            using value_type = std::decay_t<decltype(*std::begin(std::declval<Container&>()))>;
+
+            explicit container_source(Container&& container) :
+                m_container(std::move(container))
+            {
+            }
+
+            std::optional<value_type> next()
+            {
+                if (m_index == std::size(m_container))
+                {
+                    return std::nullopt;
+                }
+                return std::move(std::begin(m_container)[m_index++]);
+            }
+
+            template<typename Sink>
+            bool run(Sink& sink)
+            {
+                const std::size_t size = std::size(m_container);
+                for (; m_index < size; m_index++)
+                {
+                    if (!sink(std::move(std::begin(m_container)[m_index])))
+                    {
+                        m_index++;
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            std::size_t size() const
+            {
+                return std::size(m_container) - m_index;
+            }
+
+            // Reads the elements in place (copying them), the container stays with this source.
+            auto slice(std::size_t begin, std::size_t end) const
+            {
+                const auto first = std::begin(m_container) + m_index;
+                return iterator_source<decltype(first)>(first + begin, first + end);
+            }
+
+            bool can_split() const
+            {
+                return true;
+            }
+        };
+
+        // Other containers (e.g. std::list) are kept on the heap, so their iterators survive moving the source.
+        template<typename Container>
+        class container_source<Container, false>
+        {
+            using iterator = decltype(std::begin(std::declval<Container&>()));
+
+            std::unique_ptr<Container> m_container;
+            iterator m_current;
+            iterator m_end;
+
+        public:
+
+            using value_type = std::decay_t<decltype(*std::declval<iterator>())>;
+
+            explicit container_source(Container&& container) :
+                m_container(new Container(std::move(container))),
+                m_current(std::begin(*m_container)),
+                m_end(std::end(*m_container))
+            {
+            }
+
+            std::optional<value_type> next()
+            {
+                if (m_current == m_end)
+                {
+                    return std::nullopt;
+                }
+                return std::move(*m_current++);
+            }
+
+            template<typename Sink>
+            bool run(Sink& sink)
+            {
+                for (; m_current != m_end; ++m_current)
+                {
+                    if (!sink(std::move(*m_current)))
+                    {
+                        ++m_current;
+                        return false;
+                    }
+                }
+                return true;
+            }
+        };
+
+        template<typename Integer>
+        class range_source
+        {
+            Integer m_current;
+            Integer m_end;
+            bool m_bounded;
+
+        public:
+
+            using value_type = Integer;
+
+            range_source(Integer first, Integer last, bool bounded) :
+                m_current(first),
+                m_end(last),
+                m_bounded(bounded)
+            {
+            }
+
+            std::optional<Integer> next()
+            {
+                if (m_bounded && m_current >= m_end)
+                {
+                    return std::nullopt;
+                }
+                return m_current++;
+            }
+
+            template<typename Sink>
+            bool run(Sink& sink)
+            {
+                if (m_bounded)
+                {
+                    for (; m_current < m_end; ++m_current)
+                    {
+                        if (!sink(Integer(m_current)))
+                        {
+                            ++m_current;
+                            return false;
+                        }
+                    }
+                    return true;
+                }
+                for (;; ++m_current)
+                {
+                    if (!sink(Integer(m_current)))
+                    {
+                        ++m_current;
+                        return false;
+                    }
+                }
+            }
+
+            // SIZE_MAX without end. The difference is taken unsigned: range(INT_MIN, INT_MAX) overflows an int.
+            std::size_t size() const
+            {
+                using unsigned_type = std::make_unsigned_t<Integer>;
+                return !m_bounded ? SIZE_MAX : m_current < m_end ? static_cast<std::size_t>(static_cast<unsigned_type>(m_end) - static_cast<unsigned_type>(m_current)) : 0;
+            }
+
+            range_source slice(std::size_t begin, std::size_t end) const
+            {
+                using unsigned_type = std::make_unsigned_t<Integer>;
+                const unsigned_type first = static_cast<unsigned_type>(m_current);
+                return range_source(static_cast<Integer>(first + static_cast<unsigned_type>(begin)), static_cast<Integer>(first + static_cast<unsigned_type>(end)), true);
+            }
+
+            bool can_split() const
+            {
+                return m_bounded;
+            }
+        };
+
+        template<typename Func>
+        class generate_source
+        {
+            Func m_func;
+            bool m_done = false;
+
+        public:
+
+            using value_type = typename std::invoke_result_t<Func&>::value_type;
+
+            explicit generate_source(Func func) :
+                m_func(std::move(func))
+            {
+            }
+
+            std::optional<value_type> next()
+            {
+                if (m_done)
+                {
+                    return std::nullopt;
+                }
+                std::optional<value_type> value = m_func();
+                m_done = !value;
+                return value;
+            }
+
+            template<typename Sink>
+            bool run(Sink& sink)
+            {
+                while (auto value = next())
+                {
+                    if (!sink(std::move(*value)))
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            }
+        };
+
+        template<typename Upstream, typename Func>
+        class map_stage
+        {
+            Upstream m_upstream;
+            Func m_func;
+
+        public:
+
+            using value_type = std::decay_t<std::invoke_result_t<Func&, typename Upstream::value_type>>;
+
+            map_stage(Upstream upstream, Func func) :
+                m_upstream(std::move(upstream)),
+                m_func(std::move(func))
+            {
+            }
+
+            std::optional<value_type> next()
+            {
+                if (auto value = m_upstream.next())
+                {
+                    return m_func(std::move(*value));
+                }
+                return std::nullopt;
+            }
+
+            template<typename Sink>
+            bool run(Sink& sink)
+            {
+                auto fused = [this, &sink](auto&& value) { return sink(m_func(std::forward<decltype(value)>(value))); };
+                return m_upstream.run(fused);
+            }
+
+            template<typename U = Upstream>
+            auto size() const -> decltype(std::declval<const U&>().size())
+            {
+                return m_upstream.size();
+            }
+
+            template<typename U = Upstream, typename F = Func, typename = std::enable_if_t<std::is_copy_constructible<F>::value>>
+            auto slice(std::size_t begin, std::size_t end) const -> map_stage<decltype(std::declval<const U&>().slice(0, 0)), Func>
+            {
+                return { m_upstream.slice(begin, end), m_func };
+            }
+
+            template<typename U = Upstream>
+            auto can_split() const -> decltype(std::declval<const U&>().can_split())
+            {
+                return m_upstream.can_split();
+            }
+        };
+
+        template<typename Upstream, typename Predicate>
+        class filter_stage
+        {
+            Upstream m_upstream;
+            Predicate m_predicate;
+
+        public:
+
+            using value_type = typename Upstream::value_type;
+
+            filter_stage(Upstream upstream, Predicate predicate) :
+                m_upstream(std::move(upstream)),
+                m_predicate(std::move(predicate))
+            {
+            }
+
+            std::optional<value_type> next()
+            {
+                while (auto value = m_upstream.next())
+                {
+                    if (m_predicate(static_cast<const value_type&>(*value)))
+                    {
+                        return value;
+                    }
+                }
+                return std::nullopt;
+            }
+
+            template<typename Sink>
+            bool run(Sink& sink)
+            {
+                auto fused = [this, &sink](auto&& value) { return !m_predicate(static_cast<const value_type&>(value)) || sink(std::forward<decltype(value)>(value)); };
+                return m_upstream.run(fused);
+            }
+
+            template<typename U = Upstream>
+            auto size() const -> decltype(std::declval<const U&>().size())
+            {
+                return m_upstream.size();
+            }
+
+            template<typename U = Upstream, typename P = Predicate, typename = std::enable_if_t<std::is_copy_constructible<P>::value>>
+            auto slice(std::size_t begin, std::size_t end) const -> filter_stage<decltype(std::declval<const U&>().slice(0, 0)), Predicate>
+            {
+                return { m_upstream.slice(begin, end), m_predicate };
+            }
+
+            template<typename U = Upstream>
+            auto can_split() const -> decltype(std::declval<const U&>().can_split())
+            {
+                return m_upstream.can_split();
+            }
+        };
+
+        template<typename Upstream>
+        class take_stage
+        {
+            Upstream m_upstream;
+            std::size_t m_remaining;
+
+        public:
+
+            using value_type = typename Upstream::value_type;
+
+            take_stage(Upstream upstream, std::size_t count) :
+                m_upstream(std::move(upstream)),
+                m_remaining(count)
+            {
+            }
+
+            std::optional<value_type> next()
+            {
+                if (m_remaining == 0)
+                {
+                    return std::nullopt;
+                }
+                m_remaining--;
+                return m_upstream.next();
+            }
+
+            template<typename Sink>
+            bool run(Sink& sink)
+            {
+                if (m_remaining == 0)
+                {
+                    return true;
+                }
+                bool stopped = false;
+                auto fused = [this, &sink, &stopped](auto&& value) {
+                    m_remaining--;
+                    stopped = !sink(std::forward<decltype(value)>(value));
+                    return !stopped && m_remaining > 0; // Stops the upstream without pulling one element too many
+                };
+                m_upstream.run(fused);
+                return !stopped;
+            }
+        };
+
+        template<typename Upstream, typename Predicate>
+        class take_while_stage
+        {
+            Upstream m_upstream;
+            Predicate m_predicate;
+            bool m_done = false;
+
+        public:
+
+            using value_type = typename Upstream::value_type;
+
+            take_while_stage(Upstream upstream, Predicate predicate) :
+                m_upstream(std::move(upstream)),
+                m_predicate(std::move(predicate))
+            {
+            }
+
+            std::optional<value_type> next()
+            {
+                if (m_done)
+                {
+                    return std::nullopt;
+                }
+                auto value = m_upstream.next();
+                if (!value || !m_predicate(static_cast<const value_type&>(*value)))
+                {
+                    m_done = true;
+                    return std::nullopt;
+                }
+                return value;
+            }
+
+            template<typename Sink>
+            bool run(Sink& sink)
+            {
+                if (m_done)
+                {
+                    return true;
+                }
+                bool stopped = false;
+                auto fused = [this, &sink, &stopped](auto&& value) {
+                    if (!m_predicate(static_cast<const value_type&>(value)))
+                    {
+                        m_done = true;
+                        return false;
+                    }
+                    stopped = !sink(std::forward<decltype(value)>(value));
+                    return !stopped;
+                };
+                m_upstream.run(fused);
+                m_done = m_done || !stopped;
+                return !stopped;
+            }
+        };
+
+        template<typename T>
+        struct is_lazy_seq : std::false_type
+        {
+        };
+
+        template<typename T, typename Source>
+        struct is_lazy_seq<lazy_seq<T, Source>> : std::true_type
+        {
+        };
+
+        // The source of what a flat_map function returned: a lazy_seq, or a container it now owns.
+        template<typename Result>
+        auto inner_source(Result&& result)
+        {
+            if constexpr (is_lazy_seq<std::decay_t<Result>>::value)
+            {
+                return std::move(result.source());
+            }
+            else
+            {
+                return container_source<std::decay_t<Result>>(std::forward<Result>(result));
+            }
+        }
+
+        template<typename Upstream, typename Func>
+        class flat_map_stage
+        {
+            using inner_type = decltype(inner_source(std::declval<std::invoke_result_t<Func&, typename Upstream::value_type>>()));
+
+            Upstream m_upstream;
+            Func m_func;
+            std::optional<inner_type> m_inner;
+
+        public:
+
+            using value_type = typename inner_type::value_type;
+
+            flat_map_stage(Upstream upstream, Func func) :
+                m_upstream(std::move(upstream)),
+                m_func(std::move(func))
+            {
+            }
+
+            std::optional<value_type> next()
+            {
+                for (;;)
+                {
+                    if (m_inner)
+                    {
+                        if (auto value = m_inner->next())
+                        {
+                            return value;
+                        }
+                        m_inner.reset();
+                    }
+                    auto outer = m_upstream.next();
+                    if (!outer)
+                    {
+                        return std::nullopt;
+                    }
+                    m_inner.emplace(inner_source(m_func(std::move(*outer))));
+                }
+            }
+
+            template<typename Sink>
+            bool run(Sink& sink)
+            {
+                if (m_inner && !m_inner->run(sink))
+                {
+                    return false;
+                }
+                m_inner.reset();
+                bool stopped = false;
+                auto fused = [this, &sink, &stopped](auto&& value) {
+                    inner_type inner = inner_source(m_func(std::forward<decltype(value)>(value)));
+                    if (!inner.run(sink))
+                    {
+                        m_inner.emplace(std::move(inner)); // Whatever the sink did not take yet
+                        stopped = true;
+                    }
+                    return !stopped;
+                };
+                m_upstream.run(fused);
+                return !stopped;
+            }
+
+            // Only the outer elements are split, so not while an inner sequence is partially consumed.
+            template<typename U = Upstream>
+            auto size() const -> decltype(std::declval<const U&>().size())
+            {
+                return m_upstream.size();
+            }
+
+            template<typename U = Upstream, typename F = Func, typename = std::enable_if_t<std::is_copy_constructible<F>::value>>
+            auto slice(std::size_t begin, std::size_t end) const -> flat_map_stage<decltype(std::declval<const U&>().slice(0, 0)), Func>
+            {
+                return { m_upstream.slice(begin, end), m_func };
+            }
+
+            template<typename U = Upstream>
+            auto can_split() const -> decltype(std::declval<const U&>().can_split())
+            {
+                return !m_inner && m_upstream.can_split();
+            }
+        };
+
+        // Pull only, the two sides can't both push.
+        template<typename First, typename Second>
+        class zip_stage
+        {
+            First m_first;
+            Second m_second;
+
+        public:
+
+            using value_type = std::pair<typename First::value_type, typename Second::value_type>;
+
+            zip_stage(First first, Second second) :
+                m_first(std::move(first)),
+                m_second(std::move(second))
+            {
+            }
+
+            std::optional<value_type> next()
+            {
+                auto a = m_first.next();
+                if (!a)
+                {
+                    return std::nullopt;
+                }
+                auto b = m_second.next();
+                if (!b)
+                {
+                    return std::nullopt;
+                }
+                return value_type(std::move(*a), std::move(*b));
+            }
+
+            template<typename Sink>
+            bool run(Sink& sink)
+            {
+                bool stopped = false;
+                auto fused = [this, &sink, &stopped](auto&& a) {
+                    auto b = m_second.next();
+                    if (!b)
+                    {
+                        return false; // The second side ran out, which is not the sink stopping
+                    }
+                    stopped = !sink(value_type(std::forward<decltype(a)>(a), std::move(*b)));
+                    return !stopped;
+                };
+                m_first.run(fused);
+                return !stopped;
+            }
+        };
+
+        template<typename Upstream>
+        class chunk_stage
+        {
+            Upstream m_upstream;
+            std::size_t m_size;
+
+        public:
+
+            using value_type = std::vector<typename Upstream::value_type>;
+
+            chunk_stage(Upstream upstream, std::size_t size) :
+                m_upstream(std::move(upstream)),
+                m_size(size ? size : 1)
+            {
+            }
+
+            std::optional<value_type> next()
+            {
+                value_type chunk;
+                chunk.reserve(m_size);
+                while (chunk.size() < m_size)
+                {
+                    auto value = m_upstream.next();
+                    if (!value)
+                    {
+                        break;
+                    }
+                    chunk.push_back(std::move(*value));
+                }
+                return chunk.empty() ? std::nullopt : std::optional<value_type>(std::move(chunk));
+            }
+
+            template<typename Sink>
+            bool run(Sink& sink)
+            {
+                value_type chunk;
+                chunk.reserve(m_size);
+                bool stopped = false;
+                auto fused = [this, &sink, &chunk, &stopped](auto&& value) {
+                    chunk.push_back(std::forward<decltype(value)>(value));
+                    if (chunk.size() == m_size)
+                    {
+                        stopped = !sink(std::move(chunk));
+                        chunk = value_type();
+                        chunk.reserve(m_size);
+                    }
+                    return !stopped;
+                };
+                m_upstream.run(fused);
+                return stopped ? false : chunk.empty() || sink(std::move(chunk));
+            }
+        };
+    }
+
+    // A lazily evaluated, single pass sequence of T. Nothing runs until it is iterated (with a range for loop, 
+    // next(), or for_each(), collect(), reduce()), and every element goes through the whole pipeline before the next one.
+    //
+    //  auto squares = cpplazy::range(0, 1'000'000).filter([](int i) { return i % 3 == 0; }).map([](int i) { return i * i; });
+    //  long long sum = squares.reduce(0LL, [](long long a, int b) { return a + b; }); //One loop, no temporary vectors
+    //
+    // Combinators return a new lazy_seq whose type records the whole pipeline, so it fuses into one loop. 
+    // lazy_seq<T> (with the default Source) holds any pipeline of T behind a virtual call per element, to store it or return it 
+    // from a function. Sequences are consumed by iteration, and are move only if any function in them is.
+    template<typename T, typename Source = detail::any_source<T>>
+    class lazy_seq
+    {
+        template<typename, typename>
+        friend class lazy_seq;
+
+        Source m_source;
+
+        template<typename Stage>
+        static lazy_seq<typename Stage::value_type, Stage> wrap(Stage&& stage)
+        {
+            return lazy_seq<typename Stage::value_type, Stage>(std::move(stage));
+        }
+
+    public:
+
+        using value_type = T;
+        using source_type = Source;
+
+        explicit lazy_seq(Source source) :
+            m_source(std::move(source))
+        {
+        }
+
+        // Erases the pipeline's type (lazy_seq<T> only).
+        template<typename U, typename OtherSource, typename S = Source, typename = std::enable_if_t<std::is_same<S, detail::any_source<T>>::value && !std::is_same<OtherSource, S>::value>>
+        lazy_seq(lazy_seq<U, OtherSource>&& other) :
+            m_source(std::move(other.m_source))
+        {
+        }
+
+        // The pipeline itself, for adaptors built on top of lazy_seq.
+        Source& source() noexcept
+        {
+            return m_source;
+        }
+
+        std::optional<T> next()
+        {
+            return m_source.next();
+        }
+
+        template<typename Func>
+        auto map(Func func) &&
+        {
+            return wrap(detail::map_stage<Source, Func>(std::move(m_source), std::move(func)));
+        }
+
+        template<typename Predicate>
+        auto filter(Predicate predicate) &&
+        {
+            return wrap(detail::filter_stage<Source, Predicate>(std::move(m_source), std::move(predicate)));
+        }
+
+        auto take(std::size_t count) &&
+        {
+            return wrap(detail::take_stage<Source>(std::move(m_source), count));
+        }
+
+        template<typename Predicate>
+        auto take_while(Predicate predicate) &&
+        {
+            return wrap(detail::take_while_stage<Source, Predicate>(std::move(m_source), std::move(predicate)));
+        }
+
+        // func returns a lazy_seq, or a container, whose elements replace the element.
+        template<typename Func>
+        auto flat_map(Func func) &&
+        {
+            return wrap(detail::flat_map_stage<Source, Func>(std::move(m_source), std::move(func)));
+        }
+
+        // Pairs of elements of both sequences, as long as the shorter one.
+        template<typename U, typename OtherSource>
+        auto zip(lazy_seq<U, OtherSource> other) &&
+        {
+            return wrap(detail::zip_stage<Source, OtherSource>(std::move(m_source), std::move(other.m_source)));
+        }
+
+        // std::vectors of size elements (the last one may be shorter).
+        auto chunk(std::size_t size) &&
+        {
+            return wrap(detail::chunk_stage<Source>(std::move(m_source), size));
+        }
+
+        template<typename Func>
+        void for_each(Func func)
+        {
+            auto sink = [&func](auto&& value) {
+                func(std::forward<decltype(value)>(value));
+                return true;
+            };
+            m_source.run(sink);
+        }
+
+        template<typename Result, typename Op>
+        Result reduce(Result init, Op op)
+        {
+            auto sink = [&init, &op](auto&& value) {
+                init = op(std::move(init), std::forward<decltype(value)>(value));
+                return true;
+            };
+            m_source.run(sink);
+            return init;
+        }
+
+        std::vector<T> collect()
+        {
+            std::vector<T> values;
+            auto sink = [&values](auto&& value) {
+                values.emplace_back(std::forward<decltype(value)>(value));
+                return true;
+            };
+            m_source.run(sink);
+            return values;
+        }
+
+        std::size_t count()
+        {
+            std::size_t n = 0;
+            auto sink = [&n](auto&&) {
+                n++;
+                return true;
+            };
+            m_source.run(sink);
+            return n;
+        }
+
+        // An input iterator: incrementing it pulls the next element.
+        class iterator
+        {
+            lazy_seq* m_seq = nullptr;
+            std::optional<T> m_current;
+
+        public:
+
+            using iterator_category = std::input_iterator_tag;
+            using value_type = T;
+            using difference_type = std::ptrdiff_t;
+            using pointer = T*;
+            using reference = T&;
+
+            iterator() = default;
+
+            explicit iterator(lazy_seq* seq) :
+                m_seq(seq),
+                m_current(seq->next())
+            {
+            }
+
+            T& operator*() noexcept
+            {
+                return *m_current;
+            }
+
+            T* operator->() noexcept
+            {
+                return &*m_current;
+            }
+
+            iterator& operator++()
+            {
+                m_current = m_seq->next();
+                return *this;
+            }
+
+            // Ends are all equal
+            bool operator==(const iterator& other) const noexcept
+            {
+                return !m_current && !other.m_current;
+            }
+
+            bool operator!=(const iterator& other) const noexcept
+            {
+                return !(*this == other);
+            }
+        };
+
+        iterator begin()
+        {
+            return iterator(this);
+        }
+
+        iterator end() noexcept
+        {
+            return iterator();
+        }
+    };
+
+    // The elements of [begin, end), which must outlive the sequence.
+    template<typename Iterator>
+    auto from(Iterator begin, Iterator end)
+    {
+        using source = detail::iterator_source<Iterator>;
+        return lazy_seq<typename source::value_type, source>(source(begin, end));
+    }
+
+    // The elements of container, which must outlive the sequence.
+    template<typename Container>
+    auto from(const Container& container)
+    {
+        return from(std::begin(container), std::end(container));
+    }
+
+    // The elements of a temporary container, which the sequence takes over (and moves the elements out of).
+    template<typename Container, typename = std::enable_if_t<!std::is_lvalue_reference<Container>::value>>
+    auto from(Container&& container)
+    {
+        using source = detail::container_source<Container>;
+        return lazy_seq<typename source::value_type, source>(source(std::move(container)));
+    }
+
+    // first, first + 1, ... up to (not including) last.
+    template<typename Integer>
+    auto range(Integer first, Integer last)
+    {
+        static_assert(std::is_integral<Integer>::value, "range() is for integers");
+        return lazy_seq<Integer, detail::range_source<Integer>>(detail::range_source<Integer>(first, last, true));
+    }
+
+    // first, first + 1, ... without end.
+    template<typename Integer>
+    auto iota(Integer first)
+    {
+        static_assert(std::is_integral<Integer>::value, "iota() is for integers");
+        return lazy_seq<Integer, detail::range_source<Integer>>(detail::range_source<Integer>(first, first, false));
+    }
+
+    // Calls func() for each element, until it returns an empty std::optional.
+    template<typename Func>
+    auto generate(Func func)
+    {
+        using source = detail::generate_source<Func>;
+        return lazy_seq<typename source::value_type, source>(source(std::move(func)));
+    }
+}
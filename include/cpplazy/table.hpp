@@ -0,0 +1,587 @@
+// Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+// Copyright (c) 2020 Ziv Shahaf <ziv.shahaf@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// lazy_table: a columnar table (from a file or a buffer) whose columns are each decoded on first access, 
+// and can be released again under memory pressure.
+
+#include "cpplazy.hpp"
+#include "decoded.hpp"
+#include "mapped.hpp"
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+
+namespace cpplazy
+{
+    enum class column_type : std::uint8_t
+    {
+        int64 = 0,
+        float64 = 1,
+        string = 2
+    };
+
+    enum class column_encoding : std::uint8_t
+    {
+        plain = 0,      // Little endian values, or length prefixed strings
+        delta = 1,      // int64 only: zigzag varints of the differences between consecutive values
+        dictionary = 2  // string only: the distinct values once, then a varint index per row
+    };
+
+    namespace detail
+    {
+        constexpr char table_magic[8] = { 'C', 'P', 'P', 'L', 'Z', 'T', 'B', '1' };
+
+        inline void write_varint(std::string& out, std::uint64_t value)
+        {
+            for (; value >= 0x80; value >>= 7)
+            {
+                out += static_cast<char>((value & 0x7F) | 0x80);
+            }
+            out += static_cast<char>(value);
+        }
+
+        inline void write_little_endian(std::string& out, std::uint64_t value)
+        {
+            for (int i = 0; i < 8; i++)
+            {
+                out += static_cast<char>(value >> (8 * i));
+            }
+        }
+
+        inline bool read_length_prefixed(std::string_view data, std::size_t& pos, std::string_view& value) noexcept
+        {
+            std::uint64_t size;
+            if (!read_varint(data, pos, size) || size > data.size() - pos)
+            {
+                return false;
+            }
+            value = data.substr(pos, static_cast<std::size_t>(size));
+            pos += static_cast<std::size_t>(size);
+            return true;
+        }
+
+        using column_values = std::variant<std::vector<std::int64_t>, std::vector<double>, std::vector<std::string>>;
+
+        template<typename T> struct column_type_of;
+        template<> struct column_type_of<std::int64_t> { static constexpr column_type value = column_type::int64; };
+        template<> struct column_type_of<double> { static constexpr column_type value = column_type::float64; };
+        template<> struct column_type_of<std::string> { static constexpr column_type value = column_type::string; };
+
+        // Decodes a whole column. Returns false if the data is malformed. rows comes from the file, so it is checked 
+        // against the data before anything is allocated: every encoding takes at least one byte per row.
+        inline bool decode_column(column_type type, column_encoding encoding, std::string_view data, std::size_t rows, column_values& out)
+        {
+            std::size_t pos = 0;
+            if (type == column_type::int64 || type == column_type::float64)
+            {
+                if (encoding == column_encoding::plain)
+                {
+                    if (data.size() % 8 != 0 || data.size() / 8 != rows) // Not rows * 8, which can overflow
+                    {
+                        return false;
+                    }
+                    if (type == column_type::int64)
+                    {
+                        std::vector<std::int64_t>& values = out.emplace<std::vector<std::int64_t>>(rows);
+                        for (std::size_t i = 0; i < rows; i++)
+                        {
+                            values[i] = static_cast<std::int64_t>(read_little_endian(data.substr(i * 8, 8)));
+                        }
+                    }
+                    else
+                    {
+                        std::vector<double>& values = out.emplace<std::vector<double>>(rows);
+                        for (std::size_t i = 0; i < rows; i++)
+                        {
+                            const std::uint64_t raw = read_little_endian(data.substr(i * 8, 8));
+                            std::memcpy(&values[i], &raw, sizeof(double));
+                        }
+                    }
+                    return true;
+                }
+                if (encoding != column_encoding::delta || type != column_type::int64 || rows > data.size())
+                {
+                    return false;
+                }
+                std::vector<std::int64_t>& values = out.emplace<std::vector<std::int64_t>>(rows);
+                std::uint64_t previous = 0;
+                for (std::size_t i = 0; i < rows; i++)
+                {
+                    std::uint64_t zigzag;
+                    if (!read_varint(data, pos, zigzag))
+                    {
+                        return false;
+                    }
+                    previous += (zigzag >> 1) ^ (~(zigzag & 1) + 1);
+                    values[i] = static_cast<std::int64_t>(previous);
+                }
+                return pos == data.size();
+            }
+
+            if (rows > data.size() || (encoding != column_encoding::plain && encoding != column_encoding::dictionary))
+            {
+                return false;
+            }
+            std::vector<std::string>& values = out.emplace<std::vector<std::string>>(rows);
+            std::string_view value;
+            if (encoding == column_encoding::plain)
+            {
+                for (std::size_t i = 0; i < rows; i++)
+                {
+                    if (!read_length_prefixed(data, pos, value))
+                    {
+                        return false;
+                    }
+                    values[i].assign(value.data(), value.size());
+                }
+                return pos == data.size();
+            }
+            std::uint64_t distinct;
+            if (!read_varint(data, pos, distinct) || distinct > data.size())
+            {
+                return false;
+            }
+            std::vector<std::string_view> dictionary(static_cast<std::size_t>(distinct));
+            for (std::string_view& entry : dictionary)
+            {
+                if (!read_length_prefixed(data, pos, entry))
+                {
+                    return false;
+                }
+            }
+            for (std::size_t i = 0; i < rows; i++)
+            {
+                std::uint64_t index;
+                if (!read_varint(data, pos, index) || index >= distinct)
+                {
+                    return false;
+                }
+                values[i].assign(dictionary[index].data(), dictionary[index].size());
+            }
+            return pos == data.size();
+        }
+
+        struct table_column
+        {
+            std::string name;
+            column_type type;
+            column_encoding encoding;
+            std::string_view data;
+            mutable once_cell<std::optional<column_values>> values; // nullopt if the data is malformed
+        };
+
+        // The header of a table: its size, and where each column is.
+        struct table_directory
+        {
+            std::size_t rows = 0;
+            std::vector<table_column> columns;
+            std::unordered_map<std::string_view, std::size_t> by_name; // Views into columns[i].name, which stay put when the vector is moved
+            std::error_code error;
+
+            explicit table_directory(std::string_view bytes)
+            {
+                if (!parse(bytes))
+                {
+                    error = std::make_error_code(std::errc::illegal_byte_sequence);
+                    columns.clear();
+                    by_name.clear();
+                    rows = 0;
+                }
+            }
+
+        private:
+
+            bool parse(std::string_view bytes)
+            {
+                if (bytes.size() < sizeof(table_magic) || std::memcmp(bytes.data(), table_magic, sizeof(table_magic)) != 0)
+                {
+                    return false;
+                }
+                std::size_t pos = sizeof(table_magic);
+                std::uint64_t row_count, column_count;
+                // Each column has at least a byte per row, so a larger row count is corrupt (and would be allocated when decoding)
+                if (!read_varint(bytes, pos, row_count) || !read_varint(bytes, pos, column_count) || column_count > bytes.size() ||
+                    (column_count && row_count > bytes.size()))
+                {
+                    return false;
+                }
+                rows = static_cast<std::size_t>(row_count);
+                struct location
+                {
+                    std::uint64_t offset, size;
+                };
+                std::vector<location> locations;
+                columns.reserve(static_cast<std::size_t>(column_count));
+                for (std::uint64_t c = 0; c < column_count; c++)
+                {
+                    std::string_view name;
+                    location where;
+                    if (!read_length_prefixed(bytes, pos, name) || bytes.size() - pos < 2)
+                    {
+                        return false;
+                    }
+                    const auto type = static_cast<column_type>(bytes[pos]);
+                    const auto encoding = static_cast<column_encoding>(bytes[pos + 1]);
+                    pos += 2;
+                    if (type > column_type::string || !read_varint(bytes, pos, where.offset) || !read_varint(bytes, pos, where.size))
+                    {
+                        return false;
+                    }
+                    columns.push_back(table_column{ std::string(name), type, encoding, {}, {} });
+                    locations.push_back(where);
+                }
+                const std::string_view data = bytes.substr(pos);
+                for (std::size_t c = 0; c < columns.size(); c++)
+                {
+                    if (locations[c].offset > data.size() || locations[c].size > data.size() - locations[c].offset)
+                    {
+                        return false;
+                    }
+                    columns[c].data = data.substr(static_cast<std::size_t>(locations[c].offset), static_cast<std::size_t>(locations[c].size));
+                }
+                for (std::size_t c = 0; c < columns.size(); c++)
+                {
+                    by_name.emplace(columns[c].name, c);
+                }
+                return true;
+            }
+        };
+    }
+
+    // Builds the bytes of a table that lazy_table reads.
+    //
+    //  cpplazy::table_writer writer{ 3 };
+    //  writer.add("id", std::vector<std::int64_t>{ 1, 2, 3 }, cpplazy::column_encoding::delta);
+    //  writer.add("city", std::vector<std::string>{ "Oslo", "Oslo", "Rome" }, cpplazy::column_encoding::dictionary);
+    //  save(writer.bytes());
+    class table_writer
+    {
+        struct column
+        {
+            std::string name;
+            column_type type;
+            column_encoding encoding;
+            std::string data;
+        };
+
+        std::size_t m_rows;
+        std::vector<column> m_columns;
+
+    public:
+
+        explicit table_writer(std::size_t rows) noexcept :
+            m_rows(rows)
+        {
+        }
+
+        // Each column must have rows values. Returns false (and adds nothing) otherwise, or if the encoding does not apply to the type.
+        bool add(std::string name, const std::vector<std::int64_t>& values, column_encoding encoding = column_encoding::plain)
+        {
+            if (values.size() != m_rows || encoding == column_encoding::dictionary)
+            {
+                return false;
+            }
+            std::string data;
+            std::uint64_t previous = 0;
+            for (std::int64_t value : values)
+            {
+                if (encoding == column_encoding::plain)
+                {
+                    detail::write_little_endian(data, static_cast<std::uint64_t>(value));
+                }
+                else
+                {
+                    const std::uint64_t delta = static_cast<std::uint64_t>(value) - previous;
+                    detail::write_varint(data, (delta << 1) ^ (~((delta >> 63) & 1) + 1)); // Zigzag, small negative deltas stay small
+                    previous = static_cast<std::uint64_t>(value);
+                }
+            }
+            m_columns.push_back({ std::move(name), column_type::int64, encoding, std::move(data) });
+            return true;
+        }
+
+        bool add(std::string name, const std::vector<double>& values, column_encoding encoding = column_encoding::plain)
+        {
+            if (values.size() != m_rows || encoding != column_encoding::plain)
+            {
+                return false;
+            }
+            std::string data;
+            for (double value : values)
+            {
+                std::uint64_t raw;
+                std::memcpy(&raw, &value, sizeof(raw));
+                detail::write_little_endian(data, raw);
+            }
+            m_columns.push_back({ std::move(name), column_type::float64, encoding, std::move(data) });
+            return true;
+        }
+
+        bool add(std::string name, const std::vector<std::string>& values, column_encoding encoding = column_encoding::plain)
+        {
+            if (values.size() != m_rows || encoding == column_encoding::delta)
+            {
+                return false;
+            }
+            std::string data;
+            if (encoding == column_encoding::plain)
+            {
+                for (const std::string& value : values)
+                {
+                    detail::write_varint(data, value.size());
+                    data += value;
+                }
+            }
+            else
+            {
+                std::unordered_map<std::string_view, std::uint64_t> indexes;
+                std::vector<std::string_view> distinct;
+                for (const std::string& value : values)
+                {
+                    if (indexes.emplace(value, distinct.size()).second)
+                    {
+                        distinct.push_back(value);
+                    }
+                }
+                detail::write_varint(data, distinct.size());
+                for (std::string_view value : distinct)
+                {
+                    detail::write_varint(data, value.size());
+                    data += value;
+                }
+                for (const std::string& value : values)
+                {
+                    detail::write_varint(data, indexes[value]);
+                }
+            }
+            m_columns.push_back({ std::move(name), column_type::string, encoding, std::move(data) });
+            return true;
+        }
+
+        std::string bytes() const
+        {
+            std::string out(detail::table_magic, sizeof(detail::table_magic));
+            detail::write_varint(out, m_rows);
+            detail::write_varint(out, m_columns.size());
+            std::uint64_t offset = 0;
+            for (const column& c : m_columns)
+            {
+                detail::write_varint(out, c.name.size());
+                out += c.name;
+                out += static_cast<char>(c.type);
+                out += static_cast<char>(c.encoding);
+                detail::write_varint(out, offset);
+                detail::write_varint(out, c.data.size());
+                offset += c.data.size();
+            }
+            for (const column& c : m_columns)
+            {
+                out += c.data;
+            }
+            return out;
+        }
+    };
+
+    // A columnar table read lazily: the file is mapped and its directory read on first access, and each column 
+    // is decoded into a contiguous std::vector the first time it is asked for, so a scan over 3 of 200 columns 
+    // only pays for those 3. release() frees decoded columns, they are decoded again if asked for later.
+    //
+    //  cpplazy::lazy_table sales{ "/data/sales.cpplazy" };
+    //  const std::vector<double>* amounts = sales.column<double>("amount"); //Decodes this column only
+    //
+    // Column types: std::int64_t, double, std::string. Accessing columns is thread safe, 
+    // release() is not (it must not race with readers of the columns it frees).
+    class lazy_table
+    {
+        std::optional<lazy_mapped<char>> m_file;
+        std::unique_ptr<const std::string> m_buffer; // Not moved with the table, the directory points into it
+        mutable once_cell<detail::table_directory> m_directory;
+
+        const detail::table_directory& directory() const
+        {
+            return m_directory.get_or_init([this] {
+                if (m_file && m_file->error())
+                {
+                    detail::table_directory failed{ std::string_view() };
+                    failed.error = m_file->error();
+                    return failed;
+                }
+                return detail::table_directory(m_file ? m_file->bytes() : std::string_view(*m_buffer));
+            });
+        }
+
+        const detail::table_column* find(std::string_view name) const
+        {
+            const detail::table_directory& dir = directory();
+            const auto found = dir.by_name.find(name);
+            return found != dir.by_name.end() ? &dir.columns[found->second] : nullptr;
+        }
+
+        template<typename T>
+        const std::vector<T>* decoded(const detail::table_column* column) const
+        {
+            static_assert(std::is_same<T, std::int64_t>::value || std::is_same<T, double>::value || std::is_same<T, std::string>::value,
+                "Column types are std::int64_t, double and std::string");
+            if (!column || column->type != detail::column_type_of<T>::value)
+            {
+                return nullptr;
+            }
+            const std::size_t rows = directory().rows;
+            const std::optional<detail::column_values>& values = column->values.get_or_init([column, rows] {
+                std::optional<detail::column_values> result(std::in_place);
+                if (!detail::decode_column(column->type, column->encoding, column->data, rows, *result))
+                {
+                    result.reset();
+                }
+                return result;
+            });
+            return values ? &std::get<std::vector<T>>(*values) : nullptr;
+        }
+
+    public:
+
+        // Reads the table from a file, mapped on first access.
+        explicit lazy_table(std::string path, map_options options = {}) :
+            m_file(std::in_place, std::move(path), options)
+        {
+        }
+
+        // Reads the table from a buffer (e.g. table_writer::bytes()).
+        static lazy_table from_bytes(std::string bytes)
+        {
+            lazy_table table;
+            table.m_buffer.reset(new std::string(std::move(bytes)));
+            return table;
+        }
+
+        lazy_table(lazy_table&&) = default;
+        lazy_table& operator=(lazy_table&&) = default;
+
+        // Why the table could not be read (the file is missing, or malformed), if so.
+        std::error_code error() const
+        {
+            return directory().error;
+        }
+
+        std::size_t rows() const
+        {
+            return directory().rows;
+        }
+
+        std::size_t columns() const
+        {
+            return directory().columns.size();
+        }
+
+        std::string_view column_name(std::size_t index) const
+        {
+            return index < columns() ? std::string_view(directory().columns[index].name) : std::string_view();
+        }
+
+        std::optional<column_type> type(std::string_view name) const
+        {
+            const detail::table_column* column = find(name);
+            return column ? std::optional<column_type>(column->type) : std::nullopt;
+        }
+
+        // The decoded column, decoded now if needed. Null if there is no such column, it is not of type T, or its data is malformed.
+        template<typename T>
+        const std::vector<T>* column(std::string_view name) const
+        {
+            return decoded<T>(find(name));
+        }
+
+        template<typename T>
+        const std::vector<T>* column(std::size_t index) const
+        {
+            return decoded<T>(index < columns() ? &directory().columns[index] : nullptr);
+        }
+
+        bool is_decoded(std::string_view name) const
+        {
+            const detail::table_column* column = find(name);
+            return column && column->values.is_initialized();
+        }
+
+        // Frees a decoded column. Pointers returned by column() for it become dangling.
+        void release(std::string_view name)
+        {
+            if (const detail::table_column* column = find(name))
+            {
+                column->values.reset();
+            }
+        }
+
+        // Frees every decoded column (the table itself stays mapped).
+        void release_all()
+        {
+            if (m_directory.is_initialized())
+            {
+                for (const detail::table_column& column : directory().columns)
+                {
+                    column.values.reset();
+                }
+            }
+        }
+
+        // Approximately how much memory the decoded columns use, in bytes.
+        std::size_t decoded_bytes() const
+        {
+            std::size_t total = 0;
+            if (!m_directory.is_initialized())
+            {
+                return total;
+            }
+            for (const detail::table_column& column : directory().columns)
+            {
+                const std::optional<detail::column_values>* values = column.values.get();
+                if (values && *values)
+                {
+                    std::visit([&total](const auto& vector) {
+                        total += vector.capacity() * sizeof(vector[0]);
+                        if constexpr (std::is_same<std::decay_t<decltype(vector)>, std::vector<std::string>>::value)
+                        {
+                            for (const std::string& s : vector)
+                            {
+                                total += s.capacity() > 15 ? s.capacity() : 0; // Not counting small strings stored inline
+                            }
+                        }
+                    }, **values);
+                }
+            }
+            return total;
+        }
+
+    private:
+
+        lazy_table() = default;
+    };
+}
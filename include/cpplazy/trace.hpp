@@ -0,0 +1,97 @@
+// Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+// Copyright (c) 2020 Ziv Shahaf <ziv.shahaf@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+
+// Exports the initializations and blocked waits recorded with CPPLAZY_ENABLE_TRACING as Chrome Trace Event JSON,
+// which can be opened with chrome://tracing or https://ui.perfetto.dev
+
+#include "cpplazy.hpp"
+#include "metrics.hpp"
+#include <cstdio>
+#include <string>
+
+
+namespace cpplazy
+{
+    // Formats the buffered events (the most recent CPPLAZY_TRACE_BUFFER_SIZE ones) as Chrome Trace Event JSON.
+    // Returns an empty trace without CPPLAZY_ENABLE_TRACING.
+    inline std::string format_trace()
+    {
+        std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+#if CPPLAZY_ENABLE_TRACING
+#if defined(_WIN32)
+        const long pid = 1;
+#else
+        const long pid = static_cast<long>(::getpid());
+#endif
+        bool first = true;
+        detail::trace_buffer::instance().for_each([&](const detail::trace_event& e) {
+            char object[32];
+            std::snprintf(object, sizeof(object), "%p", e.object);
+            const char* category = e.kind == detail::trace_kind::wait ? "cpplazy.wait" : "cpplazy.init";
+            const char* prefix = e.kind == detail::trace_kind::wait ? "wait " : "init ";
+
+            char timing[160];
+            std::snprintf(timing, sizeof(timing), "\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%ld,\"tid\":%llu",
+                          category, e.begin_ns / 1000.0, (e.end_ns - e.begin_ns) / 1000.0, pid, static_cast<unsigned long long>(e.thread_id));
+
+            out += first ? "{\"name\":\"" : ",{\"name\":\"";
+            first = false;
+            out += prefix;
+            detail::append_escaped(out, e.name[0] ? std::string(e.name) : std::string(object));
+            out += timing;
+            out += ",\"args\":{\"object\":\"";
+            out += object;
+            out += e.kind == detail::trace_kind::failed_init ? "\",\"succeeded\":false}}" : "\"}}";
+        });
+#endif
+        out += "]}\n";
+        return out;
+    }
+
+    // Returns false if writing failed.
+    inline bool write_trace(int fd)
+    {
+        return detail::write_all(fd, format_trace());
+    }
+
+    inline bool write_trace(const std::string& path)
+    {
+        std::FILE* file = std::fopen(path.c_str(), "wb");
+        if (!file)
+        {
+            return false;
+        }
+        const std::string data = format_trace();
+        const bool written = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+        return std::fclose(file) == 0 && written;
+    }
+
+    // Drops the buffered events, e.g. to trace only a specific phase of the startup.
+    inline void clear_trace() noexcept
+    {
+#if CPPLAZY_ENABLE_TRACING
+        detail::trace_buffer::instance().clear();
+#endif
+    }
+}
@@ -0,0 +1,151 @@
+// Built with CPPLAZY_ENABLE_CYCLE_DETECTION (see CMakeLists.txt)
+#include "catch.hpp"
+#include <cpplazy/cpplazy.hpp>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cpplazy;
+
+namespace
+{
+    struct cycle_error : std::runtime_error
+    {
+        using std::runtime_error::runtime_error;
+    };
+
+    std::mutex cycles_mutex;
+    std::vector<std::string> cycles;
+
+    void throwing_handler(const char* cycle)
+    {
+        {
+            std::lock_guard<std::mutex> lock(cycles_mutex);
+            cycles.push_back(cycle);
+        }
+        throw cycle_error(cycle);
+    }
+
+    // Installs the throwing handler for the scope of a test, so the cycle unwinds instead of aborting
+    struct scoped_handler
+    {
+        scoped_handler()
+        {
+            cycles.clear();
+            set_cycle_handler(&throwing_handler);
+        }
+
+        ~scoped_handler()
+        {
+            set_cycle_handler(nullptr);
+        }
+    };
+
+    // Drops the " [thread N]" parts
+    std::string names_only(std::string cycle)
+    {
+        for (size_t begin; (begin = cycle.find(" [thread ")) != std::string::npos;)
+        {
+            cycle.erase(begin, cycle.find(']', begin) - begin + 1);
+        }
+        return cycle;
+    }
+}
+
+TEST_CASE("Cycle detection")
+{
+    scoped_handler handler;
+
+    SECTION("Initializer accessing its own lazy object")
+    {
+        lazy<int> a{ "a", [&a] { return *a + 1; } };
+
+        REQUIRE_THROWS_AS(*a, std::bad_optional_access); // The outer initialization failed because of the cycle
+        REQUIRE(cycles.size() == 1);
+        REQUIRE(names_only(cycles[0]) == "a -> a");
+        REQUIRE(cycles[0].find("a [thread ") == 0);
+        REQUIRE_FALSE(a.is_initialized());
+    }
+
+    SECTION("Cycle through other lazy objects")
+    {
+        lazy<int>* b_ptr = nullptr;
+        lazy<int> a{ "a", [&b_ptr] { return **b_ptr; } };
+        lazy<int> b{ "b", [&a] { return *a; } };
+        b_ptr = &b;
+
+        REQUIRE_THROWS(*a);
+        REQUIRE(cycles.size() == 1);
+        REQUIRE(names_only(cycles[0]) == "a -> b -> a");
+    }
+
+    SECTION("Unnamed objects are shown by address")
+    {
+        once_cell<int> cell;
+        REQUIRE_THROWS_AS(cell.get_or_init([&cell] { return cell.get_or_init([] { return 1; }) + 1; }), cycle_error);
+        REQUIRE(cycles.size() == 1);
+        REQUIRE(cycles[0].find("<unnamed ") == 0);
+        REQUIRE(cell.get() == nullptr);
+    }
+
+    SECTION("Cycle across threads")
+    {
+        std::atomic<bool> a_started{ false };
+        std::atomic<bool> b_started{ false };
+        lazy<int>* b_ptr = nullptr;
+        lazy<int> a{ "a", [&] {
+            a_started = true;
+            while (!b_started) std::this_thread::yield();
+            return **b_ptr;
+        } };
+        lazy<int> b{ "b", [&] {
+            b_started = true;
+            while (!a_started) std::this_thread::yield();
+            return *a;
+        } };
+        b_ptr = &b;
+
+        std::atomic<int> failed{ 0 };
+        std::thread t1([&] { try { *a; } catch (...) { failed++; } });
+        std::thread t2([&] { try { *b; } catch (...) { failed++; } });
+        t1.join();
+        t2.join();
+
+        // Whichever thread waits last closes the cycle. Its initializer fails, so the other thread
+        // takes over that initialization and reenters its own lazy object.
+        REQUIRE(failed == 2);
+        REQUIRE(cycles.size() >= 1);
+        const std::string first = names_only(cycles[0]);
+        REQUIRE((first == "a -> b -> a" || first == "b -> a -> b"));
+        REQUIRE(cycles[0].find("[thread ") != cycles[0].rfind("[thread ")); // Two threads are listed
+    }
+
+    SECTION("Contention is not a cycle")
+    {
+        std::atomic<bool> release{ false };
+        lazy<int> a{ "a", [&] {
+            while (!release) std::this_thread::yield();
+            return 1;
+        } };
+        lazy<int> b{ "b", [&] { return *a + 1; } };
+
+        std::vector<std::thread> threads;
+        std::atomic<int> sum{ 0 };
+        for (int i = 0; i < 4; i++)
+        {
+            threads.emplace_back([&, i] { sum += i % 2 ? *a : *b; });
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        release = true;
+        for (auto& t : threads)
+        {
+            t.join();
+        }
+
+        REQUIRE(cycles.empty());
+        REQUIRE(sum == 2 + 1 + 2 + 1);
+    }
+}
@@ -0,0 +1,229 @@
+#include "catch.hpp"
+#include <cpplazy/decoded.hpp>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cpplazy;
+
+namespace
+{
+    // A minimal protobuf encoder for the test messages
+    struct writer
+    {
+        std::string bytes;
+
+        void varint(std::uint64_t value)
+        {
+            for (; value >= 0x80; value >>= 7)
+            {
+                bytes += static_cast<char>((value & 0x7F) | 0x80);
+            }
+            bytes += static_cast<char>(value);
+        }
+
+        writer& uint(std::uint32_t number, std::uint64_t value)
+        {
+            varint(number << 3 | 0);
+            varint(value);
+            return *this;
+        }
+
+        writer& fixed(std::uint32_t number, double value)
+        {
+            varint(number << 3 | 1);
+            std::uint64_t raw;
+            std::memcpy(&raw, &value, sizeof(raw));
+            for (int i = 0; i < 8; i++)
+            {
+                bytes += static_cast<char>(raw >> (8 * i));
+            }
+            return *this;
+        }
+
+        writer& fixed32(std::uint32_t number, std::uint32_t raw)
+        {
+            varint(number << 3 | 5);
+            for (int i = 0; i < 4; i++)
+            {
+                bytes += static_cast<char>(raw >> (8 * i));
+            }
+            return *this;
+        }
+
+        writer& fixed(std::uint32_t number, float value)
+        {
+            varint(number << 3 | 5);
+            std::uint32_t raw;
+            std::memcpy(&raw, &value, sizeof(raw));
+            for (int i = 0; i < 4; i++)
+            {
+                bytes += static_cast<char>(raw >> (8 * i));
+            }
+            return *this;
+        }
+
+        writer& text(std::uint32_t number, const std::string& value)
+        {
+            varint(number << 3 | 2);
+            varint(value.size());
+            bytes += value;
+            return *this;
+        }
+    };
+
+    enum class status
+    {
+        pending = 0,
+        shipped = 2
+    };
+
+    using item = lazy_decoded<field<1, std::string_view>, field<2, std::uint32_t>>;
+    using order = lazy_decoded<
+        field<1, std::uint64_t>,
+        field<2, std::string_view>,
+        field<3, double>,
+        field<4, float>,
+        field<5, status>,
+        field<6, std::int32_t>,
+        field<7, std::vector<item>>,
+        field<8, std::vector<std::uint32_t>>,
+        field<9, bool>,
+        field<10, std::string>>;
+
+    std::string make_order()
+    {
+        writer packed;
+        packed.varint(1);
+        packed.varint(300);
+        packed.varint(5);
+
+        writer w;
+        w.uint(1, 1234567890123ull)
+            .text(2, "Ada")
+            .fixed(3, 99.5)
+            .fixed(4, 0.25f)
+            .uint(5, 2)
+            .uint(6, static_cast<std::uint64_t>(static_cast<std::int64_t>(-42)))
+            .text(7, writer().text(1, "pen").uint(2, 3).bytes)
+            .text(7, writer().text(1, "ink").uint(2, 10).bytes)
+            .text(8, packed.bytes)
+            .uint(9, 1);
+        return w.bytes;
+    }
+}
+
+TEST_CASE("lazy_decoded")
+{
+    const std::string buffer = make_order();
+
+    SECTION("Fields are decoded on first access only")
+    {
+        order o{ buffer };
+        REQUIRE_FALSE(o.message().is_indexed());
+        REQUIRE(o.get<2>() == "Ada");
+        REQUIRE(o.message().is_indexed());
+        REQUIRE(o.is_decoded<2>());
+        REQUIRE_FALSE(o.is_decoded<1>());
+        REQUIRE_FALSE(o.is_decoded<7>());
+        REQUIRE(!o.error());
+    }
+
+    SECTION("Scalar types")
+    {
+        order o{ buffer };
+        REQUIRE(o.get<1>() == 1234567890123ull);
+        REQUIRE(o.get<3>() == 99.5);
+        REQUIRE(o.get<4>() == 0.25f);
+        REQUIRE(o.get<5>() == status::shipped);
+        REQUIRE(o.get<6>() == -42);
+        REQUIRE(o.get<9>());
+    }
+
+    SECTION("Zigzag and sfixed32")
+    {
+        const std::string zigzag = writer().uint(1, 3).uint(2, 0xFFFFFFFFull).uint(3, 2).fixed32(4, 0xFFFFFFFF).fixed32(5, 0xFFFFFFFF).bytes;
+        lazy_decoded<field<1, sint<std::int32_t>>, field<2, sint<std::int64_t>>, field<3, sint<std::int64_t>>, field<4, std::int64_t>, field<5, std::uint64_t>> m{ zigzag };
+        REQUIRE(m.get<1>() == -2);
+        REQUIRE(m.get<2>() == -2147483648LL);
+        REQUIRE(m.get<3>() == 1);
+        REQUIRE(m.get<4>() == -1); // Sign extended
+        REQUIRE(m.get<5>() == 0xFFFFFFFFull);
+
+        writer packed;
+        packed.varint(1);
+        packed.varint(4);
+        const std::vector<sint<std::int32_t>> values = lazy_decoded<field<1, std::vector<sint<std::int32_t>>>>{ writer().text(1, packed.bytes).bytes }.get<1>();
+        REQUIRE(values.size() == 2);
+        REQUIRE(values[0] == -1);
+        REQUIRE(values[1] == 2);
+    }
+
+    SECTION("Strings point into the buffer")
+    {
+        order o{ buffer };
+        REQUIRE(o.get<2>().data() >= buffer.data());
+        REQUIRE(o.get<2>().data() < buffer.data() + buffer.size());
+    }
+
+    SECTION("Repeated, packed and nested fields")
+    {
+        order o{ buffer };
+        const std::vector<item>& items = o.get<7>();
+        REQUIRE(items.size() == 2);
+        REQUIRE(items[1].get<1>() == "ink");
+        REQUIRE(items[1].get<2>() == 10);
+        REQUIRE_FALSE(items[0].message().is_indexed()); // Nested messages are lazy too
+        REQUIRE(o.get<8>() == std::vector<std::uint32_t>{ 1, 300, 5 });
+    }
+
+    SECTION("Missing fields decode to their default value")
+    {
+        order o{ buffer };
+        REQUIRE_FALSE(o.has(10));
+        REQUIRE(o.get<10>().empty());
+        REQUIRE(o.is_decoded<10>());
+    }
+
+    SECTION("The last occurrence wins")
+    {
+        const std::string twice = writer().uint(1, 1).uint(2, 7).uint(1, 2).bytes;
+        lazy_decoded<field<1, int>> message{ twice };
+        REQUIRE(message.get<1>() == 2);
+        REQUIRE(message.message().has(2));
+    }
+
+    SECTION("Malformed buffers")
+    {
+        std::string truncated = buffer.substr(0, buffer.size() - 1);
+        order o{ truncated };
+        REQUIRE(o.error() == std::errc::illegal_byte_sequence);
+        REQUIRE(o.get<1>() == 1234567890123ull); // Fields before the damage are still readable
+        REQUIRE(o.get<8>().size() == 3);
+        REQUIRE_FALSE(o.has(9)); // The truncated one is not
+
+        std::int64_t value = 7;
+        REQUIRE_FALSE(detail::decode_scalar(wire_type::varint, std::string_view("\x80\x80", 2), value)); // Unterminated varint
+    }
+
+    SECTION("Concurrent first access")
+    {
+        order o{ buffer };
+        std::vector<std::thread> threads;
+        std::vector<const std::vector<item>*> seen(4);
+        for (size_t i = 0; i < seen.size(); i++)
+        {
+            threads.emplace_back([&, i] { seen[i] = &o.get<7>(); });
+        }
+        for (auto& t : threads)
+        {
+            t.join();
+        }
+        for (const auto* items : seen)
+        {
+            REQUIRE(items == seen[0]);
+        }
+    }
+}
@@ -0,0 +1,117 @@
+#include "catch.hpp"
+#include <cpplazy/cpplazy.hpp>
+#include <atomic>
+#include <thread>
+
+using namespace cpplazy;
+
+namespace
+{
+    std::atomic<int> destroyed{ 0 };
+    std::thread::id destroyed_on;
+
+    // Counts destructions of objects that still own their value (not moved-from shells)
+    struct heavy
+    {
+        bool owner = true;
+
+        heavy() = default;
+
+        heavy(heavy&& other) noexcept
+        {
+            other.owner = false;
+        }
+
+        heavy& operator=(heavy&& other) noexcept
+        {
+            owner = other.owner;
+            other.owner = false;
+            return *this;
+        }
+
+        ~heavy()
+        {
+            if (owner)
+            {
+                destroyed_on = std::this_thread::get_id();
+                destroyed++;
+            }
+        }
+    };
+}
+
+TEST_CASE("Destruction policies")
+{
+    wait_for_background_destruction(); // Values retired at the end of the previous section
+    destroyed = 0;
+    destroyed_on = std::thread::id();
+
+    SECTION("Inline by default")
+    {
+        {
+            lazy<heavy> l{ [] { return heavy(); } };
+            *l;
+        }
+        REQUIRE(destroyed == 1);
+        REQUIRE(destroyed_on == std::this_thread::get_id());
+    }
+
+    SECTION("In background")
+    {
+        {
+            lazy<heavy, destroy_in_background> l{ [] { return heavy(); } };
+            *l;
+            l.reset();
+            *l;
+        }
+        wait_for_background_destruction();
+        REQUIRE(destroyed == 2);
+        REQUIRE(destroyed_on != std::this_thread::get_id());
+    }
+
+    SECTION("In background on assignment")
+    {
+        lazy<heavy, destroy_in_background> a{ [] { return heavy(); } };
+        lazy<heavy, destroy_in_background> b{ [] { return heavy(); } };
+        *a;
+        *b;
+        a = std::move(b);
+        wait_for_background_destruction();
+        REQUIRE(destroyed == 1);
+        REQUIRE(destroyed_on != std::this_thread::get_id());
+        REQUIRE(a.is_initialized());
+    }
+
+    SECTION("take() moves the value out, nothing is destroyed")
+    {
+        lazy<heavy, destroy_in_background> l{ [] { return heavy(); } };
+        std::optional<heavy> value = l.take();
+        wait_for_background_destruction();
+        REQUIRE(destroyed == 0);
+        REQUIRE(value->owner);
+    }
+
+    SECTION("lazy<void> accepts a policy")
+    {
+        int runs = 0;
+        lazy<void, destroy_in_background> action{ [&runs] { runs++; } };
+        REQUIRE(action.ensure());
+        REQUIRE(action.ensure());
+        action.reset();
+        REQUIRE(action.ensure());
+        REQUIRE(runs == 2);
+        REQUIRE(destroyed == 0);
+    }
+
+    SECTION("Leaked by the destructor only")
+    {
+        {
+            lazy<heavy, leak_on_destroy> l{ [] { return heavy(); } };
+            *l;
+            l.reset();
+            REQUIRE(destroyed == 1);
+            *l;
+        }
+        REQUIRE(destroyed == 1);
+    }
+}
@@ -0,0 +1,108 @@
+#include "catch.hpp"
+#include <cpplazy/expr.hpp>
+#include <cstddef>
+#include <vector>
+
+using namespace cpplazy;
+
+namespace
+{
+    // Small integers and halves: every level computes them exactly, so results compare equal
+    template<typename T>
+    std::vector<T> values(std::size_t size, int offset)
+    {
+        std::vector<T> result(size);
+        for (std::size_t i = 0; i < size; i++)
+        {
+            result[i] = static_cast<T>(static_cast<int>(i % 97) - 40 + offset) / 2;
+        }
+        return result;
+    }
+
+    const simd_level all_levels[] = { simd_level::scalar, simd_level::sse2, simd_level::avx2, simd_level::neon };
+
+    template<typename T>
+    void check_every_level()
+    {
+        for (std::size_t size : { 0, 1, 7, 255, 256, 257, 1003 })
+        {
+            const std::vector<T> a = values<T>(size, 0);
+            const std::vector<T> b = values<T>(size, 100); // Never zero
+            const std::vector<T> c = values<T>(size, 3);
+
+            std::vector<T> expected(size);
+            for (std::size_t i = 0; i < size; i++)
+            {
+                expected[i] = (a[i] * b[i] + c[i] * 2) - (1 - a[i] / 4) / b[i] - -c[i];
+            }
+
+            const auto e = (expr(a) * b + expr(c) * 2) - (1 - expr(a) / 4) / b - -expr(c);
+            REQUIRE(e.size() == size);
+            for (simd_level level : all_levels)
+            {
+                REQUIRE(e.eval(level) == expected);
+            }
+            if (size)
+            {
+                REQUIRE(e[size - 1] == expected[size - 1]);
+            }
+        }
+    }
+}
+
+TEST_CASE("lazy_expr")
+{
+    SECTION("Every level computes the same values as a plain loop")
+    {
+        check_every_level<float>();
+        check_every_level<double>();
+    }
+
+    SECTION("Detected level")
+    {
+#if defined(__x86_64__) || defined(_M_X64)
+        REQUIRE((detected_simd_level() == simd_level::sse2 || detected_simd_level() == simd_level::avx2));
+#elif defined(__aarch64__) || defined(_M_ARM64)
+        REQUIRE(detected_simd_level() == simd_level::neon);
+#endif
+        REQUIRE(detail::is_supported(simd_level::scalar));
+        REQUIRE(detail::is_supported(detected_simd_level()));
+    }
+
+    SECTION("Evaluated on assignment, from the arrays at that time")
+    {
+        std::vector<float> a{ 1, 2, 3 };
+        const std::vector<float> b{ 10, 20, 30 };
+        const auto sum = expr(a) + b;
+        a[0] = 5;
+        std::vector<float> r = sum;
+        REQUIRE(r == std::vector<float>{ 15, 22, 33 });
+
+        std::vector<float> out(3);
+        (sum * 2).eval_into(out.data());
+        REQUIRE(out == std::vector<float>{ 30, 44, 66 });
+    }
+
+    SECTION("Lone arrays and different sizes")
+    {
+        const std::vector<double> a{ 1, 2, 3, 4 };
+        const std::vector<double> b{ 1, 1 };
+        REQUIRE(expr(a).eval() == a);
+        REQUIRE((expr(a) - b).size() == 2);
+        REQUIRE((expr(a) - b).eval() == std::vector<double>{ 0, 1 });
+        REQUIRE((-expr(a.data() + 2, 2)).eval() == std::vector<double>{ -3, -4 });
+    }
+
+    SECTION("Cached in a lazy")
+    {
+        std::vector<float> a(1000, 1.5f);
+        lazy<std::vector<float>> cached = (expr(a) * expr(a)).cached();
+        REQUIRE_FALSE(cached.is_initialized());
+        a[999] = 2;
+        REQUIRE((*cached)[999] == 4);
+        REQUIRE(cached.is_initialized());
+
+        a[0] = 3; // Not seen anymore
+        REQUIRE((*cached)[0] == 2.25f);
+    }
+}
@@ -0,0 +1,117 @@
+// Built with CPPLAZY_ENABLE_INSTRUMENTATION, CPPLAZY_ENABLE_TRACING and CPPLAZY_ENABLE_PERF_COUNTERS (see CMakeLists.txt)
+#include "catch.hpp"
+#include <cpplazy/cpplazy.hpp>
+#include <thread>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+using namespace cpplazy;
+using namespace std::literals;
+
+namespace
+{
+    std::atomic<int> begin_count{ 0 };
+    std::atomic<int> end_count{ 0 };
+    std::atomic<int> failed_count{ 0 };
+    std::atomic<int> wait_count{ 0 };
+
+    void reset_hook_counters()
+    {
+        begin_count = end_count = failed_count = wait_count = 0;
+    }
+}
+
+TEST_CASE("Instrumentation counters")
+{
+    SECTION("Not accessed")
+    {
+        lazy<int> l{ [] { return 42; } };
+        lazy_stats stats = l.stats();
+        REQUIRE(stats.first_access == 0ns);
+        REQUIRE(stats.init_time == 0ns);
+        REQUIRE(stats.failures == 0);
+        REQUIRE(stats.waits == 0);
+    }
+
+    SECTION("Init time and first access")
+    {
+        lazy<int> l{ [] { std::this_thread::sleep_for(5ms); return 42; } };
+        REQUIRE(*l == 42);
+        REQUIRE(*l == 42);
+        lazy_stats stats = l.stats();
+        REQUIRE(stats.init_time >= 5ms);
+        REQUIRE(stats.first_access > 0ns);
+        REQUIRE(stats.failures == 0);
+    }
+
+    SECTION("Failures")
+    {
+        int attempts = 0;
+        lazy<std::string> l{ [&]() -> std::string { if (++attempts < 3) throw std::runtime_error("can't open config file"); return "config"; } };
+        REQUIRE_FALSE(l->has_value());
+        REQUIRE_FALSE(l->has_value());
+        REQUIRE(*l == "config");
+        REQUIRE(l.stats().failures == 2);
+    }
+
+    SECTION("Waits")
+    {
+        lazy<void> l{ [] { std::this_thread::sleep_for(20ms); } };
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < 4; i++)
+        {
+            threads.emplace_back([&] { l.ensure(); });
+        }
+        for (auto& t : threads)
+        {
+            t.join();
+        }
+        lazy_stats stats = l.stats();
+        REQUIRE(stats.waits <= 3);
+        REQUIRE(stats.max_wait <= stats.total_wait);
+        REQUIRE(stats.total_wait <= stats.waits * 20ms + 1s);
+    }
+
+    SECTION("once_cell wait")
+    {
+        once_cell<int> cell;
+        std::thread producer([&] { std::this_thread::sleep_for(10ms); cell.set(42); });
+        REQUIRE(cell.wait() == 42);
+        producer.join();
+        REQUIRE(cell.stats().waits == 1);
+        REQUIRE(cell.stats().max_wait > 0ns);
+    }
+}
+
+TEST_CASE("Instrumentation hooks")
+{
+    reset_hook_counters();
+    instrumentation_hooks hooks;
+    hooks.on_init_begin = [](const init_event&) { ++begin_count; };
+    hooks.on_init_end = [](const init_event& e) { ++end_count; failed_count += e.succeeded ? 0 : 1; };
+    hooks.on_wait = [](const init_event&) { ++wait_count; };
+    set_instrumentation_hooks(hooks);
+
+    bool fail = true;
+    lazy<int> l{ [&] { if (fail) throw std::runtime_error("failed"); return 42; } };
+    REQUIRE_FALSE(l->has_value());
+    fail = false;
+    REQUIRE(*l == 42);
+    REQUIRE(*l == 42);
+    REQUIRE(begin_count == 2);
+    REQUIRE(end_count == 2);
+    REQUIRE(failed_count == 1);
+
+    lazy<void> slow{ [] { std::this_thread::sleep_for(20ms); } };
+    std::thread t1([&] { slow.ensure(); });
+    std::thread t2([&] { slow.ensure(); });
+    t1.join();
+    t2.join();
+    REQUIRE(wait_count == static_cast<int>(slow.stats().waits));
+
+    set_instrumentation_hooks({});
+    lazy<int> unobserved{ [] { return 42; } };
+    REQUIRE(*unobserved == 42);
+    REQUIRE(begin_count == 3);
+}
@@ -0,0 +1,121 @@
+#include "catch.hpp"
+#include <cpplazy/json.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cpplazy;
+
+namespace
+{
+    const char* const sample = R"({
+        "name": "service \"a\"",
+        "version": 3,
+        "ratio": -0.125e1,
+        "enabled": true,
+        "owner": null,
+        "tags": ["x", "yé", "😀"],
+        "stats": { "latency": { "p50": 1.5, "p99": 42 }, "count": 1000000 },
+        "empty": {},
+        "none": [],
+        "es\"caped": 1
+    })";
+}
+
+TEST_CASE("json_document")
+{
+    SECTION("Stages run on first query only")
+    {
+        json_document doc{ sample };
+        REQUIRE_FALSE(doc.is_indexed());
+        REQUIRE(doc["stats"]["latency"]["p99"].as_int64() == 42);
+        REQUIRE(doc.is_indexed());
+        REQUIRE(doc.indexed_containers() == 3); // The root, stats and latency, not tags
+        REQUIRE(!doc.error());
+    }
+
+    SECTION("Types and values")
+    {
+        json_document doc{ sample };
+        REQUIRE(doc.root().type() == json_type::object);
+        REQUIRE(doc["name"].as_string() == std::string("service \"a\""));
+        REQUIRE(doc["name"].raw_string() == std::string_view(R"(service \"a\")"));
+        REQUIRE(doc["version"].as_int64() == 3);
+        REQUIRE(doc["ratio"].as_double() == -1.25);
+        REQUIRE_FALSE(doc["ratio"].as_int64());
+        REQUIRE(doc["enabled"].as_bool() == true);
+        REQUIRE(doc["owner"].type() == json_type::null);
+        REQUIRE(doc["stats"]["count"].as_double() == 1e6);
+        REQUIRE(doc["es\"caped"].as_int64() == 1);
+    }
+
+    SECTION("Arrays and iteration")
+    {
+        json_document doc{ sample };
+        json_value tags = doc["tags"];
+        REQUIRE(tags.size() == 3);
+        REQUIRE(tags[1].as_string() == std::string("y\xc3\xa9"));
+        REQUIRE(tags[2].as_string() == std::string("\xf0\x9f\x98\x80"));
+        REQUIRE_FALSE(tags[3]);
+        REQUIRE(doc["empty"].size() == 0);
+        REQUIRE(doc["none"].size() == 0);
+        REQUIRE(doc.root().size() == 10);
+        REQUIRE(doc.root().key(6) == "stats");
+        REQUIRE(doc.root()[1].as_int64() == 3);
+    }
+
+    SECTION("Missing members and wrong types are invalid values")
+    {
+        json_document doc{ sample };
+        REQUIRE_FALSE(doc["missing"]);
+        REQUIRE_FALSE(doc["missing"]["deeper"][0]);
+        REQUIRE_FALSE(doc["version"].as_string());
+        REQUIRE_FALSE(doc["name"].as_double());
+        REQUIRE(doc["tags"]["x"].type() == json_type::invalid);
+    }
+
+    SECTION("Large objects and structural characters inside strings")
+    {
+        std::string text = "{";
+        for (int i = 0; i < 500; i++)
+        {
+            text += (i ? ",\"k" : "\"k") + std::to_string(i) + "\": \"{[,:]}\\\\\"";
+        }
+        text += ", \"last\": [1, 2, {\"deep\": [[[]]]}]}";
+        json_document doc{ text };
+        REQUIRE(!doc.error());
+        REQUIRE(doc.root().size() == 501);
+        REQUIRE(doc["k321"].as_string() == std::string("{[,:]}\\"));
+        REQUIRE(doc["last"][2]["deep"][0][0].size() == 0);
+        REQUIRE_FALSE(doc["k500"]);
+    }
+
+    SECTION("Structural errors")
+    {
+        REQUIRE(json_document("{\"a\": [1, 2}").error() == std::errc::illegal_byte_sequence);
+        REQUIRE(json_document("{\"a\": \"unterminated}").error() == std::errc::illegal_byte_sequence);
+        REQUIRE(json_document("").error());
+        REQUIRE_FALSE(json_document("[1, 2").root());
+        REQUIRE(json_document(" 7 ").root().as_int64() == 7);
+    }
+
+    SECTION("Concurrent queries")
+    {
+        json_document doc{ sample };
+        std::vector<std::thread> threads;
+        std::vector<double> seen(4);
+        for (size_t i = 0; i < seen.size(); i++)
+        {
+            threads.emplace_back([&, i] { seen[i] = *doc["stats"]["latency"]["p50"].as_double(); });
+        }
+        for (auto& t : threads)
+        {
+            t.join();
+        }
+        for (double value : seen)
+        {
+            REQUIRE(value == 1.5);
+        }
+        REQUIRE(doc.indexed_containers() == 3);
+    }
+}
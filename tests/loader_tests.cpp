@@ -0,0 +1,133 @@
+#include "catch.hpp"
+#include <cpplazy/loader.hpp>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cpplazy;
+
+namespace
+{
+    std::string temp_file_path(int index)
+    {
+        const auto unique = std::chrono::steady_clock::now().time_since_epoch().count();
+        return (std::filesystem::temp_directory_path() / ("cpplazy_test_" + std::to_string(unique) + "_" + std::to_string(index) + ".txt")).string();
+    }
+
+    void write_file(const std::string& path, const std::string& contents)
+    {
+        std::FILE* file = std::fopen(path.c_str(), "wb");
+        REQUIRE(file);
+        REQUIRE(std::fwrite(contents.data(), 1, contents.size(), file) == contents.size());
+        std::fclose(file);
+    }
+
+    // The file's contents, or "error" if it could not be read
+    std::string parse_text(std::string bytes, std::error_code error)
+    {
+        return error ? "error" : bytes;
+    }
+
+    void check_batch(load_backend backend)
+    {
+        std::vector<std::string> paths;
+        std::vector<std::unique_ptr<file_lazy<std::string>>> files;
+        for (int i = 0; i < 200; i++)
+        {
+            paths.push_back(temp_file_path(i));
+            write_file(paths.back(), std::string(i * 37, 'a' + i % 26));
+            files.emplace_back(new file_lazy<std::string>(paths.back(), &parse_text));
+        }
+
+        batch_loader loader{ backend, 16 };
+        for (auto& file : files)
+        {
+            loader.add(*file);
+        }
+        loader.load();
+        if (backend == load_backend::thread_pool)
+        {
+            REQUIRE(loader.backend() == load_backend::thread_pool);
+        }
+        else if (loader.backend() != load_backend::io_uring)
+        {
+            WARN("io_uring is not available, the thread pool was used");
+        }
+
+        for (int i = 0; i < 200; i++)
+        {
+            REQUIRE(files[i]->is_initialized());
+            REQUIRE(**files[i] == std::string(i * 37, 'a' + i % 26));
+            std::remove(paths[i].c_str());
+        }
+    }
+}
+
+TEST_CASE("file_lazy and batch_loader")
+{
+    SECTION("Read on first access without a loader")
+    {
+        const std::string path = temp_file_path(0);
+        write_file(path, "hello");
+        file_lazy<std::size_t> length{ path, [](std::string bytes, std::error_code) { return bytes.size(); } };
+        REQUIRE_FALSE(length.is_initialized());
+        REQUIRE(*length == 5);
+        REQUIRE(length.is_initialized());
+        std::remove(path.c_str());
+    }
+
+    SECTION("io_uring")
+    {
+        check_batch(load_backend::io_uring);
+    }
+
+    SECTION("Thread pool")
+    {
+        check_batch(load_backend::thread_pool);
+    }
+
+    SECTION("Read errors go to the parser")
+    {
+        for (load_backend backend : { load_backend::automatic, load_backend::thread_pool })
+        {
+            std::error_code seen;
+            file_lazy<std::string> missing{ temp_file_path(0), [&seen](std::string bytes, std::error_code error) {
+                seen = error;
+                return parse_text(bytes, error);
+            } };
+            batch_loader loader{ backend };
+            loader.add(missing);
+            loader.load();
+            REQUIRE(missing.is_initialized());
+            REQUIRE(*missing == "error");
+            REQUIRE(seen == std::errc::no_such_file_or_directory);
+        }
+    }
+
+    SECTION("Initialized objects are skipped, early accesses don't wait for the batch")
+    {
+        const std::string path = temp_file_path(0);
+        write_file(path, "data");
+        int parsed = 0;
+        file_lazy<std::string> file{ path, [&parsed](std::string bytes, std::error_code error) {
+            parsed++;
+            return parse_text(bytes, error);
+        } };
+
+        batch_loader loader;
+        loader.add(file);
+        loader.submit();
+        REQUIRE(*file == "data"); // Either loaded already, or read directly
+        loader.wait();
+        REQUIRE(parsed == 1);
+
+        loader.add(file);
+        loader.load();
+        REQUIRE(parsed == 1);
+        std::remove(path.c_str());
+    }
+}
@@ -0,0 +1,130 @@
+#include "catch.hpp"
+#include <cpplazy/mapped.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cpplazy;
+
+namespace
+{
+    struct header
+    {
+        std::uint32_t magic;
+        std::uint32_t count;
+    };
+
+    struct row
+    {
+        std::uint32_t id;
+        float score;
+    };
+
+    std::string temp_file_path()
+    {
+        const auto unique = std::chrono::steady_clock::now().time_since_epoch().count();
+        return (std::filesystem::temp_directory_path() / ("cpplazy_test_" + std::to_string(unique) + ".bin")).string();
+    }
+
+    void write_file(const std::string& path, const void* data, std::size_t size)
+    {
+        std::FILE* file = std::fopen(path.c_str(), "wb");
+        REQUIRE(file);
+        REQUIRE(std::fwrite(data, 1, size, file) == size);
+        std::fclose(file);
+    }
+}
+
+TEST_CASE("lazy_mapped")
+{
+    const std::string path = temp_file_path();
+
+    SECTION("Array of T")
+    {
+        const std::vector<std::uint64_t> values{ 1, 2, 3, 42 };
+        write_file(path, values.data(), values.size() * sizeof(std::uint64_t));
+
+        lazy_mapped<std::uint64_t> mapped{ path, { true, map_advice::sequential } };
+        REQUIRE_FALSE(mapped.is_initialized());
+        REQUIRE(mapped.size() == 4);
+        REQUIRE(mapped.is_initialized());
+        REQUIRE(std::vector<std::uint64_t>(mapped.elements().begin(), mapped.elements().end()) == values);
+        REQUIRE(mapped[3] == 42);
+        REQUIRE(!mapped.error());
+    }
+
+    SECTION("Struct and flat table views")
+    {
+        std::vector<unsigned char> file(sizeof(header) + 3 * sizeof(row));
+        const header h{ 0xCAFE, 3 };
+        const row rows[3] = { { 1, 0.5f }, { 2, 1.5f }, { 3, 2.5f } };
+        std::memcpy(file.data(), &h, sizeof(h));
+        std::memcpy(file.data() + sizeof(h), rows, sizeof(rows));
+        write_file(path, file.data(), file.size());
+
+        lazy_mapped<header> mapped{ path };
+        REQUIRE(mapped->magic == 0xCAFE);
+        const mapped_span<row> table = mapped.view<row>(sizeof(header), mapped->count);
+        REQUIRE(table.size() == 3);
+        REQUIRE(table[2].id == 3);
+        REQUIRE(table[2].score == 2.5f);
+
+        REQUIRE(mapped.view<row>(sizeof(header), 4).empty()); // Past the end
+        REQUIRE(mapped.view<row>(1, 1).empty()); // Misaligned
+    }
+
+    SECTION("Views point into the mapping, without copies")
+    {
+        const std::uint32_t values[2] = { 7, 8 };
+        write_file(path, values, sizeof(values));
+
+        lazy_mapped<std::uint32_t> mapped{ path };
+        REQUIRE(mapped.elements().data() == reinterpret_cast<const std::uint32_t*>(mapped.bytes().data()));
+        REQUIRE(&mapped[1] == mapped.elements().data() + 1);
+    }
+
+    SECTION("Missing file")
+    {
+        lazy_mapped<int> mapped{ path };
+        REQUIRE(mapped.error() == std::errc::no_such_file_or_directory);
+        REQUIRE(mapped.size() == 0);
+        REQUIRE(mapped.operator->() == nullptr);
+
+        // The error is cached until reset()
+        const int value = 5;
+        write_file(path, &value, sizeof(value));
+        REQUIRE(mapped.error());
+        mapped.reset();
+        REQUIRE(*mapped == 5);
+    }
+
+    SECTION("Mapped once across threads")
+    {
+        const std::vector<int> values(1000, 3);
+        write_file(path, values.data(), values.size() * sizeof(int));
+        lazy_mapped<int> mapped{ path };
+
+        std::vector<std::thread> threads;
+        std::vector<const int*> seen(4);
+        for (size_t i = 0; i < seen.size(); i++)
+        {
+            threads.emplace_back([&, i] { seen[i] = mapped.elements().data(); });
+        }
+        for (auto& t : threads)
+        {
+            t.join();
+        }
+        for (const int* data : seen)
+        {
+            REQUIRE(data == seen[0]);
+        }
+        REQUIRE(mapped.size() == 1000);
+    }
+
+    std::remove(path.c_str());
+}
@@ -0,0 +1,124 @@
+#include "catch.hpp"
+#include <cpplazy/memo.hpp>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cpplazy;
+
+namespace
+{
+    std::atomic<int> produced_count{ 0 };
+
+    lazy_seq<std::uint64_t> fibonacci()
+    {
+        return generate([a = std::uint64_t(0), b = std::uint64_t(1)]() mutable -> std::optional<std::uint64_t> {
+            produced_count++;
+            const std::uint64_t current = a;
+            a = b;
+            b += current;
+            return current;
+        });
+    }
+
+    bool is_prime(std::uint64_t n)
+    {
+        for (std::uint64_t d = 2; d * d <= n; d++)
+        {
+            if (n % d == 0)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+TEST_CASE("memo_seq")
+{
+    produced_count = 0;
+
+    SECTION("Elements are produced once")
+    {
+        memo_seq<std::uint64_t> fib{ fibonacci() };
+        REQUIRE(produced_count == 0);
+        REQUIRE(fib[10] == 55);
+        REQUIRE(produced_count == 11);
+        REQUIRE(fib[5] == 5);
+        REQUIRE(fib.view().take(11).collect().back() == 55);
+        REQUIRE(produced_count == 11);
+        REQUIRE(fib.produced() == 11);
+        REQUIRE(fib.view().take(12).count() == 12);
+        REQUIRE(produced_count == 12);
+    }
+
+    SECTION("Across chunks, references stay valid")
+    {
+        memo_seq<std::uint64_t, 16> primes{ iota<std::uint64_t>(2).filter(&is_prime) };
+        const std::uint64_t& first = primes[0];
+        REQUIRE(primes[999] == 7919);
+        REQUIRE(&first == &primes[0]);
+        REQUIRE(first == 2);
+    }
+
+    SECTION("Finite sources")
+    {
+        memo_seq<std::string> words{ from(std::vector<std::string>{ "a", "b", "c" }) };
+        REQUIRE(words.get(3) == nullptr);
+        REQUIRE(words.is_complete());
+        REQUIRE(words.produced() == 3);
+        std::string all;
+        for (const std::string& w : words)
+        {
+            all += w;
+        }
+        for (const std::string& w : words)
+        {
+            all += w;
+        }
+        REQUIRE(all == "abcabc");
+        REQUIRE(words.view(1).collect() == std::vector<std::string>{ "b", "c" });
+    }
+
+    SECTION("Full is not the end of the source")
+    {
+        std::size_t pulled = 0;
+        memo_seq<std::uint32_t, 1> memo{ iota<std::uint32_t>(0).map([&pulled](std::uint32_t i) { pulled++; return i; }) };
+        const std::size_t capacity = memo_seq<std::uint32_t, 1>::capacity();
+        REQUIRE(memo.get(capacity - 1));
+        REQUIRE(memo.is_full());
+        REQUIRE(memo.get(capacity) == nullptr);
+        REQUIRE(memo.get(SIZE_MAX) == nullptr);
+        REQUIRE_FALSE(memo.is_complete());
+        REQUIRE(pulled == capacity); // Nothing was pulled and dropped
+        REQUIRE(memo.view(capacity - 2).count() == 2);
+    }
+
+    SECTION("Concurrent readers and one producer at a time")
+    {
+        memo_seq<std::uint64_t, 64> fib{ fibonacci() };
+        std::vector<std::thread> threads;
+        std::atomic<bool> wrong{ false };
+        for (int t = 0; t < 4; t++)
+        {
+            threads.emplace_back([&, t] {
+                for (std::size_t i = 0; i < 90; i++)
+                {
+                    const std::size_t index = (i * 7 + t * 13) % 90;
+                    if (index >= 2 && fib[index] != fib[index - 1] + fib[index - 2])
+                    {
+                        wrong = true;
+                    }
+                }
+            });
+        }
+        for (auto& t : threads)
+        {
+            t.join();
+        }
+        REQUIRE_FALSE(wrong);
+        REQUIRE(produced_count == 90);
+    }
+}
@@ -0,0 +1,70 @@
+// Built with exceptions disabled, to make sure the headers compile and work without them.
+#include <cpplazy/cpplazy.hpp>
+#include <cpplazy/decoded.hpp>
+#include <cpplazy/expr.hpp>
+#include <cpplazy/json.hpp>
+#include <cpplazy/loader.hpp>
+#include <cpplazy/mapped.hpp>
+#include <cpplazy/memo.hpp>
+#include <cpplazy/metrics.hpp>
+#if defined(__linux__)
+#include <cpplazy/pages.hpp>
+#endif
+#include <cpplazy/parallel.hpp>
+#include <cpplazy/persistent.hpp>
+#include <cpplazy/prefetch.hpp>
+#include <cpplazy/seq.hpp>
+#include <cpplazy/table.hpp>
+#include <cpplazy/trace.hpp>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+#if CPPLAZY_HAS_EXCEPTIONS
+#error "This file should be compiled with exceptions disabled"
+#endif
+
+using namespace cpplazy;
+
+#define CHECK(expr) if (!(expr)) { std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #expr); return 1; }
+
+int main()
+{
+    int init_count = 0;
+    lazy_expected<int, std::string> the_answer{ [&]() -> expected<int, std::string> { ++init_count; return 42; } };
+    CHECK(the_answer->has_value());
+    CHECK(*the_answer.get() == 42);
+    CHECK(init_count == 1);
+
+    lazy_expected<std::string, int> config{ [&]() -> expected<std::string, int> { ++init_count; return unexpected<int>(2); } };
+    CHECK(!config->has_value());
+    CHECK(config->error() == 2);
+    CHECK(config->value_or("default") == "default");
+    CHECK(init_count == 2);
+
+    lazy<int> l{ [] { return 42; } };
+    CHECK(*l == 42);
+
+    // The other headers' CPPLAZY_HAS_EXCEPTIONS branches
+    CHECK(reduce(parallel_policy{ 2, 16 }, range(1, 1001), 0, std::plus<>()) == 500500);
+    CHECK(collect(parallel, range(0, 100).map([](int i) { return i * 2; })).size() == 100);
+    CHECK(prefetching(range(0, 100), 4).count() == 100);
+    memo_seq<int> memo{ range(0, 10) };
+    CHECK(memo.get(9) && *memo.get(9) == 9);
+
+    const std::string path = (std::filesystem::temp_directory_path() / 
+        ("cpplazy_no_exceptions_" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()))).string();
+    persistent_lazy<std::string> snapshot{ path, "key", [] { return std::string("value"); }, 
+        [](const std::string& value) { return value; }, [](std::string_view data) { return std::optional<std::string>(std::string(data)); } };
+    CHECK(*snapshot == "value");
+    CHECK(snapshot.status() == snapshot_status::written);
+    file_lazy<std::string> loaded{ path, [](std::string data, std::error_code error) { return error ? std::string() : data; } };
+    CHECK(loaded.get().size() > 5);
+    std::remove(path.c_str());
+
+    std::printf("All checks passed\n");
+    return 0;
+}
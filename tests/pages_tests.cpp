@@ -0,0 +1,157 @@
+#include "catch.hpp"
+#if defined(__linux__)
+#include <cpplazy/pages.hpp>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace cpplazy;
+
+namespace
+{
+    std::atomic<std::size_t> filled_elements{ 0 };
+
+    void fill_squares(std::size_t first, std::uint64_t* values, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; i++)
+        {
+            values[i] = (first + i) * (first + i);
+        }
+        filled_elements += count;
+    }
+
+    void check_mode(page_fault_mode mode)
+    {
+        filled_elements = 0;
+        const std::size_t count = 64 * 1024 * 1024; // 512MB of address space
+        lazy_pages<std::uint64_t> squares{ count, &fill_squares, 0, mode };
+        if (mode == page_fault_mode::userfaultfd && squares.error())
+        {
+            WARN("userfaultfd is not available: " << squares.error().message());
+            return;
+        }
+        REQUIRE(!squares.error());
+        REQUIRE(squares.filled() == 0);
+
+        // Touch 100 elements spread over the whole array, only their pages are filled
+        for (std::size_t i = 0; i < 100; i++)
+        {
+            const std::size_t index = i * (count / 100) + 7;
+            REQUIRE(squares[index] == index * index);
+        }
+        REQUIRE(squares.filled() == 100);
+        REQUIRE(filled_elements == 100 * squares.granule_size() / sizeof(std::uint64_t));
+
+        // Filled pages are plain memory from then on
+        squares[7] = 1;
+        REQUIRE(squares[7] == 1);
+        REQUIRE(squares.filled() == 100);
+        REQUIRE(squares[count - 1] == (count - 1) * (count - 1));
+    }
+}
+
+TEST_CASE("lazy_pages")
+{
+    SECTION("Automatic")
+    {
+        check_mode(page_fault_mode::automatic);
+    }
+
+    SECTION("userfaultfd")
+    {
+        check_mode(page_fault_mode::userfaultfd);
+    }
+
+    SECTION("Signal")
+    {
+        check_mode(page_fault_mode::signal);
+    }
+
+    SECTION("Larger granules and partial last granule")
+    {
+        for (page_fault_mode mode : { page_fault_mode::automatic, page_fault_mode::signal })
+        {
+            filled_elements = 0;
+            lazy_pages<std::uint64_t> squares{ 100'000, &fill_squares, 64 * 1024, mode };
+            REQUIRE(squares.granule_size() % (64 * 1024) == 0);
+            REQUIRE(squares[99'999] == 99'999ull * 99'999ull);
+            REQUIRE(squares.filled() == 1);
+            REQUIRE(filled_elements == 100'000 % (squares.granule_size() / sizeof(std::uint64_t)));
+        }
+    }
+
+    SECTION("Sizes that don't fit in memory")
+    {
+        for (page_fault_mode mode : { page_fault_mode::automatic, page_fault_mode::signal })
+        {
+            lazy_pages<std::uint64_t> huge{ SIZE_MAX / 4, &fill_squares, 0, mode };
+            REQUIRE(huge.error() == std::errc::value_too_large);
+            REQUIRE(huge.data() == nullptr);
+            REQUIRE(huge.begin() == huge.end());
+        }
+        lazy_pages<std::uint64_t> huge_granule{ 10, &fill_squares, SIZE_MAX - 1 };
+        REQUIRE(huge_granule.error() == std::errc::value_too_large);
+    }
+
+    SECTION("System calls need prefault()")
+    {
+        lazy_pages<std::uint64_t> squares{ 4096, &fill_squares, 0, page_fault_mode::signal };
+        const std::size_t per_page = squares.granule_size() / sizeof(std::uint64_t);
+        REQUIRE(squares.size() >= 5 * per_page);
+        int fds[2];
+        REQUIRE(::pipe(fds) == 0);
+
+        // The kernel doesn't raise SIGSEGV for its own accesses
+        REQUIRE(::write(fds[1], squares.data() + 1000, 8 * sizeof(std::uint64_t)) == -1);
+        REQUIRE(errno == EFAULT);
+        REQUIRE(squares.filled() == 0);
+
+        squares.prefault(1000, 8);
+        REQUIRE(squares.filled() == 1);
+        REQUIRE(::write(fds[1], squares.data() + 1000, 8 * sizeof(std::uint64_t)) == 8 * sizeof(std::uint64_t));
+        std::uint64_t values[8];
+        REQUIRE(::read(fds[0], values, sizeof(values)) == sizeof(values));
+        REQUIRE(values[7] == 1007 * 1007);
+
+        // Spanning two pages, and clamped to the array
+        const std::size_t before = squares.filled();
+        squares.prefault(3 * per_page - 1, 2);
+        REQUIRE(squares.filled() == before + 2);
+        squares.prefault(squares.size() - 1, 100);
+        REQUIRE(squares.filled() == before + 3);
+        ::close(fds[0]);
+        ::close(fds[1]);
+    }
+
+    SECTION("Concurrent first touches fill each granule once")
+    {
+        for (page_fault_mode mode : { page_fault_mode::automatic, page_fault_mode::signal })
+        {
+            lazy_pages<std::uint64_t> squares{ 1 << 20, &fill_squares, 0, mode };
+            std::vector<std::thread> threads;
+            std::atomic<bool> wrong{ false };
+            for (int t = 0; t < 4; t++)
+            {
+                threads.emplace_back([&] {
+                    for (std::size_t i = 0; i < squares.size(); i += 256) // Every page
+                    {
+                        if (squares[i] != i * i)
+                        {
+                            wrong = true;
+                        }
+                    }
+                });
+            }
+            for (auto& t : threads)
+            {
+                t.join();
+            }
+            REQUIRE_FALSE(wrong);
+            REQUIRE(squares.filled() == (squares.size() * sizeof(std::uint64_t) + squares.granule_size() - 1) / squares.granule_size());
+        }
+    }
+}
+#endif
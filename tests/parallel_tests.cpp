@@ -0,0 +1,117 @@
+#include "catch.hpp"
+#include <cpplazy/parallel.hpp>
+#include <atomic>
+#include <functional>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cpplazy;
+
+TEST_CASE("Parallel reductions")
+{
+    std::vector<double> values(100'000);
+    for (std::size_t i = 0; i < values.size(); i++)
+    {
+        values[i] = 1.0 / (i + 1);
+    }
+
+    SECTION("Same result whatever the threads")
+    {
+        const double one_thread = reduce(parallel_policy{ 1 }, from(values).map([](double v) { return v * 3; }), 0.0, std::plus<>());
+        for (unsigned threads : { 2u, 3u, 8u })
+        {
+            for (int run = 0; run < 3; run++)
+            {
+                REQUIRE(reduce(parallel_policy{ threads }, from(values).map([](double v) { return v * 3; }), 0.0, std::plus<>()) == one_thread); // Bit for bit
+            }
+        }
+    }
+
+    SECTION("Associative but not commutative operations keep their order")
+    {
+        auto letters = [] { return range(0, 5000).map([](int i) { return std::string(1, static_cast<char>('a' + i % 26)); }); };
+        const std::string expected = letters().reduce(std::string(">"), std::plus<>());
+        REQUIRE(reduce(parallel_policy{ 4, 7 }, letters(), std::string(">"), std::plus<>()) == expected);
+    }
+
+    SECTION("Folding into another type")
+    {
+        const std::vector<std::string> words(10'000, "word");
+        const std::size_t chars = reduce(parallel_policy{ 4 }, from(words), std::size_t(0), [](std::size_t n, const std::string& w) { return n + w.size(); }, std::plus<>());
+        REQUIRE(chars == 40'000);
+    }
+
+    SECTION("collect keeps the sequence order")
+    {
+        auto evens = [] { return range(0, 100'000).filter([](int i) { return i % 2 == 0; }).flat_map([](int i) { return std::vector<int>{ i, -i }; }); };
+        REQUIRE(collect(parallel_policy{ 4 }, evens()) == evens().collect());
+        REQUIRE(collect(sequential, evens()) == evens().collect());
+    }
+
+    SECTION("for_each runs on several threads")
+    {
+        std::atomic<long long> sum{ 0 };
+        std::mutex ids_mutex;
+        std::set<std::thread::id> ids;
+        for_each(parallel_policy{ 4, 1 }, range(0, 200), [&](int i) {
+            sum += i;
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            std::lock_guard<std::mutex> lock(ids_mutex);
+            ids.insert(std::this_thread::get_id());
+        });
+        REQUIRE(sum == 199 * 200 / 2);
+        REQUIRE(ids.size() > 1);
+    }
+
+    SECTION("Pipelines that can't be split run sequentially")
+    {
+        REQUIRE(reduce(parallel, iota(1).take(100), 0, std::plus<>()) == 5050);
+        REQUIRE(collect(parallel, range(0, 10).chunk(4)).size() == 3);
+    }
+
+    SECTION("A partially consumed flat_map inner sequence is not lost")
+    {
+        auto triples = [](int i) { return std::vector<int>{ 10 * i, 10 * i + 1, 10 * i + 2 }; };
+        const std::vector<int> expected{ 1, 2, 10, 11, 12, 20, 21, 22, 30, 31, 32 };
+
+        auto collected = range(0, 4).flat_map(triples);
+        REQUIRE(collected.next() == 0);
+        REQUIRE(collect(parallel_policy{ 2, 1 }, std::move(collected)) == expected);
+
+        auto reduced = range(0, 4).flat_map(triples);
+        reduced.next();
+        REQUIRE(reduce(parallel_policy{ 2, 1 }, std::move(reduced), 0, std::plus<>()) == 1 + 2 + 33 + 63 + 93);
+
+        auto split = range(0, 4).flat_map(triples);
+        REQUIRE(split.source().can_split());
+        split.next();
+        REQUIRE_FALSE(split.source().can_split());
+    }
+
+    SECTION("Nested parallel calls")
+    {
+        const long long total = reduce(parallel_policy{ 4, 1 }, range(0, 16), 0LL, [](long long sum, long long i) {
+            return sum + reduce(parallel_policy{ 4 }, range(0LL, i * 1000), 0LL, std::plus<>());
+        }, std::plus<>());
+        long long expected = 0;
+        for (long long i = 0; i < 16; i++)
+        {
+            expected += (i * 1000) * (i * 1000 - 1) / 2;
+        }
+        REQUIRE(total == expected);
+    }
+
+    SECTION("Exceptions propagate to the caller")
+    {
+        REQUIRE_THROWS_AS(for_each(parallel_policy{ 4 }, range(0, 10'000), [](int i) {
+            if (i == 5000)
+            {
+                throw std::runtime_error("bad element");
+            }
+        }), std::runtime_error);
+        REQUIRE(reduce(parallel_policy{ 4 }, range(0, 10), 0, std::plus<>()) == 45); // The pool is still usable
+    }
+}
@@ -0,0 +1,47 @@
+// Built with CPPLAZY_ENABLE_INSTRUMENTATION, CPPLAZY_ENABLE_TRACING and CPPLAZY_ENABLE_PERF_COUNTERS (see CMakeLists.txt)
+#include "catch.hpp"
+#include <cpplazy/cpplazy.hpp>
+#include <cpplazy/metrics.hpp>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <vector>
+
+using namespace cpplazy;
+
+TEST_CASE("Perf counters")
+{
+    const size_t size = 16 * 1024 * 1024;
+    lazy<std::unique_ptr<char[]>> touches_memory{ "touches_memory", [size] {
+        std::unique_ptr<char[]> buffer(new char[size]);
+        std::memset(buffer.get(), 1, size); // Faults in every page
+        return buffer;
+    } };
+    REQUIRE((*touches_memory)[size - 1] == 1);
+    const lazy_stats stats = touches_memory.stats();
+
+    if (!perf_counters_available())
+    {
+        WARN("perf events are not permitted, counters should stay zero");
+        REQUIRE(stats.page_faults == 0);
+        REQUIRE(stats.cycles == 0);
+        return;
+    }
+
+    // Hardware counters are often not available (e.g. in VMs), so only page faults are required
+    REQUIRE(stats.page_faults >= size / 4096 / 2);
+
+    SECTION("Nested initializations are included in the outer one")
+    {
+        lazy<long> inner{ [] { std::vector<long> v(1 << 20, 1); return std::accumulate(v.begin(), v.end(), 0L); } };
+        lazy<long> outer{ [&] { return *inner + 1; } };
+        REQUIRE(*outer == (1 << 20) + 1);
+        REQUIRE(outer.stats().page_faults >= inner.stats().page_faults);
+        REQUIRE(inner.stats().page_faults > 0);
+    }
+
+    SECTION("Metrics")
+    {
+        REQUIRE(format_metrics().find("cpplazy_init_page_faults{name=\"touches_memory\"} " + std::to_string(stats.page_faults)) != std::string::npos);
+    }
+}
@@ -0,0 +1,147 @@
+#include "catch.hpp"
+#include <cpplazy/persistent.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cpplazy;
+
+namespace
+{
+    int computed = 0;
+
+    std::vector<int> compute_table()
+    {
+        computed++;
+        return { 1, 2, 3, 42 };
+    }
+
+    std::string save_table(const std::vector<int>& table)
+    {
+        return std::string(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(int));
+    }
+
+    std::optional<std::vector<int>> load_table(std::string_view data)
+    {
+        if (data.size() % sizeof(int))
+        {
+            return std::nullopt;
+        }
+        std::vector<int> table(data.size() / sizeof(int));
+        std::memcpy(table.data(), data.data(), data.size());
+        return table;
+    }
+
+    persistent_lazy<std::vector<int>> make_table(const std::string& path, const std::string& key)
+    {
+        return persistent_lazy<std::vector<int>>(path, key, &compute_table, &save_table, &load_table);
+    }
+
+    std::string temp_snapshot_path()
+    {
+        const auto unique = std::chrono::steady_clock::now().time_since_epoch().count();
+        return (std::filesystem::temp_directory_path() / ("cpplazy_test_" + std::to_string(unique) + ".snapshot")).string();
+    }
+}
+
+TEST_CASE("persistent_lazy")
+{
+    computed = 0;
+    const std::string path = temp_snapshot_path();
+
+    SECTION("Computed and written on the first run, loaded on the next")
+    {
+        auto first = make_table(path, "inputs-v1");
+        REQUIRE(first.status() == snapshot_status::none);
+        REQUIRE(*first == std::vector<int>{ 1, 2, 3, 42 });
+        REQUIRE(first.status() == snapshot_status::written);
+        REQUIRE(computed == 1);
+
+        auto second = make_table(path, "inputs-v1");
+        REQUIRE(*second == std::vector<int>{ 1, 2, 3, 42 });
+        REQUIRE(second.status() == snapshot_status::loaded);
+        REQUIRE(computed == 1);
+    }
+
+    SECTION("A different key recomputes and replaces the snapshot")
+    {
+        *make_table(path, "inputs-v1");
+        auto changed = make_table(path, "inputs-v2");
+        *changed;
+        REQUIRE(changed.status() == snapshot_status::written);
+        REQUIRE(computed == 2);
+
+        auto next = make_table(path, "inputs-v2");
+        *next;
+        REQUIRE(next.status() == snapshot_status::loaded);
+        REQUIRE(computed == 2);
+    }
+
+    SECTION("Corrupt snapshots are recomputed")
+    {
+        *make_table(path, "inputs-v1");
+        std::FILE* file = std::fopen(path.c_str(), "r+b");
+        REQUIRE(file);
+        std::fseek(file, -1, SEEK_END);
+        std::fputc('x', file);
+        std::fclose(file);
+
+        auto table = make_table(path, "inputs-v1");
+        REQUIRE(*table == std::vector<int>{ 1, 2, 3, 42 });
+        REQUIRE(table.status() == snapshot_status::written);
+        REQUIRE(computed == 2);
+    }
+
+    SECTION("Rejected by the deserializer")
+    {
+        persistent_lazy<std::vector<int>> table{ path, "inputs-v1", &compute_table, &save_table, [](std::string_view) { return std::optional<std::vector<int>>(); } };
+        *table;
+        persistent_lazy<std::vector<int>> again{ path, "inputs-v1", &compute_table, &save_table, [](std::string_view) { return std::optional<std::vector<int>>(); } };
+        *again;
+        REQUIRE(again.status() == snapshot_status::written);
+        REQUIRE(computed == 2);
+    }
+
+    SECTION("Objects writing the same path from several threads")
+    {
+        std::vector<std::thread> threads;
+        std::atomic<int> written{ 0 };
+        std::atomic<int> wrong{ 0 };
+        for (int t = 0; t < 4; t++)
+        {
+            threads.emplace_back([&] {
+                for (int i = 0; i < 20; i++)
+                {
+                    persistent_lazy<std::vector<int>> table{ path, "inputs-v1", [] { return std::vector<int>(100'000, 7); }, &save_table, &load_table };
+                    wrong += *table != std::vector<int>(100'000, 7);
+                    written += table.status() == snapshot_status::written;
+                    wrong += table.status() == snapshot_status::write_failed; // Another thread renamed the same temporary file away
+                }
+            });
+        }
+        for (auto& t : threads)
+        {
+            t.join();
+        }
+        REQUIRE(wrong == 0);
+        REQUIRE(written >= 1);
+
+        persistent_lazy<std::vector<int>> next{ path, "inputs-v1", &compute_table, &save_table, &load_table };
+        REQUIRE(*next == std::vector<int>(100'000, 7));
+        REQUIRE(next.status() == snapshot_status::loaded);
+    }
+
+    SECTION("Write failures don't fail the initialization")
+    {
+        auto table = make_table("/nonexistent-directory/table.snapshot", "inputs-v1");
+        REQUIRE(*table == std::vector<int>{ 1, 2, 3, 42 });
+        REQUIRE(table.status() == snapshot_status::write_failed);
+    }
+
+    std::remove(path.c_str());
+}
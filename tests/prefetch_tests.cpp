@@ -0,0 +1,144 @@
+#include "catch.hpp"
+#include <cpplazy/prefetch.hpp>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace cpplazy;
+
+TEST_CASE("prefetching")
+{
+    std::atomic<int> produced{ 0 };
+
+    SECTION("Same elements, produced on another thread")
+    {
+        const std::thread::id consumer = std::this_thread::get_id();
+        std::atomic<bool> same_thread{ false };
+        auto seq = prefetching(range(0, 1000).map([&](int i) {
+            same_thread = same_thread || std::this_thread::get_id() == consumer;
+            return i * 2;
+        }), 8);
+        const std::vector<int> values = seq.collect();
+        REQUIRE(values.size() == 1000);
+        REQUIRE(values[999] == 1998);
+        REQUIRE_FALSE(same_thread);
+    }
+
+    SECTION("Nothing runs before the first element is asked for")
+    {
+        auto seq = prefetching(range(0, 10).map([&](int i) {
+            produced++;
+            return i;
+        }));
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        REQUIRE(produced == 0);
+        REQUIRE(seq.next() == 0);
+    }
+
+    SECTION("The producer stays at most depth elements ahead")
+    {
+        std::atomic<int> consumed{ 0 };
+        std::atomic<int> most_ahead{ 0 };
+        auto seq = prefetching(range(0, 200).map([&](int i) {
+            const int ahead = ++produced - consumed;
+            if (ahead > most_ahead)
+            {
+                most_ahead = ahead;
+            }
+            return i;
+        }), 4);
+        for (int i : seq)
+        {
+            REQUIRE(i == consumed);
+            if (i % 20 == 0)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1)); // Lets the producer fill the ring
+            }
+            consumed++;
+        }
+        REQUIRE(consumed == 200);
+        REQUIRE(most_ahead <= 4 + 2); // The ring, the element being consumed and the one being produced
+    }
+
+    SECTION("Stopping early cancels the producer")
+    {
+        {
+            auto seq = prefetching(iota(0).map([&](int i) {
+                produced++;
+                return i;
+            }), 4);
+            int count = 0;
+            for (int i : seq)
+            {
+                REQUIRE(i == count);
+                if (++count == 5)
+                {
+                    break;
+                }
+            }
+        }
+        const int after_destruction = produced;
+        REQUIRE(after_destruction <= 5 + 4 + 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        REQUIRE(produced == after_destruction);
+    }
+
+    SECTION("Exceptions reach the consumer after the elements before them")
+    {
+        auto seq = prefetching(range(0, 10).map([](int i) {
+            if (i == 3)
+            {
+                throw std::runtime_error("decode failed");
+            }
+            return i;
+        }));
+        REQUIRE(seq.next() == 0);
+        REQUIRE(seq.next() == 1);
+        REQUIRE(seq.next() == 2);
+        REQUIRE_THROWS_AS(seq.next(), std::runtime_error);
+        REQUIRE_FALSE(seq.next());
+    }
+
+    SECTION("Custom executor")
+    {
+        int started = 0;
+        std::thread worker;
+        auto executor = [&](std::function<void()> task) {
+            started++;
+            worker = std::thread(std::move(task));
+        };
+        {
+            auto seq = prefetching(range(0, 100), 2, executor);
+            REQUIRE(seq.count() == 100);
+        }
+        worker.join();
+        REQUIRE(started == 1);
+    }
+
+    SECTION("An executor that throws leaves nothing to wait for")
+    {
+        int calls = 0;
+        std::thread worker;
+        auto executor = [&](std::function<void()> task) {
+            if (calls++ == 0)
+            {
+                throw std::runtime_error("no thread available");
+            }
+            worker = std::thread(std::move(task));
+        };
+        {
+            auto failed = prefetching(range(0, 10), 2, executor);
+            REQUIRE_THROWS_AS(failed.next(), std::runtime_error);
+            REQUIRE(failed.next() == 0); // Tries again
+        }
+        worker.join();
+        REQUIRE(calls == 2);
+
+        {
+            auto never_started = prefetching(range(0, 10), 2, [](std::function<void()>) { throw std::runtime_error("rejected"); });
+            REQUIRE_THROWS_AS(never_started.next(), std::runtime_error);
+        } // Doesn't wait for a producer that never ran
+    }
+}
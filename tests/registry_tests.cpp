@@ -0,0 +1,161 @@
+// Built with CPPLAZY_ENABLE_INSTRUMENTATION, CPPLAZY_ENABLE_TRACING and CPPLAZY_ENABLE_PERF_COUNTERS (see CMakeLists.txt)
+#include "catch.hpp"
+#include <cpplazy/cpplazy.hpp>
+#include <cpplazy/metrics.hpp>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <csignal>
+#include <unistd.h>
+
+using namespace cpplazy;
+using namespace std::literals;
+
+namespace
+{
+    std::optional<lazy_info> find_registered(const std::string& name)
+    {
+        std::optional<lazy_info> found;
+        for_each_registered([&](const lazy_info& info) { if (info.name == name) found = info; });
+        return found;
+    }
+
+    CPPLAZY_CONSTINIT lazy_static registered_static{ [] { return 42; } };
+    static_registration registered_static_registration{ registered_static, "registered_static" };
+}
+
+TEST_CASE("Named lazy registry")
+{
+    SECTION("State and value size")
+    {
+        lazy<std::vector<long>> numbers{ "numbers", [] { return std::vector<long>(1000); } };
+        std::optional<lazy_info> info = find_registered("numbers");
+        REQUIRE(info);
+        REQUIRE(info->state == lazy_state::uninitialized);
+        REQUIRE(info->value_size == 0);
+
+        REQUIRE(numbers->value().size() == 1000);
+        info = find_registered("numbers");
+        REQUIRE(info->state == lazy_state::initialized);
+        REQUIRE(info->value_size >= 1000 * sizeof(long));
+    }
+
+    SECTION("Destroyed objects are removed")
+    {
+        {
+            lazy<int> temporary{ "temporary", [] { return 42; } };
+            REQUIRE(find_registered("temporary"));
+        }
+        REQUIRE_FALSE(find_registered("temporary"));
+    }
+
+    SECTION("Moves take the name along")
+    {
+        std::vector<lazy<int>> lazies;
+        lazies.emplace_back("first", [] { return 1; });
+        lazies.emplace_back("second", [] { return 2; });
+        REQUIRE(*lazies[1] == 2);
+        lazies.erase(lazies.begin());
+        REQUIRE_FALSE(find_registered("first"));
+        std::optional<lazy_info> info = find_registered("second");
+        REQUIRE(info);
+        REQUIRE(info->state == lazy_state::initialized);
+        REQUIRE(info->stats.init_time > 0ns);
+    }
+
+    SECTION("Failures")
+    {
+        lazy<int> failing{ "failing", []() -> int { throw std::runtime_error("can't open config file"); } };
+        REQUIRE_FALSE(failing->has_value());
+        REQUIRE(find_registered("failing")->stats.failures == 1);
+    }
+
+    SECTION("Other named types")
+    {
+        once_cell<std::string> cell{ "cell" };
+        run_once action{ "action", [] {} };
+        lazy_expected<int, int> expected_value{ "expected", []() -> expected<int, int> { return 1; } };
+        action.ensure();
+        REQUIRE(find_registered("cell"));
+        REQUIRE(find_registered("action")->state == lazy_state::initialized);
+        REQUIRE(find_registered("expected"));
+        REQUIRE(find_registered("registered_static"));
+    }
+
+    SECTION("Concurrent registration and enumeration")
+    {
+        std::atomic<bool> done{ false };
+        std::atomic<bool> unnamed_listed{ false };
+        std::thread enumerator([&] {
+            while (!done)
+            {
+                for_each_registered([&](const lazy_info& info) { unnamed_listed = unnamed_listed || info.name.empty(); });
+            }
+        });
+        for (int i = 0; i < 1000; i++)
+        {
+            lazy<int> l{ "churn" + std::to_string(i % 10), [] { return 1; } };
+            *l;
+        }
+        done = true;
+        enumerator.join();
+        REQUIRE_FALSE(unnamed_listed);
+    }
+}
+
+TEST_CASE("Metrics dump")
+{
+    lazy<std::string> config{ "config \"main\"", [] { return "config"s; } };
+    *config;
+
+    SECTION("Prometheus")
+    {
+        const std::string text = format_metrics(metrics_format::prometheus);
+        REQUIRE(text.find("# TYPE cpplazy_initialized gauge\n") != std::string::npos);
+        REQUIRE(text.find("cpplazy_initialized{name=\"config \\\"main\\\"\"} 1\n") != std::string::npos);
+        REQUIRE(text.find("cpplazy_init_failures_total{name=\"config \\\"main\\\"\"} 0\n") != std::string::npos);
+    }
+
+    SECTION("JSON")
+    {
+        const std::string json = format_metrics(metrics_format::json);
+        REQUIRE(json.rfind("{\"lazies\":[", 0) == 0);
+        REQUIRE(json.find("{\"name\":\"config \\\"main\\\"\",\"state\":\"initialized\"") != std::string::npos);
+    }
+
+    SECTION("File descriptor")
+    {
+        int fds[2];
+        REQUIRE(::pipe(fds) == 0);
+        REQUIRE(write_metrics(fds[1], metrics_format::json));
+        ::close(fds[1]);
+        char buffer[4096];
+        const ssize_t n = ::read(fds[0], buffer, sizeof(buffer));
+        ::close(fds[0]);
+        REQUIRE(n > 0);
+        REQUIRE(std::string(buffer, 11) == "{\"lazies\":[");
+    }
+
+    SECTION("On signal")
+    {
+        const std::string path = "cpplazy_metrics_test.prom";
+        std::remove(path.c_str());
+        REQUIRE(dump_metrics_on_signal(SIGUSR1, path));
+        REQUIRE_FALSE(dump_metrics_on_signal(SIGUSR1, path));
+        std::raise(SIGUSR1);
+        std::string contents;
+        for (int i = 0; i < 200 && contents.find("config") == std::string::npos; i++)
+        {
+            std::this_thread::sleep_for(5ms);
+            std::ifstream file(path);
+            std::stringstream ss;
+            ss << file.rdbuf();
+            contents = ss.str();
+        }
+        REQUIRE(contents.find("cpplazy_initialized{name=\"config \\\"main\\\"\"} 1") != std::string::npos);
+        std::remove(path.c_str());
+    }
+}
@@ -0,0 +1,121 @@
+#include "catch.hpp"
+#include <cpplazy/seq.hpp>
+#include <climits>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace cpplazy;
+
+namespace
+{
+    // Numbers from 1, one by one, counting how many were produced
+    lazy_seq<int> counting(int& produced)
+    {
+        return generate([&produced, i = 0]() mutable -> std::optional<int> {
+            produced++;
+            return ++i;
+        });
+    }
+}
+
+TEST_CASE("lazy_seq")
+{
+    SECTION("Nothing runs until iterated")
+    {
+        int calls = 0;
+        auto seq = range(0, 10).map([&calls](int i) {
+            calls++;
+            return i * 2;
+        });
+        REQUIRE(calls == 0);
+        REQUIRE(seq.collect() == std::vector<int>{ 0, 2, 4, 6, 8, 10, 12, 14, 16, 18 });
+        REQUIRE(calls == 10);
+    }
+
+    SECTION("map, filter and reduce")
+    {
+        const long long sum = range(0, 1000)
+            .filter([](int i) { return i % 3 == 0; })
+            .map([](int i) { return static_cast<long long>(i) * i; })
+            .reduce(0LL, [](long long a, long long b) { return a + b; });
+        long long expected = 0;
+        for (int i = 0; i < 1000; i += 3)
+        {
+            expected += static_cast<long long>(i) * i;
+        }
+        REQUIRE(sum == expected);
+    }
+
+    SECTION("take and take_while stop the source early")
+    {
+        int produced = 0;
+        REQUIRE(counting(produced).take(5).collect() == std::vector<int>{ 1, 2, 3, 4, 5 });
+        REQUIRE(produced == 5);
+
+        produced = 0;
+        REQUIRE(counting(produced).take_while([](int i) { return i * i < 50; }).count() == 7);
+        REQUIRE(produced == 8);
+
+        REQUIRE(iota(1).filter([](int i) { return i % 7 == 0; }).take(3).collect() == std::vector<int>{ 7, 14, 21 });
+        REQUIRE(range(0, 10).take(0).count() == 0);
+    }
+
+    SECTION("flat_map with sequences and containers")
+    {
+        auto nested = range(1, 4).flat_map([](int i) { return range(0, i); });
+        REQUIRE(nested.collect() == std::vector<int>{ 0, 0, 1, 0, 1, 2 });
+
+        auto words = from(std::vector<std::string>{ "ab", "cde" }).flat_map([](const std::string& s) { return std::vector<char>(s.begin(), s.end()); });
+        REQUIRE(std::move(words).take(4).collect() == std::vector<char>{ 'a', 'b', 'c', 'd' });
+    }
+
+    SECTION("zip and chunk")
+    {
+        const std::vector<std::string> names{ "a", "b", "c" };
+        auto pairs = from(names).zip(iota(10)).collect();
+        REQUIRE(pairs.size() == 3);
+        REQUIRE(pairs[2] == std::make_pair(std::string("c"), 12));
+
+        auto chunks = range(0, 7).chunk(3).collect();
+        REQUIRE(chunks == std::vector<std::vector<int>>{ { 0, 1, 2 }, { 3, 4, 5 }, { 6 } });
+        auto first = range(0, 7).chunk(3).take(1).collect();
+        REQUIRE(first == std::vector<std::vector<int>>{ { 0, 1, 2 } });
+    }
+
+    SECTION("Pulling and pushing give the same elements")
+    {
+        auto make = [] {
+            return range(0, 50).flat_map([](int i) { return range(0, i % 4); }).filter([](int i) { return i != 1; }).map([](int i) { return i + 1; }).chunk(4).take(6);
+        };
+        std::vector<std::vector<int>> pulled;
+        for (auto& chunk : make())
+        {
+            pulled.push_back(chunk);
+        }
+        REQUIRE(pulled == make().collect());
+    }
+
+    SECTION("Type erased sequences")
+    {
+        lazy_seq<int> erased = from(std::list<int>{ 1, 2, 3 }).map([](int i) { return i * 10; });
+        REQUIRE(erased.next() == 10);
+        REQUIRE(std::move(erased).map([](int i) { return i + 1; }).collect() == std::vector<int>{ 21, 31 });
+    }
+
+    SECTION("Move only elements and functions")
+    {
+        auto owned = range(0, 3).map([p = std::make_unique<int>(5)](int i) { return std::make_unique<int>(i + *p); }).collect();
+        REQUIRE(owned.size() == 3);
+        REQUIRE(*owned[2] == 7);
+    }
+
+    SECTION("Ranges wider than their integer type can count")
+    {
+        auto wide = range(INT_MIN, INT_MAX);
+        REQUIRE(wide.source().size() == std::size_t(UINT_MAX));
+        REQUIRE(lazy_seq<int, decltype(wide.source().slice(0, 0))>(wide.source().slice(UINT_MAX - 2, UINT_MAX)).collect() == std::vector<int>{ INT_MAX - 2, INT_MAX - 1 });
+        REQUIRE_FALSE(iota(0).source().can_split());
+    }
+}
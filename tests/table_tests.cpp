@@ -0,0 +1,170 @@
+#include "catch.hpp"
+#include <cpplazy/table.hpp>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cpplazy;
+
+namespace
+{
+    std::string make_table(std::size_t rows, int extra_columns)
+    {
+        std::vector<std::int64_t> ids(rows);
+        std::vector<double> amounts(rows);
+        std::vector<std::string> cities(rows);
+        for (std::size_t i = 0; i < rows; i++)
+        {
+            ids[i] = 1000 + static_cast<std::int64_t>(i) * 3 - (i % 2 ? 5 : 0);
+            amounts[i] = i * 0.5;
+            cities[i] = i % 3 ? "Oslo" : "A city name longer than the small string buffer";
+        }
+        table_writer writer{ rows };
+        REQUIRE(writer.add("id", ids, column_encoding::delta));
+        REQUIRE(writer.add("amount", amounts));
+        REQUIRE(writer.add("city", cities, column_encoding::dictionary));
+        REQUIRE(writer.add("name", cities));
+        for (int c = 0; c < extra_columns; c++)
+        {
+            REQUIRE(writer.add("extra" + std::to_string(c), ids));
+        }
+        REQUIRE_FALSE(writer.add("wrong size", std::vector<double>(rows + 1)));
+        REQUIRE_FALSE(writer.add("wrong encoding", amounts, column_encoding::delta));
+        return writer.bytes();
+    }
+}
+
+TEST_CASE("lazy_table")
+{
+    SECTION("Columns are decoded on first access only")
+    {
+        lazy_table table = lazy_table::from_bytes(make_table(1000, 200));
+        REQUIRE(table.rows() == 1000);
+        REQUIRE(table.columns() == 204);
+        REQUIRE(table.decoded_bytes() == 0);
+
+        const std::vector<double>* amounts = table.column<double>("amount");
+        REQUIRE(amounts);
+        REQUIRE((*amounts)[999] == 499.5);
+        REQUIRE(table.is_decoded("amount"));
+        REQUIRE_FALSE(table.is_decoded("id"));
+        REQUIRE_FALSE(table.is_decoded("extra7"));
+        REQUIRE(table.decoded_bytes() == 1000 * sizeof(double));
+        REQUIRE(table.column<double>("amount") == amounts); // Cached
+    }
+
+    SECTION("Encodings")
+    {
+        lazy_table table = lazy_table::from_bytes(make_table(100, 1));
+        const std::vector<std::int64_t>* ids = table.column<std::int64_t>("id");
+        REQUIRE(ids->size() == 100);
+        REQUIRE((*ids)[0] == 1000);
+        REQUIRE((*ids)[1] == 998);
+        REQUIRE((*ids)[99] == 1000 + 99 * 3 - 5);
+        REQUIRE(*table.column<std::int64_t>("extra0") == *ids);
+        REQUIRE(*table.column<std::string>("city") == *table.column<std::string>("name"));
+        REQUIRE((*table.column<std::string>(std::size_t(2)))[1] == "Oslo");
+        REQUIRE(table.column_name(3) == "name");
+        REQUIRE(table.type("city") == column_type::string);
+    }
+
+    SECTION("Missing columns and wrong types")
+    {
+        lazy_table table = lazy_table::from_bytes(make_table(10, 0));
+        REQUIRE(table.column<double>("missing") == nullptr);
+        REQUIRE(table.column<double>("id") == nullptr);
+        REQUIRE(table.column<double>(std::size_t(100)) == nullptr);
+        REQUIRE_FALSE(table.type("missing"));
+    }
+
+    SECTION("Released columns are decoded again")
+    {
+        lazy_table table = lazy_table::from_bytes(make_table(100, 0));
+        REQUIRE(table.column<std::string>("name"));
+        REQUIRE(table.column<std::int64_t>("id"));
+        REQUIRE(table.decoded_bytes() > 0);
+        table.release("name");
+        REQUIRE_FALSE(table.is_decoded("name"));
+        REQUIRE(table.is_decoded("id"));
+        table.release_all();
+        REQUIRE(table.decoded_bytes() == 0);
+        REQUIRE((*table.column<std::string>("name"))[0] == "A city name longer than the small string buffer");
+    }
+
+    SECTION("Moving keeps the table readable")
+    {
+        lazy_table table = lazy_table::from_bytes(make_table(3, 0));
+        REQUIRE(table.columns() == 4);
+        lazy_table moved = std::move(table);
+        REQUIRE((*moved.column<std::string>("city"))[2] == "Oslo");
+    }
+
+    SECTION("From a file")
+    {
+        const auto unique = std::chrono::steady_clock::now().time_since_epoch().count();
+        const std::string path = (std::filesystem::temp_directory_path() / ("cpplazy_test_" + std::to_string(unique) + ".table")).string();
+        const std::string bytes = make_table(50, 0);
+        std::FILE* file = std::fopen(path.c_str(), "wb");
+        REQUIRE(file);
+        REQUIRE(std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size());
+        std::fclose(file);
+
+        lazy_table table{ path };
+        REQUIRE(!table.error());
+        REQUIRE((*table.column<double>("amount"))[10] == 5.0);
+        std::remove(path.c_str());
+
+        lazy_table missing{ path };
+        REQUIRE(missing.error() == std::errc::no_such_file_or_directory);
+        REQUIRE(missing.rows() == 0);
+    }
+
+    SECTION("Malformed tables")
+    {
+        REQUIRE(lazy_table::from_bytes("not a table").error() == std::errc::illegal_byte_sequence);
+        std::string truncated = make_table(10, 0);
+        truncated.pop_back();
+        REQUIRE(lazy_table::from_bytes(truncated).error());
+
+        // A huge row count is rejected, not allocated
+        std::string huge("CPPLZTB1", 8);
+        detail::write_varint(huge, std::uint64_t(1) << 61);
+        detail::write_varint(huge, 1);
+        huge += "\x01" "a";
+        huge += static_cast<char>(column_type::int64);
+        huge += static_cast<char>(column_encoding::plain);
+        detail::write_varint(huge, 0);
+        detail::write_varint(huge, 0);
+        REQUIRE(lazy_table::from_bytes(huge).error() == std::errc::illegal_byte_sequence);
+
+        detail::column_values values;
+        const std::size_t rows = std::size_t(1) << 61; // rows * 8 wraps to 0
+        REQUIRE_FALSE(detail::decode_column(column_type::int64, column_encoding::plain, "", rows, values));
+        REQUIRE_FALSE(detail::decode_column(column_type::float64, column_encoding::plain, "", rows, values));
+        REQUIRE_FALSE(detail::decode_column(column_type::int64, column_encoding::delta, "\x02", rows, values));
+        REQUIRE_FALSE(detail::decode_column(column_type::string, column_encoding::plain, "\x00", rows, values));
+        REQUIRE_FALSE(detail::decode_column(column_type::string, column_encoding::dictionary, "\x00", rows, values));
+    }
+
+    SECTION("Concurrent first access")
+    {
+        lazy_table table = lazy_table::from_bytes(make_table(10000, 0));
+        std::vector<std::thread> threads;
+        std::vector<const std::vector<std::int64_t>*> seen(4);
+        for (size_t i = 0; i < seen.size(); i++)
+        {
+            threads.emplace_back([&, i] { seen[i] = table.column<std::int64_t>("id"); });
+        }
+        for (auto& t : threads)
+        {
+            t.join();
+        }
+        for (const auto* ids : seen)
+        {
+            REQUIRE(ids == seen[0]);
+        }
+    }
+}
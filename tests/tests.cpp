@@ -1,11 +1,14 @@
 #include "catch.hpp"
-#include <cpplazy\cpplazy.hpp>
+#include <cpplazy/cpplazy.hpp>
 #include <thread>
 #include <string>
 #include <array>
 #include <vector>
 #include <memory>
 #include <type_traits>
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
 
 using namespace cpplazy;
 using namespace std::literals;
@@ -16,6 +19,13 @@ namespace
     {
         return 42;
     }
+
+    int static_init_count = 0;
+    CPPLAZY_CONSTINIT lazy_static static_answer{ [] { ++static_init_count; return 42; } };
+    CPPLAZY_CONSTINIT lazy_static static_name{ [] { return "lazy"s; } };
+    CPPLAZY_CONSTINIT lazy_static<int, int(*)()> static_foo{ &foo };
+    static_registration static_answer_registration{ static_answer, "static_answer" };
+    static_registration static_name_registration{ static_name, "static_name" };
 }
 TEST_CASE("Compilation Check")
 {
@@ -222,6 +232,264 @@ TEST_CASE("Move an already initialized lazy")
 
 }
 
+TEST_CASE("Move assignment and swap")
+{
+    int init_count = 0;
+    lazy<int> l1{ [&] { ++init_count; return 1; } };
+    lazy<int> l2{ [&] { ++init_count; return 2; } };
+
+    SECTION("Move assign an initialized lazy")
+    {
+        REQUIRE(*l1 == 1);
+        l2 = std::move(l1);
+        REQUIRE(l2.is_initialized());
+        REQUIRE_FALSE(l1.is_initialized());
+        REQUIRE(*l2 == 1);
+        REQUIRE(init_count == 1);
+    }
+
+    SECTION("Move assign a non initialized lazy")
+    {
+        REQUIRE(*l2 == 2);
+        l2 = std::move(l1);
+        REQUIRE_FALSE(l2.is_initialized());
+        REQUIRE(*l2 == 1);
+        REQUIRE(init_count == 2);
+    }
+
+    SECTION("Moved-from lazy can be assigned to again")
+    {
+        lazy<int> l3 = std::move(l1);
+        l1 = lazy<int>{ [] { return 3; } };
+        REQUIRE(*l1 == 3);
+        REQUIRE(*l3 == 1);
+    }
+
+    SECTION("Swap")
+    {
+        REQUIRE(*l1 == 1);
+        swap(l1, l2);
+        REQUIRE_FALSE(l1.is_initialized());
+        REQUIRE(l2.is_initialized());
+        REQUIRE(*l1 == 2);
+        REQUIRE(*l2 == 1);
+        REQUIRE(init_count == 2);
+    }
+
+    static_assert(std::is_nothrow_move_assignable<lazy<int>>::value, "Moving a lazy int should not throw");
+    static_assert(std::is_nothrow_swappable<lazy<std::string>>::value, "Swapping a lazy string should not throw");
+}
+
+TEST_CASE("Lazy objects in containers")
+{
+    std::vector<lazy<int>> lazies;
+    for (int i = 0; i < 10; i++)
+    {
+        lazies.emplace_back([i] { return 9 - i; });
+    }
+    REQUIRE(*lazies[3] == 6);
+
+    lazies.erase(lazies.begin());
+    REQUIRE(lazies.size() == 9);
+    REQUIRE(*lazies[2] == 6);
+    REQUIRE(*lazies[0] == 8);
+
+    std::sort(lazies.begin(), lazies.end(), [](const lazy<int>& lhs, const lazy<int>& rhs) { return *lhs < *rhs; });
+    for (int i = 0; i < 9; i++)
+    {
+        REQUIRE(*lazies[i] == i);
+    }
+}
+
+TEST_CASE("take and reset")
+{
+    int init_count = 0;
+    lazy<std::unique_ptr<int>> l{ [&] { ++init_count; return std::make_unique<int>(42); } };
+
+    std::optional<std::unique_ptr<int>> taken = l.take();
+    REQUIRE(init_count == 1);
+    REQUIRE(taken.has_value());
+    REQUIRE(**taken == 42);
+    REQUIRE_FALSE(l.is_initialized());
+
+    REQUIRE(**l == 42);
+    REQUIRE(init_count == 2);
+
+    l.reset();
+    REQUIRE_FALSE(l.is_initialized());
+    REQUIRE(**l == 42);
+    REQUIRE(init_count == 3);
+}
+
+
+TEST_CASE("lazy_expected")
+{
+    int init_count = 0;
+
+    SECTION("Value")
+    {
+        lazy_expected<int, std::string> l{ [&]() -> expected<int, std::string> { ++init_count; return 42; } };
+        REQUIRE_FALSE(l.is_initialized());
+        REQUIRE(l->has_value());
+        REQUIRE(**l == 42);
+        REQUIRE(l.get().value_or(0) == 42);
+        REQUIRE(init_count == 1);
+    }
+
+    SECTION("Error is cached")
+    {
+        lazy_expected<int, std::string> l{ [&]() -> expected<int, std::string> { ++init_count; return unexpected<std::string>("can't open config file"); } };
+        REQUIRE_FALSE(l->has_value());
+        REQUIRE(l->error() == "can't open config file");
+        REQUIRE(l->value_or(7) == 7);
+        REQUIRE(init_count == 1);
+
+        l.reset();
+        REQUIRE_FALSE(l->has_value());
+        REQUIRE(init_count == 2);
+    }
+
+    SECTION("Move")
+    {
+        lazy_expected<std::string, int> l{ [&]() -> expected<std::string, int> { ++init_count; return "lazy"; } };
+        REQUIRE(*l.get() == "lazy");
+        lazy_expected<std::string, int> l2 = std::move(l);
+        REQUIRE(l2.is_initialized());
+        REQUIRE(l2->has_value());
+        REQUIRE(l2.get()->size() == 4);
+        REQUIRE(init_count == 1);
+    }
+}
+
+TEST_CASE("lazy<void>")
+{
+    static_assert(sizeof(lazy<void>) <= sizeof(std::function<void()>) + alignof(std::function<void()>), "lazy<void> should only add a state word");
+    static_assert(sizeof(detail::once_state) == 1 || CPPLAZY_ENABLE_INSTRUMENTATION, "Instrumentation should cost nothing when disabled");
+
+    int run_count = 0;
+    run_once register_handlers{ [&] { ++run_count; } };
+    REQUIRE_FALSE(register_handlers.is_initialized());
+    for (size_t i = 0; i < 10; i++)
+    {
+        REQUIRE(register_handlers.ensure());
+    }
+    REQUIRE(run_count == 1);
+    REQUIRE(register_handlers.is_initialized());
+
+    SECTION("Failed action is retried")
+    {
+        int attempts = 0;
+        lazy<void> open_log{ [&] { if (++attempts < 3) throw std::runtime_error("can't open log file"); } };
+        REQUIRE_FALSE(open_log.ensure());
+        REQUIRE_FALSE(open_log.ensure());
+        REQUIRE(open_log.ensure());
+        REQUIRE(open_log.ensure());
+        REQUIRE(attempts == 3);
+    }
+
+    SECTION("Move and reset")
+    {
+        lazy<void> moved = std::move(register_handlers);
+        REQUIRE(moved.is_initialized());
+        REQUIRE(moved.ensure());
+        REQUIRE(run_count == 1);
+        moved.reset();
+        REQUIRE(moved.ensure());
+        REQUIRE(run_count == 2);
+    }
+
+    SECTION("Thread safe")
+    {
+        std::atomic<int> concurrent_run_count{ 0 };
+        lazy<void> detect_cpu_features{ [&] { std::this_thread::sleep_for(10ms); ++concurrent_run_count; } };
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < 4; i++)
+        {
+            threads.emplace_back([&] { detect_cpu_features.ensure(); });
+        }
+        for (auto& t : threads)
+        {
+            t.join();
+        }
+        REQUIRE(concurrent_run_count == 1);
+    }
+}
+
+TEST_CASE("once_cell")
+{
+    once_cell<std::string> cell;
+    REQUIRE(cell.get() == nullptr);
+    REQUIRE_FALSE(cell.is_initialized());
+
+    SECTION("set succeeds only once")
+    {
+        REQUIRE(cell.set("first"));
+        REQUIRE_FALSE(cell.set("second"));
+        REQUIRE(*cell.get() == "first");
+        REQUIRE(cell.get_or_init([] { return "third"s; }) == "first");
+        REQUIRE(cell.wait() == "first");
+    }
+
+    SECTION("get_or_init")
+    {
+        int init_count = 0;
+        REQUIRE(cell.get_or_init([&] { ++init_count; return "lazy"s; }) == "lazy");
+        REQUIRE(cell.get_or_init([&] { ++init_count; return "lazier"s; }) == "lazy");
+        REQUIRE_FALSE(cell.set("second"));
+        REQUIRE(init_count == 1);
+    }
+
+    SECTION("Failed get_or_init leaves the cell empty")
+    {
+        REQUIRE_THROWS_AS(cell.get_or_init([]() -> std::string { throw std::runtime_error("failed"); }), std::runtime_error);
+        REQUIRE_FALSE(cell.is_initialized());
+        REQUIRE(cell.set("second"));
+        REQUIRE(*cell.get() == "second");
+    }
+
+    SECTION("wait for another thread to set the value")
+    {
+        std::string waited;
+        std::thread consumer([&] { waited = cell.wait(); });
+        std::thread producer([&] { std::this_thread::sleep_for(10ms); cell.set("produced"); });
+        producer.join();
+        consumer.join();
+        REQUIRE(waited == "produced");
+    }
+
+    SECTION("take and reset")
+    {
+        cell.set("value");
+        once_cell<std::string> moved = std::move(cell);
+        REQUIRE_FALSE(cell.is_initialized());
+        REQUIRE(moved.take() == "value"s);
+        REQUIRE_FALSE(moved.is_initialized());
+        REQUIRE(moved.set("again"));
+    }
+}
+
+TEST_CASE("lazy_static")
+{
+    REQUIRE(*static_foo == 42);
+    REQUIRE(static_name->value() == "lazy");
+
+    REQUIRE(static_init_count == 0);
+    REQUIRE_FALSE(static_answer.is_initialized());
+
+    std::vector<std::string> names;
+    static_registration::for_each([&](const static_registration& r) { names.push_back(r.name()); });
+    REQUIRE(names == std::vector<std::string>{ "static_name", "static_answer" });
+
+    warm_up_statics();
+    REQUIRE(static_answer.is_initialized());
+    REQUIRE(static_init_count == 1);
+    REQUIRE(*static_answer == 42);
+    REQUIRE(static_init_count == 1);
+
+    bool all_initialized = true;
+    static_registration::for_each([&](const static_registration& r) { all_initialized &= r.is_initialized(); });
+    REQUIRE(all_initialized);
+}
 
 TEST_CASE("README Simple API")
 {
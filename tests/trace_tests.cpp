@@ -0,0 +1,73 @@
+// Built with CPPLAZY_ENABLE_INSTRUMENTATION, CPPLAZY_ENABLE_TRACING and CPPLAZY_ENABLE_PERF_COUNTERS (see CMakeLists.txt)
+#include "catch.hpp"
+#include <cpplazy/cpplazy.hpp>
+#include <cpplazy/trace.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cpplazy;
+using namespace std::literals;
+
+namespace
+{
+    size_t count(const std::string& text, const std::string& pattern)
+    {
+        size_t n = 0;
+        for (size_t pos = text.find(pattern); pos != std::string::npos; pos = text.find(pattern, pos + 1))
+        {
+            n++;
+        }
+        return n;
+    }
+}
+
+TEST_CASE("Chrome trace export")
+{
+    clear_trace();
+    REQUIRE(format_trace() == "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[]}\n");
+
+    lazy<void> slow{ "slow", [] { std::this_thread::sleep_for(20ms); } };
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < 3; i++)
+    {
+        threads.emplace_back([&] { slow.ensure(); });
+    }
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+
+    int attempts = 0;
+    lazy<int> failing_once{ "failing_once", [&] { if (++attempts == 1) throw std::runtime_error("failed"); return 42; } };
+    REQUIRE_FALSE(failing_once->has_value());
+    REQUIRE(*failing_once == 42);
+
+    lazy<int> unnamed{ [] { return 42; } };
+    REQUIRE(*unnamed == 42);
+
+    const std::string trace = format_trace();
+    REQUIRE(trace.rfind("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[{", 0) == 0);
+    REQUIRE(count(trace, "{\"name\":\"init slow\",\"cat\":\"cpplazy.init\",\"ph\":\"X\"") == 1);
+    REQUIRE(count(trace, "{\"name\":\"wait slow\",\"cat\":\"cpplazy.wait\",\"ph\":\"X\"") == slow.stats().waits);
+    REQUIRE(count(trace, "\"name\":\"init failing_once\"") == 2);
+    REQUIRE(count(trace, "\"succeeded\":false") == 1);
+    REQUIRE(count(trace, "\"name\":\"init 0x") == 1);
+
+    clear_trace();
+    REQUIRE(count(format_trace(), "\"ph\":\"X\"") == 0);
+}
+
+TEST_CASE("Trace ring buffer keeps the most recent events")
+{
+    clear_trace();
+    for (int i = 0; i < CPPLAZY_TRACE_BUFFER_SIZE + 10; i++)
+    {
+        lazy<int> l{ "l" + std::to_string(i), [] { return 1; } };
+        *l;
+    }
+    const std::string trace = format_trace();
+    REQUIRE(count(trace, "\"ph\":\"X\"") == CPPLAZY_TRACE_BUFFER_SIZE);
+    REQUIRE(trace.find("\"init l9\"") == std::string::npos);
+    REQUIRE(trace.find("\"init l" + std::to_string(CPPLAZY_TRACE_BUFFER_SIZE + 9) + "\"") != std::string::npos);
+}